@@ -0,0 +1,109 @@
+#include "audio.h"
+
+#include <math.h>
+
+// Fill the wavetable with one period of `tone` and set the phase step that plays it. An XO-CHIP
+// pattern's 128 samples are spread evenly over the table, so render() plays it like the square wave.
+static void set_tone(audio_t *audio, const audio_tone_t *tone)
+{
+    const uint32_t size = sizeof audio->wavetable / sizeof audio->wavetable[0];
+    const uint32_t pattern_bits = 8 * CHIP8_AUDIO_PATTERN_SIZE;
+
+    for(uint32_t i = 0; i < size; i++)
+    {
+        const uint32_t bit = i * pattern_bits / size;
+        const bool high = tone->pattern ? (tone->samples[bit / 8] >> (7 - bit % 8)) & 1 : i < size / 2;
+        audio->wavetable[i] = high ? audio->volume : -audio->volume;
+    }
+
+    // A pattern plays 4000 * 2^((pitch - 64) / 48) samples per second, a whole pattern per period
+    const double frequency = tone->pattern ? 4000.0 * exp2((tone->pitch - 64) / 48.0) / pattern_bits
+                                           : audio->square_wave_frequency;
+    audio->phase_step = (uint32_t) (frequency * 4294967296.0 / audio->sample_rate);
+    audio->tone = *tone;
+}
+
+// Precompute one period of the tone and the per sample phase step, called before the device is unpaused
+void audio_init(audio_t *audio, const config_t *config, const uint32_t sample_rate, const uint32_t buffer_samples)
+{
+    *audio = (audio_t) {
+        .sample_rate = sample_rate,
+        .frequency = SDL_GetPerformanceFrequency(),
+        .square_wave_frequency = config->square_wave_frequency,
+        .volume = config->volume,
+    };
+    audio->latency = audio->frequency * buffer_samples / sample_rate;
+    SDL_AtomicSet(&audio->head, 0);
+    SDL_AtomicSet(&audio->tail, 0);
+
+    set_tone(audio, &(audio_tone_t) {.pattern = false, .pitch = CHIP8_DEFAULT_PITCH});
+}
+
+// The tone a machine plays while its sound timer runs
+audio_tone_t audio_tone(const chip8_t *chip8)
+{
+    audio_tone_t tone = {.pattern = chip8->audio_pattern_set, .pitch = chip8->pitch};
+    memcpy(tone.samples, chip8->audio_pattern, sizeof tone.samples);
+    return tone;
+}
+
+// Queue a tone edge, called from the emulation thread. Returns false if the ring is full,
+// the caller should retry the edge later.
+bool audio_push(audio_t *audio, const bool on, const audio_tone_t *tone, const uint64_t time)
+{
+    const int head = SDL_AtomicGet(&audio->head);
+    if(head - SDL_AtomicGet(&audio->tail) == AUDIO_RING_SIZE) return false;
+
+    audio->events[head & (AUDIO_RING_SIZE - 1)] = (audio_event_t) {.time = time, .on = on, .tone = *tone};
+    SDL_AtomicSet(&audio->head, head + 1); // Publishes the event to the callback
+    return true;
+}
+
+// Render `count` samples of the current tone state, fading in or out instead of stepping
+static void render(audio_t *audio, int16_t *samples, const int count)
+{
+    const uint32_t full = 1 << AUDIO_RAMP_SHIFT;
+
+    for(int i = 0; i < count; i++)
+    {
+        if(audio->on && audio->level < full) audio->level++;
+        else if(!audio->on && audio->level > 0) audio->level--;
+
+        samples[i] = (audio->wavetable[audio->phase >> (32 - AUDIO_WAVETABLE_BITS)] * (int32_t) audio->level) >> AUDIO_RAMP_SHIFT;
+        audio->phase += audio->phase_step;
+    }
+}
+
+// SDL audio callback, runs on SDL's audio thread. Each queued edge is played `latency` after it
+// happened, which lands it inside the buffer being filled, at the matching sample.
+void audio_callback(void* userdata, uint8_t *stream, int len)
+{
+    audio_t *audio = userdata;
+    int16_t *samples = (int16_t *)stream;
+    const int count = len / sizeof *samples;
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    int tail = SDL_AtomicGet(&audio->tail);
+    const int head = SDL_AtomicGet(&audio->head);
+    int i = 0;
+
+    while(tail != head)
+    {
+        const audio_event_t *event = &audio->events[tail & (AUDIO_RING_SIZE - 1)];
+        const uint64_t due = event->time + audio->latency;
+        const uint64_t offset = due <= now ? 0 : (due - now) * audio->sample_rate / audio->frequency;
+        if(offset >= (uint64_t) count) break; // Belongs to a later buffer
+
+        if((int) offset > i)
+        {
+            render(audio, &samples[i], offset - i);
+            i = offset;
+        }
+        audio->on = event->on;
+        if(memcmp(&event->tone, &audio->tone, sizeof audio->tone) != 0) set_tone(audio, &event->tone);
+        tail++;
+    }
+
+    render(audio, &samples[i], count - i);
+    SDL_AtomicSet(&audio->tail, tail);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+#include "SDL.h"
+
+#define AUDIO_BUFFER_SAMPLES   256     // Device buffer, ~6ms at 44.1kHz
+#define AUDIO_RING_SIZE        64      // Pending on/off edges, must be a power of 2
+#define AUDIO_WAVETABLE_BITS   8       // Wavetable holds 1 << AUDIO_WAVETABLE_BITS samples of one period
+#define AUDIO_RAMP_SHIFT       6       // Tone fades in and out over 1 << AUDIO_RAMP_SHIFT samples to avoid clicks
+
+// What plays while the sound timer runs: the configured square wave, or an XO-CHIP pattern
+typedef struct {
+    bool pattern;       // Play `samples` at `pitch` instead of the square wave
+    uint8_t pitch;
+    uint8_t samples[CHIP8_AUDIO_PATTERN_SIZE];
+} audio_tone_t;
+
+// Tone edge pushed by the emulation thread
+typedef struct {
+    uint64_t time;      // SDL_GetPerformanceCounter() when the sound timer or tone changed
+    bool on;
+    audio_tone_t tone;  // Tone from this edge on
+} audio_event_t;
+
+// Audio Engine Object, shared between the emulation thread (producer) and the audio callback (consumer)
+typedef struct {
+    audio_event_t events[AUDIO_RING_SIZE];
+    SDL_atomic_t head;      // Next event slot to write, emulation thread only
+    SDL_atomic_t tail;      // Next event slot to read, audio callback only
+    int16_t wavetable[1 << AUDIO_WAVETABLE_BITS];   // One period of `tone`
+    audio_tone_t tone;
+    uint32_t phase;         // 32 bit fixed point position in the wavetable, top bits index it
+    uint32_t phase_step;
+    uint32_t square_wave_frequency;
+    int16_t volume;
+    uint32_t level;         // Fade envelope, 0 is silent and 1 << AUDIO_RAMP_SHIFT full volume
+    bool on;                // Tone state after the last applied event
+    uint32_t sample_rate;
+    uint64_t frequency;     // SDL_GetPerformanceFrequency()
+    uint64_t latency;       // Counter ticks from an edge to the callback that plays it, one device buffer
+} audio_t;
+
+void audio_init(audio_t *audio, const config_t *config, const uint32_t sample_rate, const uint32_t buffer_samples);
+audio_tone_t audio_tone(const chip8_t *chip8);
+bool audio_push(audio_t *audio, const bool on, const audio_tone_t *tone, const uint64_t time);
+void audio_callback(void* userdata, uint8_t *stream, int len);
@@ -0,0 +1,561 @@
+// Headless parallel batch runner.
+//
+// Runs a list of ROM jobs with no frontend on a work-stealing pool of threads, one per host core
+// by default, and reports a final state hash, the instructions run and the wall time of every job.
+// Optionally writes each job's final framebuffer as a bit-packed PBM image and its final save state.
+// Jobs run on the quirk profile's interpreter, or with --engine on one of the caching engines,
+// which only implement the modern profile and give the same final states.
+//
+// Jobs are read from a manifest file ("-" for stdin), one per line:
+//     <rom_path> <cycles> <seed> [state=<path>] [<tick>+<key> | <tick>-<key> ...]
+// `cycles` is the number of instructions to run, `seed` seeds CXNN, `state` starts the job from a
+// save state of the same ROM instead of booting it, and each optional key event presses (+) or
+// releases (-) the hex key before the given 60Hz tick runs. Blank lines and lines starting with #
+// are skipped.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_batch
+// Usage:
+//     chip8_batch [--json] [--threads <n>] [--ips <n>] [--quirks <profile>] [--engine <name>]
+//                 [--snapshots <dir>] [--save-states <dir>] <manifest>
+
+#include "common.h"
+#include "chip8.h"
+#include "emulator.h"
+#include "scheduler.h"
+#include "savestate.h"
+#include "decode.h"
+#include "block.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define BATCH_MAX_KEY_EVENTS 64
+
+// Scripted key press or release
+typedef struct {
+    uint64_t tick;
+    uint8_t key;
+    bool down;
+} batch_key_event_t;
+
+// Batch Job Object: parameters from the manifest plus the results filled in by a worker
+typedef struct {
+    char rom_path[256];
+    char state_path[256];     // Empty to boot the ROM
+    uint64_t cycles;
+    uint32_t seed;
+    batch_key_event_t keys[BATCH_MAX_KEY_EVENTS];
+    uint8_t num_keys;
+
+    bool ok;
+    uint64_t hash;
+    uint64_t ticks;
+    uint64_t elapsed_ns;
+    chip8_row_t display[CHIP8_HIRES_HEIGHT];  // Pixels lit on any plane
+    bool hires;
+    uint8_t *state;                         // Final save state, only kept with --save-states
+    size_t state_size;
+} batch_job_t;
+
+// Engine every job runs on, selected with --engine
+typedef enum {
+    BATCH_ENGINE_INTERPRETER,   // The quirk profile's interpreter, see chip8_runner()
+    BATCH_ENGINE_DECODED,       // Pre-decoded instruction cache, see decode_cache_run()
+    BATCH_ENGINE_BLOCK,         // Basic block translation cache, see block_cache_run()
+    BATCH_ENGINE_JIT,           // x86-64 native code, interprets on other hosts, see jit_run()
+    BATCH_ENGINE_COUNT
+} batch_engine_t;
+
+static const char *engine_names[BATCH_ENGINE_COUNT] = {"interpreter", "decoded", "block", "jit"};
+
+// A worker's engine state, flushed for every job it runs
+typedef struct {
+    decode_cache_t *decode;
+    block_cache_t *block;
+    jit_t *jit;
+} batch_engine_state_t;
+
+// Per worker deque of job indices. The owner pops from the back, idle workers steal from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *jobs;
+    uint32_t front, back;
+} batch_queue_t;
+
+// Shared state of the whole run
+typedef struct {
+    batch_job_t *jobs;
+    batch_queue_t *queues;
+    uint32_t num_workers;
+    uint32_t instructions_per_second;
+    chip8_run_t run;            // Interpreter for the quirk profile every job runs with
+    batch_engine_t engine;
+    uint32_t ram_size;          // RAM of every job's machine, as much as the profile needs
+    bool save_states;
+} batch_pool_t;
+
+// Worker thread argument
+typedef struct {
+    batch_pool_t *pool;
+    uint32_t id;
+} batch_worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Parse one manifest line into a job, returns false on malformed input
+static bool parse_job(char *line, batch_job_t *job)
+{
+    char *save;
+    const char *rom_path = strtok_r(line, " \t\r\n", &save);
+    const char *cycles = strtok_r(NULL, " \t\r\n", &save);
+    const char *seed = strtok_r(NULL, " \t\r\n", &save);
+    if(!rom_path || !cycles || !seed || strlen(rom_path) >= sizeof job->rom_path) return false;
+
+    char *cycles_end, *seed_end;
+    *job = (batch_job_t) {
+        .cycles = strtoull(cycles, &cycles_end, 0),
+        .seed = strtoul(seed, &seed_end, 0),
+    };
+    if(*cycles_end != '\0' || *seed_end != '\0' || strtoull(seed, NULL, 0) > UINT32_MAX) return false;
+    strcpy(job->rom_path, rom_path);
+
+    for(const char *event = strtok_r(NULL, " \t\r\n", &save); event; event = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if(!strncmp(event, "state=", 6))
+        {
+            if(strlen(event + 6) >= sizeof job->state_path) return false;
+            strcpy(job->state_path, event + 6);
+            continue;
+        }
+
+        char *sign;
+        const uint64_t tick = strtoull(event, &sign, 10);
+        if(job->num_keys == BATCH_MAX_KEY_EVENTS || (*sign != '+' && *sign != '-')) return false;
+
+        char *end;
+        const unsigned long key = strtoul(sign + 1, &end, 16);
+        if(*end != '\0' || end == sign + 1 || key > 0xF) return false;
+
+        job->keys[job->num_keys++] = (batch_key_event_t) {.tick = tick, .key = key, .down = *sign == '+'};
+    }
+
+    return true;
+}
+
+// Print `text` as a JSON string, quotes included
+static void print_json_string(const char *text)
+{
+    putchar('"');
+    for(const unsigned char *c = (const unsigned char *) text; *c; c++)
+    {
+        if(*c == '"' || *c == '\\') printf("\\%c", *c);
+        else if(*c < 0x20) printf("\\u%04x", *c);
+        else putchar(*c);
+    }
+    putchar('"');
+}
+
+// First tick after `tick` with a key event, UINT64_MAX if there is none
+static uint64_t next_key_tick(const batch_job_t *job, const uint64_t tick)
+{
+    uint64_t next = UINT64_MAX;
+    for(uint8_t i = 0; i < job->num_keys; i++)
+    {
+        if(job->keys[i].tick > tick && job->keys[i].tick < next) next = job->keys[i].tick;
+    }
+    return next;
+}
+
+// Allocate a worker's state for `engine`, returns false if out of memory
+static bool create_engine_state(batch_engine_state_t *state, const batch_engine_t engine)
+{
+    *state = (batch_engine_state_t) {0};
+    if(engine == BATCH_ENGINE_DECODED) state->decode = malloc(sizeof *state->decode);
+    if(engine == BATCH_ENGINE_BLOCK) state->block = malloc(sizeof *state->block);
+    if(engine == BATCH_ENGINE_JIT && (state->jit = malloc(sizeof *state->jit))) jit_init(state->jit); // Interprets if it fails
+    return engine == BATCH_ENGINE_INTERPRETER || state->decode || state->block || state->jit;
+}
+
+static void destroy_engine_state(batch_engine_state_t *state)
+{
+    free(state->decode);
+    free(state->block);
+    if(state->jit) jit_destroy(state->jit);
+    free(state->jit);
+}
+
+// Drop whatever the engine cached about the previous job's RAM
+static void reset_engine_state(batch_engine_state_t *state)
+{
+    if(state->decode) decode_cache_reset(state->decode);
+    if(state->block) block_cache_reset(state->block);
+    if(state->jit) jit_reset(state->jit);
+}
+
+static uint32_t run_engine(const batch_pool_t *pool, batch_engine_state_t *state, chip8_t *chip8, const uint32_t cycles)
+{
+    switch(pool->engine)
+    {
+        case BATCH_ENGINE_DECODED: return decode_cache_run(chip8, state->decode, cycles);
+        case BATCH_ENGINE_BLOCK: return block_cache_run(chip8, state->block, cycles);
+        case BATCH_ENGINE_JIT: return jit_run(chip8, state->jit, cycles);
+        default: return pool->run(chip8, cycles);
+    }
+}
+
+// Run one job to completion on the worker's machine, reloaded from scratch, 60Hz tick by tick
+// like the frontend. `base_ram` has room for the machine's RAM.
+static void run_job(batch_job_t *job, chip8_t *chip8, uint8_t *base_ram, const batch_pool_t *pool,
+                    batch_engine_state_t *engine)
+{
+    const uint32_t instructions_per_second = pool->instructions_per_second;
+    scheduler_t scheduler = {0}; // Only used to split instructions_per_second into ticks
+
+    const uint64_t start = now_ns();
+    job->ok = init_chip8(chip8, job->rom_path);
+    if(!job->ok) return;
+    chip8_seed(chip8, job->seed);
+
+    // Save states hold RAM as a delta against the freshly loaded ROM
+    memcpy(base_ram, chip8->ram, chip8->ram_size);
+    if(job->state_path[0])
+    {
+        job->ok = chip8_load_state_file(chip8, base_ram, job->state_path);
+        if(!job->ok) return;
+    }
+    reset_engine_state(engine);
+
+    uint64_t remaining = job->cycles;
+    for(job->ticks = 0; remaining > 0; job->ticks++)
+    {
+        // Key events due this tick are applied in manifest order
+        for(uint8_t i = 0; i < job->num_keys; i++)
+        {
+            if(job->keys[i].tick != job->ticks) continue;
+            const uint16_t bit = 1 << job->keys[i].key;
+            chip8->keypad = job->keys[i].down ? chip8->keypad | bit : chip8->keypad & ~bit;
+        }
+
+        uint64_t cycles = scheduler_cycles(&scheduler, instructions_per_second);
+        if(cycles > remaining) cycles = remaining;
+        remaining -= cycles;
+
+        const uint32_t events = run_engine(pool, engine, chip8, cycles);
+        update_timers(chip8);
+
+        // Only the timers change until the next key event, fast-forward to it
+        if((events & (CHIP8_EVENT_WAIT_KEY | CHIP8_EVENT_IDLE)) && chip8_stalled(chip8))
+        {
+            const uint64_t next_key = next_key_tick(job, job->ticks);
+            for(; remaining > 0 && job->ticks + 1 < next_key; job->ticks++)
+            {
+                cycles = scheduler_cycles(&scheduler, instructions_per_second);
+                remaining -= cycles < remaining ? cycles : remaining;
+                update_timers(chip8);
+            }
+        }
+    }
+
+    job->elapsed_ns = now_ns() - start;
+    job->hash = chip8_hash(chip8);
+    for(uint32_t y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+    {
+        job->display[y] = chip8->display[0][y] | chip8->display[1][y];
+    }
+    job->hires = chip8->hires;
+    if(pool->save_states)
+    {
+        const size_t max_size = CHIP8_STATE_MAX_SIZE(chip8->ram_size);
+        job->state = malloc(max_size);
+        job->ok = job->state != NULL;
+        if(job->ok) job->state_size = chip8_save_state(chip8, base_ram, job->state, max_size);
+    }
+}
+
+// Look up an engine by its command line name
+static bool engine_from_name(const char *name, batch_engine_t *engine)
+{
+    for(uint32_t i = 0; i < BATCH_ENGINE_COUNT; i++)
+    {
+        if(!strcmp(name, engine_names[i]))
+        {
+            *engine = i;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "Unknown engine %s, expected one of:", name);
+    for(uint32_t i = 0; i < BATCH_ENGINE_COUNT; i++) fprintf(stderr, " %s", engine_names[i]);
+    fprintf(stderr, "\n");
+    return false;
+}
+
+// Take a job index from the back of our own queue, or steal one from the front of another's
+static bool next_job(batch_pool_t *pool, const uint32_t id, uint32_t *job)
+{
+    for(uint32_t n = 0; n < pool->num_workers; n++)
+    {
+        batch_queue_t *queue = &pool->queues[(id + n) % pool->num_workers];
+        bool found = false;
+
+        pthread_mutex_lock(&queue->lock);
+        if(queue->front != queue->back)
+        {
+            *job = n == 0 ? queue->jobs[--queue->back] : queue->jobs[queue->front++];
+            found = true;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if(found) return true;
+    }
+
+    return false; // No new jobs are ever queued, so every queue is empty for good
+}
+
+static void *worker_thread(void *data)
+{
+    const batch_worker_t *worker = data;
+    batch_pool_t *pool = worker->pool;
+    uint32_t job;
+
+    // One machine and engine per worker, reloaded for every job it runs
+    chip8_t *chip8 = chip8_create(pool->ram_size);
+    uint8_t *base_ram = malloc(pool->ram_size);
+    batch_engine_state_t engine;
+    const bool engine_ok = create_engine_state(&engine, pool->engine);
+
+    while(next_job(pool, worker->id, &job))
+    {
+        if(!chip8 || !base_ram || !engine_ok)
+        {
+            pool->jobs[job].ok = false;
+            continue;
+        }
+        run_job(&pool->jobs[job], chip8, base_ram, pool, &engine);
+    }
+
+    chip8_destroy(chip8);
+    free(base_ram);
+    destroy_engine_state(&engine);
+    return NULL;
+}
+
+// Write a job's framebuffer as a binary PBM, whose 1 bit per pixel MSB first rows match the display
+static bool write_snapshot(const char *dir, const uint32_t index, const batch_job_t *job)
+{
+    char path[512];
+    snprintf(path, sizeof path, "%s/%u.pbm", dir, index);
+
+    FILE *file = fopen(path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not write snapshot %s\n", path);
+        return false;
+    }
+
+    const uint32_t width = job->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    const uint32_t height = job->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    fprintf(file, "P4\n%u %u\n", width, height);
+    for(uint32_t y = 0; y < height; y++)
+    {
+        for(int shift = 120; shift >= 128 - (int) width; shift -= 8)
+        {
+            fputc((job->display[y] >> shift) & 0xFF, file);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Write a job's final save state
+static bool write_state(const char *dir, const uint32_t index, const batch_job_t *job)
+{
+    char path[512];
+    snprintf(path, sizeof path, "%s/%u.c8st", dir, index);
+
+    FILE *file = fopen(path, "wb");
+    if(!file || fwrite(job->state, job->state_size, 1, file) != 1)
+    {
+        fprintf(stderr, "Could not write save state %s\n", path);
+        if(file) fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    const char* manifest_path = NULL;
+    const char* snapshot_dir = NULL;
+    const char* state_dir = NULL;
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t instructions_per_second = 500;
+    chip8_quirk_profile_t quirk_profile = CHIP8_QUIRKS_MODERN;
+    batch_engine_t engine = BATCH_ENGINE_INTERPRETER;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--json"))
+        {
+            json = true;
+        } else if(!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            num_workers = strtol(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--ips") && i + 1 < argc) {
+            instructions_per_second = strtoul(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--quirks") && i + 1 < argc) {
+            if(!chip8_quirk_profile_from_name(argv[++i], &quirk_profile)) exit(EXIT_FAILURE);
+        } else if(!strcmp(argv[i], "--engine") && i + 1 < argc) {
+            if(!engine_from_name(argv[++i], &engine)) exit(EXIT_FAILURE);
+        } else if(!strcmp(argv[i], "--snapshots") && i + 1 < argc) {
+            snapshot_dir = argv[++i];
+        } else if(!strcmp(argv[i], "--save-states") && i + 1 < argc) {
+            state_dir = argv[++i];
+        } else if(!manifest_path && (argv[i][0] != '-' || !strcmp(argv[i], "-"))) {
+            manifest_path = argv[i];
+        } else {
+            manifest_path = NULL;
+            break;
+        }
+    }
+    if(!manifest_path)
+    {
+        fprintf(stderr, "Usage: %s [--json] [--threads <n>] [--ips <n>] [--quirks <profile>] [--engine <name>] "
+                        "[--snapshots <dir>] [--save-states <dir>] <manifest>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if(engine != BATCH_ENGINE_INTERPRETER && quirk_profile != CHIP8_QUIRKS_MODERN)
+    {
+        fprintf(stderr, "The %s engine only runs the modern quirk profile\n", engine_names[engine]);
+        exit(EXIT_FAILURE);
+    }
+    if(num_workers < 1) num_workers = 1;
+    if(instructions_per_second == 0) instructions_per_second = 1;
+
+    // Read the manifest
+    FILE *manifest = strcmp(manifest_path, "-") ? fopen(manifest_path, "r") : stdin;
+    if(!manifest)
+    {
+        fprintf(stderr, "Manifest %s is invalid or does not exist\n", manifest_path);
+        exit(EXIT_FAILURE);
+    }
+
+    batch_job_t *jobs = NULL;
+    uint32_t num_jobs = 0, capacity = 0;
+    char line[4096];
+    for(uint32_t line_number = 1; fgets(line, sizeof line, manifest); line_number++)
+    {
+        const char *text = line + strspn(line, " \t");
+        if(*text == '#' || *text == '\n' || *text == '\r' || *text == '\0') continue;
+
+        if(num_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof *jobs);
+            if(!jobs)
+            {
+                fprintf(stderr, "Out of memory reading the manifest\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if(!parse_job(line, &jobs[num_jobs]))
+        {
+            fprintf(stderr, "%s:%u: invalid job\n", manifest_path, line_number);
+            exit(EXIT_FAILURE);
+        }
+        num_jobs++;
+    }
+    if(manifest != stdin) fclose(manifest);
+
+    // Deal the jobs round robin, stealing evens out whatever imbalance is left
+    if((long) num_jobs < num_workers) num_workers = num_jobs ? num_jobs : 1;
+    batch_pool_t pool = {
+        .jobs = jobs,
+        .queues = calloc(num_workers, sizeof *pool.queues),
+        .num_workers = num_workers,
+        .instructions_per_second = instructions_per_second,
+        .run = chip8_runner(quirk_profile),
+        .engine = engine,
+        .ram_size = chip8_ram_size(quirk_profile),
+        .save_states = state_dir != NULL,
+    };
+    uint32_t *indices = malloc((num_jobs ? num_jobs : 1) * sizeof *indices);
+    pthread_t *threads = malloc(num_workers * sizeof *threads);
+    batch_worker_t *workers = malloc(num_workers * sizeof *workers);
+    if(!pool.queues || !indices || !threads || !workers)
+    {
+        fprintf(stderr, "Out of memory setting up %ld workers\n", num_workers);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t next = 0;
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        batch_queue_t *queue = &pool.queues[w];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->jobs = &indices[next];
+        for(uint32_t j = w; j < num_jobs; j += num_workers)
+        {
+            indices[next++] = j;
+        }
+        queue->back = &indices[next] - queue->jobs;
+    }
+
+    const uint64_t start = now_ns();
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        workers[w] = (batch_worker_t) {.pool = &pool, .id = w};
+        if(pthread_create(&threads[w], NULL, worker_thread, &workers[w]) != 0)
+        {
+            fprintf(stderr, "Could not create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    const uint64_t elapsed = now_ns() - start;
+
+    // Report in manifest order
+    uint32_t failed = 0;
+    if(json) printf("{\n  \"threads\": %ld,\n  \"elapsed_ns\": %llu,\n  \"jobs\": [", num_workers, (unsigned long long) elapsed);
+    else printf("%-6s %-32s %18s %12s %12s\n", "job", "rom", "hash", "ticks", "ms");
+
+    for(uint32_t j = 0; j < num_jobs; j++)
+    {
+        const batch_job_t *job = &jobs[j];
+        if(!job->ok) failed++;
+        if(job->ok && snapshot_dir && !write_snapshot(snapshot_dir, j, job)) failed++;
+        if(job->ok && state_dir && !write_state(state_dir, j, job)) failed++;
+
+        if(json)
+        {
+            printf("%s\n    {\"job\": %u, \"rom\": ", j ? "," : "", j);
+            print_json_string(job->rom_path);
+            printf(", \"ok\": %s, \"hash\": \"%016llx\", \"ticks\": %llu, \"elapsed_ns\": %llu}",
+                   job->ok ? "true" : "false", (unsigned long long) job->hash,
+                   (unsigned long long) job->ticks, (unsigned long long) job->elapsed_ns);
+        } else {
+            char hash[17] = "failed";
+            if(job->ok) snprintf(hash, sizeof hash, "%016llx", (unsigned long long) job->hash);
+            printf("%-6u %-32s %18s %12llu %12.3f\n", j, job->rom_path, hash,
+                   (unsigned long long) job->ticks, job->elapsed_ns / 1e6);
+        }
+    }
+
+    if(json) printf("\n  ]\n}\n");
+    else printf("%u jobs, %u failed, %ld threads, %.3f ms\n", num_jobs, failed, num_workers, elapsed / 1e6);
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
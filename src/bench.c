@@ -0,0 +1,640 @@
+// Headless interpreter throughput benchmark.
+//
+// Runs the CHIP8 core with no frontend and no frame pacing over a set of synthetic ROMs,
+// each one stressing a different part of the interpreter, and reports instructions/sec,
+// ns/instruction and host cycles/instruction. The whole-program workloads mix opcodes the way
+// ROMs do, the op.* microbenchmarks loop over a single opcode class each. Every engine's final
+// machine state is checked against the plain switch interpreter's, a mismatch is reported and
+// fails the run. The lockstep engine runs LOCKSTEP_LANES machines with their own seeds and keys,
+// and every lane is checked. The jit-check engine also runs every compiled block against the
+// interpreter and fails the run if any block disagrees. An engine that must not run slower than
+// the switch interpreter on a workload is timed against it in alternating runs, and fails the run
+// if its best run is slower.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_bench
+// Usage:
+//     chip8_bench [--json] [--workload <name>] [--engine <name>] [--instructions <n>] [--repeat <n>]
+
+#include "common.h"
+#include "chip8.h"
+#include "emulator.h"
+#include "decode.h"
+#include "block.h"
+#include "jit.h"
+#include "lockstep.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAVE_RDTSC 1
+#else
+    #define HAVE_RDTSC 0
+#endif
+
+// Number of instructions executed between update_timers() calls, ~30k IPS at 60Hz
+#define BENCH_INSTRUCTIONS_PER_FRAME 500
+
+// Alternating runs of an engine and the switch interpreter behind a not_slower_on check
+#define BENCH_PACE_PAIRS 5
+
+// Synthetic ROM Object
+typedef struct {
+    const char* name;
+    uint8_t rom[0x200];
+    size_t size;
+} bench_rom_t;
+
+// Interpreter engine under test, runs `count` instructions on an initialized machine.
+// Engines running several machines at once run `count` on each and leave the first in `chip8`.
+typedef struct {
+    const char* name;
+    void (*run)(chip8_t* chip8, uint64_t count);
+    uint32_t machines;                              // Machines run side by side
+    bool (*check)(const bench_rom_t* rom, uint64_t count); // Checks the other machines after a run, NULL if none
+    const char* not_slower_on;                      // Workload it must keep up with the switch interpreter on, NULL if none
+} bench_engine_t;
+
+// Result of one workload/engine pair
+typedef struct {
+    const char* workload;
+    const char* engine;
+    uint64_t instructions;
+    double ns_per_instruction;      // Median over all repeats
+    double ns_per_instruction_min;  // Best repeat
+    double cycles_per_instruction;  // Median, host TSC cycles, 0 if unavailable
+    double instructions_per_second;
+    bool state_matches;             // Every repeat ended in the switch interpreter's state
+} bench_result_t;
+
+// Append a 16 bit opcode to a ROM being assembled
+static void emit(bench_rom_t* rom, const uint16_t opcode)
+{
+    rom->rom[rom->size++] = opcode >> 8;
+    rom->rom[rom->size++] = opcode & 0xFF;
+}
+
+// Pad the ROM with zeroes until the next opcode lands on `address`
+static void org(bench_rom_t* rom, const uint16_t address)
+{
+    while(CHIP8_ENTRY_POINT + rom->size < address) rom->rom[rom->size++] = 0;
+}
+
+// Tight ALU loop: 7XNN and every 8XYN arithmetic/logic op
+static void build_alu(bench_rom_t* rom)
+{
+    emit(rom, 0x6001); // 200: V0 = 1
+    emit(rom, 0x6102); // 202: V1 = 2
+    emit(rom, 0x7001); // 204: V0 += 1
+    emit(rom, 0x8014); // 206: V0 += V1
+    emit(rom, 0x8125); // 208: V1 -= V2
+    emit(rom, 0x8232); // 20A: V2 &= V3
+    emit(rom, 0x8301); // 20C: V3 |= V0
+    emit(rom, 0x8413); // 20E: V4 ^= V1
+    emit(rom, 0x8406); // 210: V4 >>= 1
+    emit(rom, 0x850E); // 212: V5 <<= 1
+    emit(rom, 0x8517); // 214: V5 = V1 - V5
+    emit(rom, 0x8600); // 216: V6 = V0
+    emit(rom, 0x1204); // 218: jump 204
+}
+
+// DXYN heavy sprite blitter, font glyphs drawn all over the screen including the clipped edges
+static void build_sprite(bench_rom_t* rom)
+{
+    emit(rom, 0xA000); // 200: I = 0 (font)
+    emit(rom, 0x6000); // 202: V0 = 0
+    emit(rom, 0x6100); // 204: V1 = 0
+    emit(rom, 0xD015); // 206: draw 8x5 at V0, V1
+    emit(rom, 0x7003); // 208: V0 += 3
+    emit(rom, 0x7105); // 20A: V1 += 5
+    emit(rom, 0xF229); // 20C: I = font[V2]
+    emit(rom, 0x7201); // 20E: V2 += 1
+    emit(rom, 0xD01F); // 210: draw 8x15 at V0, V1
+    emit(rom, 0x1206); // 212: jump 206
+}
+
+// Call/return storm, nests 10 subroutines deep on the 12 entry stack
+static void build_call(bench_rom_t* rom)
+{
+    const uint16_t depth = 10;
+
+    emit(rom, 0x2210); // 200: call 210
+    emit(rom, 0x1200); // 202: jump 200
+    for(uint16_t level = 0; level < depth; level++)
+    {
+        const uint16_t address = 0x210 + level * 0x10;
+        org(rom, address);
+        if(level + 1 < depth)
+        {
+            emit(rom, 0x2000 | (address + 0x10)); // call next level
+        } else {
+            emit(rom, 0x7001); // V0 += 1
+        }
+        emit(rom, 0x00EE); // return
+    }
+}
+
+// FX55/FX65 register dumps and loads, plus FX33 BCD stores
+static void build_memory(bench_rom_t* rom)
+{
+    emit(rom, 0xA300); // 200: I = 300
+    emit(rom, 0xFF55); // 202: store V0-VF at I
+    emit(rom, 0xFF65); // 204: load V0-VF from I
+    emit(rom, 0xF733); // 206: BCD of V7 at I
+    emit(rom, 0x7701); // 208: V7 += 1
+    emit(rom, 0x1200); // 20A: jump 200
+}
+
+// Self-modifying code: rewrites an already run instruction through an I past 0xFFF, which lands
+// back in the 4KB of RAM. Engines caching translated code must notice the write.
+static void build_selfmod(bench_rom_t* rom)
+{
+    emit(rom, 0x606A); // 200: V0 = 6A, opcode of VA = NN
+    emit(rom, 0x6100); // 202: V1 = 0
+    emit(rom, 0x62FF); // 204: V2 = FF
+    emit(rom, 0x6323); // 206: V3 = 23
+    emit(rom, 0x7101); // 208: V1 += 1
+    emit(rom, 0xAFFF); // 20A: I = FFF
+    emit(rom, 0xF21E); // 20C: I += V2
+    emit(rom, 0xF21E); // 20E: I += V2
+    emit(rom, 0xF31E); // 210: I += V3, now 1220, which is RAM address 220
+    emit(rom, 0xF155); // 212: store V0-V1 at I, rewrites 220 as VA = V1
+    emit(rom, 0x1220); // 214: jump 220
+    org(rom, 0x220);
+    emit(rom, 0x6A00); // 220: VA = NN, NN is rewritten every loop
+    emit(rom, 0x8BA4); // 222: VB += VA
+    emit(rom, 0x1208); // 224: jump 208
+}
+
+// Opcode class microbenchmark: `body` repeated to fill a 32 instruction loop. I starts at 0x300,
+// clear of the code, V0 = 5 and V1 = 7, and a subroutine that only returns sits at 0x2F0.
+static void build_micro(bench_rom_t* rom, const uint16_t body[], const size_t length)
+{
+    emit(rom, 0xA300); // 200: I = 300
+    emit(rom, 0x6005); // 202: V0 = 5
+    emit(rom, 0x6107); // 204: V1 = 7
+    for(size_t i = 0; i < 32; i++)
+    {
+        emit(rom, body[i % length]);
+    }
+    emit(rom, 0x1206); // jump 206
+    org(rom, 0x2F0);
+    emit(rom, 0x00EE); // 2F0: return
+}
+
+// Game-like mix of random movement, skips, sprite drawing, key checks, timers and subroutines
+static void build_mixed(bench_rom_t* rom)
+{
+    emit(rom, 0x00E0); // 200: clear screen
+    emit(rom, 0x6000); // 202: V0 = 0
+    emit(rom, 0x6108); // 204: V1 = 8
+    emit(rom, 0x6A3C); // 206: VA = 60
+    emit(rom, 0xFA15); // 208: delay = VA
+    emit(rom, 0xC207); // 20A: V2 = rand & 7
+    emit(rom, 0x8024); // 20C: V0 += V2
+    emit(rom, 0x3000); // 20E: skip if V0 == 0
+    emit(rom, 0x7101); // 210: V1 += 1
+    emit(rom, 0x4140); // 212: skip if V1 != 40
+    emit(rom, 0x6100); // 214: V1 = 0
+    emit(rom, 0xF529); // 216: I = font[V5]
+    emit(rom, 0xD015); // 218: draw 8x5 at V0, V1
+    emit(rom, 0xE39E); // 21A: skip if key V3 pressed
+    emit(rom, 0x2230); // 21C: call 230
+    emit(rom, 0xF407); // 21E: V4 = delay
+    emit(rom, 0x3400); // 220: skip if V4 == 0
+    emit(rom, 0x120A); // 222: jump 20A
+    emit(rom, 0xFA15); // 224: delay = VA
+    emit(rom, 0x120A); // 226: jump 20A
+    org(rom, 0x230);
+    emit(rom, 0xA300); // 230: I = 300
+    emit(rom, 0xF433); // 232: BCD of V4 at I
+    emit(rom, 0xF565); // 234: load V0-V5 from I
+    emit(rom, 0x00EE); // 236: return
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// One opcode class per microbenchmark, see build_micro()
+static const struct {
+    const char* name;
+    uint16_t body[4];
+    size_t length;
+} micros[] = {
+    {"op.imm",   {0x6234, 0x7301, 0x6412, 0x7501}, 4},   // 6XNN, 7XNN
+    {"op.alu",   {0x8014, 0x8125, 0x8236, 0x831E}, 4},   // 8XYN arithmetic and shifts
+    {"op.logic", {0x8010, 0x8121, 0x8232, 0x8303}, 4},   // 8XY0-8XY3
+    {"op.skip",  {0x3006, 0x4107, 0x5010, 0x9000}, 4},   // 3XNN, 4XNN, 5XY0, 9XY0, never taken
+    {"op.index", {0xA300, 0xF01E, 0xF129, 0xF11E}, 4},   // ANNN, FX1E, FX29
+    {"op.rand",  {0xC2FF, 0xC30F}, 2},                   // CXNN
+    {"op.draw",  {0xF029, 0xD015, 0xF129, 0xD105}, 4},   // DXYN of font glyphs
+    {"op.clear", {0x00E0}, 1},                           // 00E0
+    {"op.bcd",   {0xF033, 0xF133}, 2},                   // FX33
+    {"op.store", {0xFF55}, 1},                           // FX55 of every register
+    {"op.load",  {0xFF65}, 1},                           // FX65 of every register
+    {"op.call",  {0x22F0}, 1},                           // 2NNN, 00EE
+    {"op.timer", {0xF015, 0xF207, 0xF118, 0xF307}, 4},   // FX07, FX15, FX18
+    {"op.key",   {0xE09E, 0xE1A1}, 2},                   // EX9E, EXA1, key never held
+};
+
+// Reference engine: the plain switch interpreter, one emulate_instruction() per step
+static void run_switch(chip8_t* chip8, uint64_t count)
+{
+    while(count > 0)
+    {
+        const uint64_t frame = count < BENCH_INSTRUCTIONS_PER_FRAME ? count : BENCH_INSTRUCTIONS_PER_FRAME;
+        for(uint64_t i = 0; i < frame; i++)
+        {
+            emulate_instruction(chip8);
+        }
+        update_timers(chip8);
+        count -= frame;
+    }
+}
+
+// Pre-decoded instruction cache with threaded dispatch
+static void run_decoded(chip8_t* chip8, uint64_t count)
+{
+    static decode_cache_t cache;
+    decode_cache_reset(&cache);
+
+    while(count > 0)
+    {
+        const uint64_t frame = count < BENCH_INSTRUCTIONS_PER_FRAME ? count : BENCH_INSTRUCTIONS_PER_FRAME;
+        decode_cache_run(chip8, &cache, frame);
+        update_timers(chip8);
+        count -= frame;
+    }
+}
+
+// Basic block translation cache
+static void run_block(chip8_t* chip8, uint64_t count)
+{
+    static block_cache_t cache;
+    block_cache_reset(&cache);
+
+    while(count > 0)
+    {
+        const uint64_t frame = count < BENCH_INSTRUCTIONS_PER_FRAME ? count : BENCH_INSTRUCTIONS_PER_FRAME;
+        block_cache_run(chip8, &cache, frame);
+        update_timers(chip8);
+        count -= frame;
+    }
+}
+
+// x86-64 JIT, interprets everything on other hosts. Runs on a fresh `jit` each time.
+static void run_jit_on(chip8_t* chip8, jit_t* jit, const bool self_check, uint64_t count)
+{
+    jit_destroy(jit);
+    jit_init(jit);
+    jit->self_check = self_check;
+
+    while(count > 0)
+    {
+        const uint64_t frame = count < BENCH_INSTRUCTIONS_PER_FRAME ? count : BENCH_INSTRUCTIONS_PER_FRAME;
+        jit_run(chip8, jit, frame);
+        update_timers(chip8);
+        count -= frame;
+    }
+}
+
+static void run_jit(chip8_t* chip8, uint64_t count)
+{
+    static jit_t jit;
+    run_jit_on(chip8, &jit, false, count);
+}
+
+// JIT with every block checked against the interpreter. Mismatching blocks are replaced by the
+// interpreter's state, so they are counted in `jit_check_mismatches` for check_jit().
+static jit_t jit_checked;
+static uint64_t jit_check_mismatches;
+
+static void run_jit_check(chip8_t* chip8, uint64_t count)
+{
+    run_jit_on(chip8, &jit_checked, true, count);
+    jit_check_mismatches += jit_checked.mismatches;
+}
+
+// No compiled block may have disagreed with the interpreter over any run of the workload
+static bool check_jit(const bench_rom_t* rom, uint64_t count)
+{
+    (void) count;
+    const bool ok = jit_check_mismatches == 0;
+    if(!ok) fprintf(stderr, "jit-check on %s: %llu blocks differ from the interpreter\n", rom->name,
+                    (unsigned long long) jit_check_mismatches);
+    jit_check_mismatches = 0;
+    return ok;
+}
+
+// Keys held by lockstep lane `lane`. Together with a CXNN seed per lane this makes the lanes
+// diverge. Lane 0 keeps the machine as it is, it is compared with the other engines.
+static uint16_t lane_keypad(const uint32_t lane)
+{
+    return lane % 3 == 1 ? 1 << (lane & 15) : 0;
+}
+
+static void setup_lane(chip8_t* chip8, const uint32_t lane)
+{
+    if(lane == 0) return;
+    chip8_seed(chip8, lane);
+    chip8->keypad = lane_keypad(lane);
+}
+
+// Lockstep engine, LOCKSTEP_LANES machines of the same ROM. Left in `lockstep` for check_lockstep().
+static _Alignas(64) lockstep_t lockstep;
+
+static void run_lockstep(chip8_t* chip8, uint64_t count)
+{
+    lockstep_init(&lockstep, chip8);
+    for(uint32_t lane = 1; lane < LOCKSTEP_LANES; lane++)
+    {
+        lockstep_seed(&lockstep, lane, lane);
+        lockstep.keypad[lane] = lane_keypad(lane);
+    }
+
+    while(count > 0)
+    {
+        const uint64_t frame = count < BENCH_INSTRUCTIONS_PER_FRAME ? count : BENCH_INSTRUCTIONS_PER_FRAME;
+        lockstep_run(&lockstep, frame);
+        lockstep_update_timers(&lockstep);
+        count -= frame;
+    }
+
+    lockstep_load_lane(&lockstep, 0, chip8);
+}
+
+// Every lane of the last lockstep run must end where the switch interpreter ends the same machine
+static bool check_lockstep(const bench_rom_t* rom, uint64_t count)
+{
+    chip8_t *reference = chip8_create(CHIP8_RAM_SIZE);
+    chip8_t *lane_machine = chip8_create(CHIP8_RAM_SIZE);
+    if(!reference || !lane_machine) exit(EXIT_FAILURE);
+
+    bool ok = true;
+    for(uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        init_chip8_from_memory(reference, rom->rom, rom->size, rom->name);
+        setup_lane(reference, lane);
+        run_switch(reference, count);
+
+        init_chip8_from_memory(lane_machine, rom->rom, rom->size, rom->name);
+        lockstep_load_lane(&lockstep, lane, lane_machine);
+        if(chip8_hash(lane_machine) != chip8_hash(reference))
+        {
+            fprintf(stderr, "lockstep lane %u on %s: final state differs from the switch interpreter\n", lane, rom->name);
+            ok = false;
+        }
+    }
+
+    chip8_destroy(reference);
+    chip8_destroy(lane_machine);
+    return ok;
+}
+
+static const bench_engine_t engines[] = {
+    {"switch", run_switch, 1, NULL, NULL},
+    {"decoded", run_decoded, 1, NULL, NULL},
+    {"block", run_block, 1, NULL, NULL},
+    {"jit", run_jit, 1, NULL, NULL},
+    {"jit-check", run_jit_check, 1, check_jit, NULL},
+    {"lockstep", run_lockstep, LOCKSTEP_LANES, check_lockstep, "mixed"},
+};
+
+// Parse a positive decimal or 0x hex count no larger than `max`, the whole string must be a number
+static bool parse_count(const char* text, const uint64_t max, uint64_t* value)
+{
+    if(!isdigit((unsigned char) text[0])) return false;
+
+    char* end;
+    errno = 0;
+    *value = strtoull(text, &end, 0);
+    return *end == '\0' && errno == 0 && *value > 0 && *value <= max;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Hash of the machine state the reference switch interpreter ends in after `instructions`
+static uint64_t reference_hash(const bench_rom_t* rom, const uint64_t instructions)
+{
+    chip8_t *chip8 = chip8_create(CHIP8_RAM_SIZE);
+    if(!chip8) exit(EXIT_FAILURE);
+
+    init_chip8_from_memory(chip8, rom->rom, rom->size, rom->name);
+    run_switch(chip8, instructions);
+    const uint64_t hash = chip8_hash(chip8);
+
+    chip8_destroy(chip8);
+    return hash;
+}
+
+// ns per instruction of one run of `engine` on a freshly loaded `rom`
+static double time_run(chip8_t* chip8, const bench_rom_t* rom, const bench_engine_t* engine, const uint64_t instructions)
+{
+    init_chip8_from_memory(chip8, rom->rom, rom->size, rom->name);
+    const uint64_t start = now_ns();
+    engine->run(chip8, instructions);
+    return (double) (now_ns() - start) / (instructions * engine->machines);
+}
+
+// Whether `engine` runs `rom` no slower than the switch interpreter, engines[0]. Runs of the two
+// alternate, so a slow spell on a busy host hits both, and the best run of each is compared.
+static bool keeps_up(const bench_rom_t* rom, const bench_engine_t* engine, const uint64_t instructions)
+{
+    chip8_t *chip8 = chip8_create(CHIP8_RAM_SIZE);
+    if(!chip8) exit(EXIT_FAILURE);
+
+    double switch_ns = 0, engine_ns = 0;
+    for(uint32_t pair = 0; pair < BENCH_PACE_PAIRS; pair++)
+    {
+        const double switch_run = time_run(chip8, rom, &engines[0], instructions);
+        const double engine_run = time_run(chip8, rom, engine, instructions);
+        if(pair == 0 || switch_run < switch_ns) switch_ns = switch_run;
+        if(pair == 0 || engine_run < engine_ns) engine_ns = engine_run;
+    }
+    chip8_destroy(chip8);
+
+    if(engine_ns > switch_ns)
+    {
+        fprintf(stderr, "%s engine on %s: slower than the switch interpreter, %.3f against %.3f best ns/instr\n",
+                engine->name, rom->name, engine_ns, switch_ns);
+    }
+    return engine_ns <= switch_ns;
+}
+
+// Run one workload on one engine `repeat` times and keep the median, after a short warmup.
+// Each repeat's final state is compared against `expected_hash`, see reference_hash().
+static bench_result_t run_benchmark(const bench_rom_t* rom, const bench_engine_t* engine,
+                                    const uint64_t instructions, const uint32_t repeat,
+                                    const uint64_t expected_hash)
+{
+    chip8_t *chip8 = chip8_create(CHIP8_RAM_SIZE);
+    double *ns = malloc(repeat * sizeof *ns);
+    double *cycles = malloc(repeat * sizeof *cycles);
+    if(!chip8 || !ns || !cycles) exit(EXIT_FAILURE);
+    bool state_matches = true;
+
+    init_chip8_from_memory(chip8, rom->rom, rom->size, rom->name);
+    engine->run(chip8, instructions / 10 + 1);
+
+    for(uint32_t r = 0; r < repeat; r++)
+    {
+        init_chip8_from_memory(chip8, rom->rom, rom->size, rom->name);
+
+        const uint64_t start_cycles = now_cycles();
+        const uint64_t start = now_ns();
+        engine->run(chip8, instructions);
+        const uint64_t end = now_ns();
+        const uint64_t end_cycles = now_cycles();
+
+        ns[r] = (double) (end - start) / (instructions * engine->machines);
+        cycles[r] = (double) (end_cycles - start_cycles) / (instructions * engine->machines);
+        state_matches &= chip8_hash(chip8) == expected_hash;
+    }
+
+    chip8_destroy(chip8);
+    if(engine->check) state_matches &= engine->check(rom, instructions);
+    qsort(ns, repeat, sizeof ns[0], compare_double);
+    qsort(cycles, repeat, sizeof cycles[0], compare_double);
+
+    const bench_result_t result = {
+        .workload = rom->name,
+        .engine = engine->name,
+        .instructions = instructions,
+        .ns_per_instruction = ns[repeat / 2],
+        .ns_per_instruction_min = ns[0],
+        .cycles_per_instruction = cycles[repeat / 2],
+        .instructions_per_second = 1e9 / ns[repeat / 2],
+        .state_matches = state_matches,
+    };
+    free(ns);
+    free(cycles);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    const char* workload_filter = NULL;
+    const char* engine_filter = NULL;
+    uint64_t instructions = 20000000;
+    uint32_t repeat = 5;
+
+    for(int i = 1; i < argc; i++)
+    {
+        bool valid = true;
+        if(!strcmp(argv[i], "--json"))
+        {
+            json = true;
+        } else if(!strcmp(argv[i], "--workload") && i + 1 < argc) {
+            workload_filter = argv[++i];
+        } else if(!strcmp(argv[i], "--engine") && i + 1 < argc) {
+            engine_filter = argv[++i];
+        } else if(!strcmp(argv[i], "--instructions") && i + 1 < argc) {
+            valid = parse_count(argv[++i], UINT64_MAX, &instructions);
+        } else if(!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            uint64_t count;
+            valid = parse_count(argv[++i], UINT32_MAX, &count);
+            repeat = count;
+        } else {
+            valid = false;
+        }
+        if(!valid)
+        {
+            fprintf(stderr, "Usage: %s [--json] [--workload <name>] [--engine <name>] "
+                            "[--instructions <n>] [--repeat <n>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    #define NUM_WORKLOADS 6
+    #define NUM_MICROS (sizeof micros / sizeof micros[0])
+    static bench_rom_t roms[NUM_WORKLOADS + NUM_MICROS] = {
+        {.name = "alu"},
+        {.name = "sprite"},
+        {.name = "call"},
+        {.name = "memory"},
+        {.name = "mixed"},
+        {.name = "selfmod"},
+    };
+    build_alu(&roms[0]);
+    build_sprite(&roms[1]);
+    build_call(&roms[2]);
+    build_memory(&roms[3]);
+    build_mixed(&roms[4]);
+    build_selfmod(&roms[5]);
+    for(size_t m = 0; m < NUM_MICROS; m++)
+    {
+        roms[NUM_WORKLOADS + m].name = micros[m].name;
+        build_micro(&roms[NUM_WORKLOADS + m], micros[m].body, micros[m].length);
+    }
+
+    const size_t num_roms = sizeof roms / sizeof roms[0];
+    const size_t num_engines = sizeof engines / sizeof engines[0];
+    bool first = true;
+    bool passed = true;
+
+    if(json) printf("{\n  \"instructions\": %llu,\n  \"repeat\": %u,\n  \"results\": [",
+                    (unsigned long long) instructions, repeat);
+    else printf("%-8s %-8s %14s %10s %10s %10s\n", "workload", "engine", "instr/sec", "ns/instr", "min ns", "cyc/instr");
+
+    for(size_t w = 0; w < num_roms; w++)
+    {
+        if(workload_filter && strcmp(workload_filter, roms[w].name)) continue;
+        const uint64_t expected_hash = reference_hash(&roms[w], instructions);
+
+        for(size_t e = 0; e < num_engines; e++)
+        {
+            if(engine_filter && strcmp(engine_filter, engines[e].name)) continue;
+
+            const bench_result_t result = run_benchmark(&roms[w], &engines[e], instructions, repeat, expected_hash);
+            if(!result.state_matches)
+            {
+                fprintf(stderr, "%s engine on %s: final state differs from the switch interpreter\n",
+                        result.engine, result.workload);
+                passed = false;
+            }
+            if(engines[e].not_slower_on && !strcmp(engines[e].not_slower_on, roms[w].name) &&
+               !keeps_up(&roms[w], &engines[e], instructions))
+            {
+                passed = false;
+            }
+            if(json)
+            {
+                printf("%s\n    {\"workload\": \"%s\", \"engine\": \"%s\", \"instructions_per_second\": %.0f, "
+                       "\"ns_per_instruction\": %.4f, \"ns_per_instruction_min\": %.4f, \"cycles_per_instruction\": %.3f, "
+                       "\"state_matches\": %s}",
+                       first ? "" : ",", result.workload, result.engine, result.instructions_per_second,
+                       result.ns_per_instruction, result.ns_per_instruction_min, result.cycles_per_instruction,
+                       result.state_matches ? "true" : "false");
+            } else {
+                printf("%-8s %-8s %14.0f %10.3f %10.3f %10.2f\n", result.workload, result.engine,
+                       result.instructions_per_second, result.ns_per_instruction,
+                       result.ns_per_instruction_min, result.cycles_per_instruction);
+            }
+            fflush(stdout);
+            first = false;
+        }
+    }
+
+    if(json) printf("\n  ]\n}\n");
+    exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,320 @@
+#include "block.h"
+#include "emulator.h"
+#include "ops.h"
+
+// Chain micro-ops with computed goto where the compiler supports it, same switch as the decode cache
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(DECODE_NO_THREADED)
+    #define BLOCK_THREADED 1
+#else
+    #define BLOCK_THREADED 0
+#endif
+
+// Opcodes that end a basic block: anything that changes the PC or may rewind it (FX0A).
+// RAM writes (FX33/FX55) run inside blocks, a write that rewrites a block's code patches it in place.
+#define BLOCK_TERMINATOR(name) [OP_##name] = true,
+static const bool is_terminator[OP_COUNT] = {
+    DECODE_JUMP_HANDLERS(BLOCK_TERMINATOR)
+    [OP_FX0A] = true,
+};
+#undef BLOCK_TERMINATOR
+
+// Execute one micro-op, returns the CHIP8_EVENT_DRAW it raises if any
+static inline uint32_t execute(chip8_t *chip8, block_cache_t *cache, const decoded_t *d)
+{
+    switch(d->handler)
+    {
+        #define BLOCK_CASE(name) case OP_##name: op_##name(chip8, d); break;
+        DECODE_PLAIN_HANDLERS(BLOCK_CASE)
+        BLOCK_CASE(FX0A)
+        #undef BLOCK_CASE
+        case OP_00E0:
+            op_00E0(chip8, d);
+            return CHIP8_EVENT_DRAW;
+        case OP_DXYN:
+            op_DXYN(chip8, d);
+            return CHIP8_EVENT_DRAW;
+        case OP_FX33:
+            op_FX33(chip8, d);
+            block_cache_invalidate(cache, chip8, chip8->I, 3);
+            break;
+        case OP_FX55:
+            op_FX55(chip8, d);
+            block_cache_invalidate(cache, chip8, chip8->I, d->X + 1);
+            break;
+        default:
+            break;
+    }
+    return CHIP8_EVENT_NONE;
+}
+
+// Empty the cache, required whenever RAM is changed behind the cache's back (e.g. loading a new ROM)
+void block_cache_reset(block_cache_t *cache)
+{
+    memset(cache->lookup, 0, sizeof cache->lookup);
+    memset(cache->code_bitmap, 0, sizeof cache->code_bitmap);
+    memset(cache->start_bitmap, 0, sizeof cache->start_bitmap);
+    cache->count = 0;
+}
+
+// Opcode bits decode_instruction() picks the handler from, by top nibble: 8XYN also looks at N,
+// 0NNN, EXNN and FXNN at NN. Rewriting only the other bits just changes the operands.
+static const uint16_t handler_bits[16] = {
+    0xF0FF, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000,
+    0xF00F, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF0FF, 0xF0FF,
+};
+
+// Bring a block overlapping a write of RAM [start, end) up to date. The rewritten micro-ops are
+// decoded again in place as long as each one still ends the block exactly when the old one did,
+// so code patching its own operands isn't translated over and over. Otherwise the block is dropped.
+static void patch_block(block_cache_t *cache, block_t *block, const uint16_t start, const uint32_t end,
+                        const uint8_t *ram)
+{
+    // The write relative to the block's first byte, negative when it starts before the block
+    const uint16_t offset = (start - block->start) & 0xFFF;
+    const int32_t write_start = offset < 2 * block->length ? offset : offset - 0x1000;
+    const int32_t write_end = write_start + (int32_t) (end - start);
+
+    for(int32_t i = write_start > 0 ? write_start / 2 : 0; i < block->length && 2 * i < write_end; i++)
+    {
+        const uint16_t address = (block->start + 2 * i) & 0xFFF;
+        const uint16_t opcode = (ram[address] << 8) | ram[(address + 1) & 0xFFF];
+        const uint16_t old = block->opcodes[i];
+        block->opcodes[i] = opcode;
+
+        if(((opcode ^ old) & handler_bits[old >> 12]) == 0)
+        {
+            // Same handler, only refresh the operands
+            block->ops[i] = (decoded_t) {
+                .handler = block->ops[i].handler,
+                .NNN = opcode & 0x0FFF,
+                .NN = opcode & 0x0FF,
+                .N = opcode & 0x0F,
+                .X = (opcode >> 8) & 0x0F,
+                .Y = (opcode >> 4) & 0x0F,
+            };
+            continue;
+        }
+
+        const decoded_t d = decode_instruction(opcode);
+        if(is_terminator[d.handler] != is_terminator[block->ops[i].handler])
+        {
+            block->valid = false;
+            cache->lookup[block->start] = NULL;
+            cache->start_bitmap[block->start >> 6] &= ~(1ull << (block->start & 63));
+            return;
+        }
+        block->ops[i] = d;
+    }
+}
+
+// Update every block overlapping the `length` bytes written at `address`, see patch_block().
+// Writes land at address & 0xFFF like every other RAM access, and one running past 0xFFF wraps
+// around to address 0. A block covers at most 2 * BLOCK_MAX_LENGTH bytes from its start, so only
+// the block starts just before and inside the write are looked at.
+// Bits are never cleared from the dirty bitmap since blocks may overlap, a stale bit only costs a scan.
+void block_cache_invalidate(block_cache_t *cache, const chip8_t *chip8, const uint16_t address, const uint16_t length)
+{
+    const uint16_t start = address & 0xFFF;
+    const uint32_t end = (uint32_t) start + length;
+    if(length < 64 && !decode_bitmap_any(cache->code_bitmap, start, length)) return; // Plain data write, no translated code there
+
+    const uint16_t first = (start - 2 * BLOCK_MAX_LENGTH + 1) & 0xFFF;
+    const uint32_t window = 2 * BLOCK_MAX_LENGTH - 1 + length < 0x1000 ? 2 * BLOCK_MAX_LENGTH - 1 + length : 0x1000;
+    for(uint32_t offset = 0; offset < window; offset += 64)
+    {
+        const uint8_t count = window - offset < 64 ? window - offset : 64;
+        uint64_t starts = decode_bitmap_bits(cache->start_bitmap, first + offset, count);
+        for(; starts; starts &= starts - 1)
+        {
+            block_t *block = cache->lookup[(first + offset + __builtin_ctzll(starts)) & 0xFFF];
+            if(decode_ranges_overlap(block->start, block->start + 2u * block->length, start, end))
+            {
+                patch_block(cache, block, start, end, chip8->ram);
+            }
+        }
+    }
+}
+
+// Translate the basic block starting at `start`
+static block_t *translate(const chip8_t *chip8, block_cache_t *cache, const uint16_t start)
+{
+    if(cache->count == BLOCK_POOL_SIZE) block_cache_reset(cache);
+
+    block_t *block = &cache->blocks[cache->count++];
+    *block = (block_t) {.start = start, .valid = true};
+
+    uint16_t address = start;
+    while(block->length < BLOCK_MAX_LENGTH)
+    {
+        const uint16_t next = (address + 1) & 0xFFF;
+        const uint16_t opcode = (chip8->ram[address] << 8) | chip8->ram[next];
+        const decoded_t d = decode_instruction(opcode);
+
+        cache->code_bitmap[address >> 6] |= 1ull << (address & 63);
+        cache->code_bitmap[next >> 6] |= 1ull << (next & 63);
+        block->opcodes[block->length] = opcode;
+        block->ops[block->length++] = d;
+
+        address = (address + 2) & 0xFFF;
+        if(is_terminator[d.handler] || address < 2) break; // Never run a block past the end of RAM
+    }
+
+    cache->lookup[start] = block;
+    cache->start_bitmap[start >> 6] |= 1ull << (start & 63);
+    return block;
+}
+
+// Out of cycles mid-block, run the first `cycles` micro-ops of the block at the PC (never the
+// terminator). Returns how many ran, fewer when a RAM write dropped the block, the PC then points
+// just past the writing one. Kept out of line so the run loop's registers aren't spent on it.
+static __attribute__((noinline))
+uint32_t run_head(chip8_t *chip8, block_cache_t *cache, const block_t *block, const uint32_t cycles, uint32_t *events)
+{
+    const uint16_t PC = chip8->PC;
+    chip8->PC = PC + 2 * cycles;
+    for(uint32_t i = 0; i < cycles; i++)
+    {
+        *events |= execute(chip8, cache, &block->ops[i]);
+        if(!block->valid)
+        {
+            chip8->PC = PC + 2 * (i + 1);
+            return i + 1;
+        }
+    }
+    return cycles;
+}
+
+// Run up to `cycles` instructions a basic block at a time. A block that doesn't fit in the
+// remaining cycles is run partially, so cycle counts match the interpreter exactly.
+// Same contract and chip8_event_t results as chip8_run().
+uint32_t block_cache_run(chip8_t *chip8, block_cache_t *cache, uint32_t cycles)
+{
+    uint32_t events = CHIP8_EVENT_NONE;
+    const bool sound_was_on = chip8->sound_timer > 0;
+    const block_t *block;
+    const decoded_t *d;
+    uint16_t PC;
+
+    // Look up (or translate) the block at the PC and start it. Only the last micro-op can read or
+    // change the PC, so it is written once up front.
+    #define BLOCK_ENTER(dispatch) \
+        do { \
+            if(cycles == 0) goto done; \
+            PC = chip8->PC; \
+            block = cache->lookup[PC & 0xFFF]; \
+            if(!block) block = translate(chip8, cache, PC & 0xFFF); \
+            if(block->length > cycles) goto partial; \
+            cycles -= block->length; \
+            chip8->PC = PC + 2 * block->length; \
+            d = block->ops; \
+            dispatch; \
+        } while(0)
+
+    // A RAM write inside the block dropped it, give back the cycles of the micro-ops
+    // after the writing one and carry on at the instruction following it
+    #define BLOCK_RESUME() \
+        do { \
+            cycles += block->length - (d - block->ops) - 1; \
+            chip8->PC = PC + 2 * (d - block->ops + 1); \
+        } while(0)
+
+    if(chip8->state != RUNNING) goto done;
+
+#if BLOCK_THREADED
+    #define BLOCK_LABEL(name) [OP_##name] = &&L_##name,
+    static void* const labels[OP_COUNT] = {
+        [OP_DECODE] = &&L_END,
+        DECODE_PLAIN_HANDLERS(BLOCK_LABEL)
+        DECODE_EVENT_HANDLERS(BLOCK_LABEL)
+    };
+    #undef BLOCK_LABEL
+    #define NEXT_BLOCK() BLOCK_ENTER(goto *labels[d->handler])
+
+next_block:
+    NEXT_BLOCK();
+
+    #define BLOCK_STRAIGHT(name) L_##name: op_##name(chip8, d); d++; goto *labels[d->handler];
+    DECODE_STRAIGHT_HANDLERS(BLOCK_STRAIGHT)
+    #undef BLOCK_STRAIGHT
+
+    #define BLOCK_JUMP(name) L_##name: op_##name(chip8, d); NEXT_BLOCK();
+    DECODE_JUMP_HANDLERS(BLOCK_JUMP)
+    #undef BLOCK_JUMP
+
+L_00E0:
+    op_00E0(chip8, d);
+    events |= CHIP8_EVENT_DRAW;
+    d++;
+    goto *labels[d->handler];
+L_DXYN:
+    op_DXYN(chip8, d);
+    events |= CHIP8_EVENT_DRAW;
+    d++;
+    goto *labels[d->handler];
+L_FX0A:
+    op_FX0A(chip8, d);
+    if(chip8->PC == PC + 2 * (block->length - 1))
+    {
+        events |= CHIP8_EVENT_WAIT_KEY;
+        goto done;
+    }
+    NEXT_BLOCK();
+L_FX33:
+    op_FX33(chip8, d);
+    block_cache_invalidate(cache, chip8, chip8->I, 3);
+    goto written;
+L_FX55:
+    op_FX55(chip8, d);
+    block_cache_invalidate(cache, chip8, chip8->I, d->X + 1);
+written:
+    if(!block->valid)
+    {
+        BLOCK_RESUME();
+        NEXT_BLOCK();
+    }
+    d++;
+    goto *labels[d->handler];
+L_END:
+    NEXT_BLOCK();
+
+    #undef NEXT_BLOCK
+#else
+    for(;;)
+    {
+next_block:
+        BLOCK_ENTER((void) 0);
+        for(; d->handler != OP_DECODE; d++)
+        {
+            events |= execute(chip8, cache, d);
+            if(!block->valid)
+            {
+                BLOCK_RESUME();
+                goto next_block;
+            }
+        }
+        d--;
+
+        // Post-processing for the block's last micro-op
+        if(d->handler == OP_FX0A && chip8->PC == PC + 2 * (block->length - 1))
+        {
+            events |= CHIP8_EVENT_WAIT_KEY;
+            goto done;
+        }
+    }
+#endif
+
+partial:;
+    uint32_t head_events = CHIP8_EVENT_NONE;
+    cycles -= run_head(chip8, cache, block, cycles, &head_events);
+    events |= head_events;
+    if(cycles > 0) goto next_block;
+    #undef BLOCK_ENTER
+    #undef BLOCK_RESUME
+
+done:;
+    const bool sound_is_on = chip8->sound_timer > 0;
+    if(sound_is_on && !sound_was_on) events |= CHIP8_EVENT_SOUND_ON;
+    if(!sound_is_on && sound_was_on) events |= CHIP8_EVENT_SOUND_OFF;
+
+    return events;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+#include "decode.h"
+
+#define BLOCK_MAX_LENGTH 16     // Instructions per block, terminator included
+#define BLOCK_POOL_SIZE  512    // Blocks held before the whole cache is flushed
+
+// Translated Basic Block Object: a straight-line run of micro-ops ending at the
+// first jump, call, return, skip or key wait
+typedef struct {
+    uint16_t start;                     // RAM address of the first instruction
+    uint8_t length;                     // Number of micro-ops
+    bool valid;
+    decoded_t ops[BLOCK_MAX_LENGTH + 1];    // Zero (OP_DECODE) entry after the last micro-op marks the end
+    uint16_t opcodes[BLOCK_MAX_LENGTH];     // Opcode each micro-op was decoded from
+} block_t;
+
+// Block Cache Object, blocks keyed by start address. A zeroed cache is empty and valid.
+typedef struct {
+    block_t *lookup[4096];              // Block starting at each address, NULL if none
+    uint64_t code_bitmap[4096 / 64];    // Dirty bitmap, one bit per RAM byte covered by a translated block
+    uint64_t start_bitmap[4096 / 64];   // One bit per address with a block in lookup, finds the blocks a write hits
+    uint16_t count;                     // Blocks allocated from the pool
+    block_t blocks[BLOCK_POOL_SIZE];
+} block_cache_t;
+
+void block_cache_reset(block_cache_t *cache);
+void block_cache_invalidate(block_cache_t *cache, const chip8_t *chip8, const uint16_t address, const uint16_t length);
+uint32_t block_cache_run(chip8_t *chip8, block_cache_t *cache, uint32_t cycles);
@@ -1,5 +1,64 @@
 #include "chip8.h"
 
+// Look up a quirk profile by its command line name
+bool chip8_quirk_profile_from_name(const char name[], chip8_quirk_profile_t *profile)
+{
+    #define QUIRK_PROFILE_NAME(name, string, quirks) string,
+    static const char *names[CHIP8_QUIRKS_COUNT] = {CHIP8_QUIRK_PROFILES(QUIRK_PROFILE_NAME)};
+    #undef QUIRK_PROFILE_NAME
+
+    for(uint32_t i = 0; i < CHIP8_QUIRKS_COUNT; i++)
+    {
+        if(strcmp(name, names[i]) == 0)
+        {
+            *profile = i;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "Unknown quirk profile %s, expected one of:", name);
+    for(uint32_t i = 0; i < CHIP8_QUIRKS_COUNT; i++) fprintf(stderr, " %s", names[i]);
+    fprintf(stderr, "\n");
+    return false;
+}
+
+// Bytes of RAM a machine running a quirk profile needs
+uint32_t chip8_ram_size(const chip8_quirk_profile_t profile)
+{
+    #define QUIRK_PROFILE_MASK(name, string, quirks) quirks,
+    static const uint32_t masks[CHIP8_QUIRKS_COUNT] = {CHIP8_QUIRK_PROFILES(QUIRK_PROFILE_MASK)};
+    #undef QUIRK_PROFILE_MASK
+
+    return (masks[profile] & CHIP8_QUIRK_LONG_MEMORY) ? CHIP8_LONG_RAM_SIZE : CHIP8_RAM_SIZE;
+}
+
+// Allocate a zeroed machine with `ram_size` bytes of RAM, see chip8_ram_size().
+// Cache line aligned, see chip8_t. Returns NULL if out of memory.
+chip8_t *chip8_create(const uint32_t ram_size)
+{
+    chip8_t *chip8 = aligned_alloc(_Alignof(chip8_t), CHIP8_MACHINE_SIZE(ram_size));
+    if(!chip8)
+    {
+        fprintf(stderr, "Could not allocate a CHIP8 machine with %u bytes of RAM\n", ram_size);
+        return NULL;
+    }
+
+    memset(chip8, 0, CHIP8_MACHINE_SIZE(ram_size));
+    chip8->ram_size = ram_size;
+    return chip8;
+}
+
+void chip8_destroy(chip8_t *chip8)
+{
+    free(chip8);
+}
+
+// Copy a whole machine, RAM included, into one created with the same RAM size
+void chip8_copy(chip8_t *dest, const chip8_t *src)
+{
+    memcpy(dest, src, CHIP8_MACHINE_SIZE(src->ram_size));
+}
+
 bool set_config_from_args(config_t *config, const int argc, char** argv)
 {
     // Set Defaults: 32x64 default
@@ -8,95 +67,257 @@ bool set_config_from_args(config_t *config, const int argc, char** argv)
         .window_height = 32,
         .fg_color = 0xFFFFFFFF, // White
         .bg_color = 0x000000FF, // Black
+        .fg2_color = 0xFF6600FF, // Orange
+        .blend_color = 0x662200FF, // Brown
         .scale_factor = 25,     // Default res of 64x32 times 20 = 1280x640
         .pixel_outlines = true,
         .instructions_per_second = 500,
+        .speed_percent = 100,
+        .turbo = false,
+        .rewind_seconds = 600,
+        .quirk_profile = CHIP8_QUIRKS_MODERN,
         .audio_sample_rate = 44100,
         .square_wave_frequency = 440,
         .volume = 2500,
     };
 
-    // Override Defaults from args, todo
-    for(int i = 1; i < argc; i++)
+    // Override Defaults from args, argv[1] is the ROM
+    for(int i = 2; i < argc; i++)
     {
-        (void) argv[i];
+        if(strcmp(argv[i], "--turbo") == 0)
+        {
+            config->turbo = true;
+        } else if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            // Speed multiplier, e.g. 2, 4 or 0.5
+            char *end;
+            const double speed = strtod(argv[++i], &end);
+            if(*end != '\0' || speed < 0.01 || speed > 100)
+            {
+                fprintf(stderr, "Invalid speed %s, expected a multiplier between 0.01 and 100\n", argv[i]);
+                return false;
+            }
+            config->speed_percent = (uint32_t) (speed * 100 + 0.5);
+        } else if(strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            // Seconds of rewind history, 0 turns it off
+            char *end;
+            const unsigned long seconds = strtoul(argv[++i], &end, 10);
+            if(*end != '\0' || seconds > 24 * 60 * 60)
+            {
+                fprintf(stderr, "Invalid rewind length %s, expected seconds up to 86400\n", argv[i]);
+                return false;
+            }
+            config->rewind_seconds = seconds;
+        } else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            config->movie_path = argv[++i];
+        } else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if(!chip8_quirk_profile_from_name(argv[++i], &config->quirk_profile)) return false;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return false;
+        }
     }
 
     return true;
 }
 
-// Initialize a new CHIP8 machine
-bool init_chip8(chip8_t *chip8, const char rom_name[])
+static const uint8_t font[] = 
 {
-    const uint32_t entry_point = 0x200; // CHIP8 ROMs will be loaded at 0x200, fonts loaded at 0x00
-    const uint8_t font[] = 
-    {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0 
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1 
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2 
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3 
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4 
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0 
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1 
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2 
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3 
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4 
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
 
-    // Load Font
+// Zero the whole machine but its RAM size, before a ROM is loaded into it
+static void clear_chip8(chip8_t *chip8)
+{
+    const uint32_t ram_size = chip8->ram_size;
+    memset(chip8, 0, CHIP8_MACHINE_SIZE(ram_size));
+    chip8->ram_size = ram_size;
+}
+
+// Load the font and reset the machine registers to their power-on defaults
+static void reset_chip8(chip8_t *chip8)
+{
     memcpy(&chip8->ram[0], font, sizeof(font));
 
+    chip8->state = RUNNING;
+    chip8->PC = CHIP8_ENTRY_POINT;
+    chip8->SP = 0;
+    chip8->V[0xF] = 0; // Carry flag initialized to 0
+    chip8->dirty_rows = ~0ull; // Frontend has never drawn this machine
+    chip8->hires = false;
+    chip8->planes = 1;
+    chip8->pitch = CHIP8_DEFAULT_PITCH;
+    chip8_seed(chip8, 0);
+}
+
+// Initialize a machine from chip8_create() with a ROM file, clearing whatever it ran before
+bool init_chip8(chip8_t *chip8, const char rom_name[])
+{
+    const uint32_t entry_point = CHIP8_ENTRY_POINT;
+
     // Ooen ROM File
     FILE* rom = fopen(rom_name, "rb");
     if(!rom)
     {
-        SDL_Log("ROM File %s is invalid or does not exist\n", rom_name);
+        fprintf(stderr, "ROM File %s is invalid or does not exist\n", rom_name);
         return false;
     }
 
     // Get & Check ROM Size
     fseek(rom, 0, SEEK_END);
     const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->ram - entry_point;
+    const size_t max_size = chip8->ram_size - entry_point;
     rewind(rom);
 
     if(rom_size > max_size)
     {
-        SDL_Log("ROM file %s is too large. ROM Size: %zu, Max Size: %zu", rom_name, rom_size, max_size);
+        fprintf(stderr, "ROM file %s is too large. ROM Size: %zu, Max Size: %zu\n", rom_name, rom_size, max_size);
+        fclose(rom);
+        return false;
     }
 
     // Load ROM into RAM
-    if(fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1)
+    clear_chip8(chip8);
+    if(rom_size > 0 && fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1)
     {
-        SDL_Log("Could not read ROM File %s into CHIP8 Memory", rom_name);
+        fprintf(stderr, "Could not read ROM File %s into CHIP8 Memory\n", rom_name);
+        fclose(rom);
+        return false;
     }
 
     fclose(rom);
 
     // Set CHIP8 machine defaults
-    chip8->state = RUNNING;
-    chip8->PC = entry_point;
-    chip8->rom_name = rom_name;
-    chip8->stack_pointer = &chip8->stack[0];
-    chip8->V[0xF] = 0; // Carry flag initialized to 0
+    reset_chip8(chip8);
+    return true;
+}
+
+// Initialize a machine from a ROM image that is already in memory, see init_chip8()
+bool init_chip8_from_memory(chip8_t *chip8, const uint8_t *rom, const size_t rom_size, const char rom_name[])
+{
+    const size_t max_size = chip8->ram_size - CHIP8_ENTRY_POINT;
+    if(rom_size > max_size)
+    {
+        fprintf(stderr, "ROM %s is too large. ROM Size: %zu, Max Size: %zu\n", rom_name, rom_size, max_size);
+        return false;
+    }
+
+    clear_chip8(chip8);
+    memcpy(&chip8->ram[CHIP8_ENTRY_POINT], rom, rom_size);
+    reset_chip8(chip8);
     return true;
 }
 
-void update_timers(const sdl_t sdl, chip8_t *chip8)
+// Decrement the 60Hz timers. Sound output is left to the frontend, which
+// should play a tone while sound_timer is non-zero.
+void update_timers(chip8_t *chip8)
 {
     if(chip8->delay_timer > 0) chip8->delay_timer--;
-    
-    if(chip8->sound_timer > 0)
-    { 
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl.dev, 0); // Play sound
-    } else {
-        SDL_PauseAudioDevice(sdl.dev, 1); // Pause sound
+    if(chip8->sound_timer > 0) chip8->sound_timer--;
+}
+
+// Initial CXNN generator state for a seed, the same seed always gives the same sequence
+uint32_t chip8_seed_state(const uint32_t seed)
+{
+    // Spread nearby seeds apart, xorshift needs a few rounds to decorrelate them otherwise
+    const uint32_t state = seed * 0x9E3779B9u + 0x7F4A7C15u;
+    return state ? state : 1;
+}
+
+// Seed the machine's CXNN random number generator
+void chip8_seed(chip8_t *chip8, const uint32_t seed)
+{
+    chip8->rng_state = chip8_seed_state(seed);
+}
+
+// FNV-1a style hash of `size` bytes, continuing from `hash`. Whole words are hashed 8 bytes at a
+// time with a fold after each multiply, so high bits feed back into the low ones.
+static uint64_t hash_bytes(uint64_t hash, const void *data, const size_t size)
+{
+    const uint8_t *bytes = data;
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, &bytes[i], sizeof word);
+        hash = (hash ^ word) * 0x100000001B3ull;
+        hash ^= hash >> 29;
     }
+    for(; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Hash of the display. A plain CHIP8 display, low resolution with only plane 0 in use, is hashed
+// as its 32 row words, which keeps it cheap and keeps hashes from before the hires modes valid.
+static uint64_t hash_display(uint64_t hash, const chip8_t *chip8)
+{
+    uint64_t rows[CHIP8_DISPLAY_HEIGHT];
+    uint64_t plane1 = 0;
+    for(uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        rows[y] = chip8_lores_row(chip8->display[0][y]);
+        plane1 |= chip8_lores_row(chip8->display[1][y]);
+    }
+
+    if(!chip8->hires && chip8->planes == 1 && !plane1) return hash_bytes(hash, rows, sizeof rows);
+
+    hash = hash_bytes(hash, chip8->display, sizeof chip8->display);
+    hash = hash_bytes(hash, &chip8->hires, sizeof chip8->hires);
+    return hash_bytes(hash, &chip8->planes, sizeof chip8->planes);
+}
+
+// Hash of the machine's architectural state: the ram_size bytes of RAM, the display, V, I, PC, SP
+// and the stack entries below it, the timers, the RNG and, once used, the XO-CHIP audio. The keypad,
+// run state and dirty rows are inputs or frontend bookkeeping rather than machine state, and are
+// left out along with the struct padding.
+uint64_t chip8_hash(const chip8_t *chip8)
+{
+    const uint8_t depth = chip8->SP;
+    const uint8_t used = depth < 16 ? depth : 16; // Entries of a runaway stack that are still held
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    hash = hash_bytes(hash, chip8->ram, chip8->ram_size);
+    hash = hash_display(hash, chip8);
+    hash = hash_bytes(hash, chip8->V, sizeof chip8->V);
+    hash = hash_bytes(hash, &chip8->I, sizeof chip8->I);
+    hash = hash_bytes(hash, &chip8->PC, sizeof chip8->PC);
+    hash = hash_bytes(hash, &depth, sizeof depth);
+    hash = hash_bytes(hash, chip8->stack, used * sizeof chip8->stack[0]);
+    hash = hash_bytes(hash, &chip8->delay_timer, sizeof chip8->delay_timer);
+    hash = hash_bytes(hash, &chip8->sound_timer, sizeof chip8->sound_timer);
+    hash = hash_bytes(hash, &chip8->rng_state, sizeof chip8->rng_state);
+
+    // Audio is only hashed once a ROM touched it, which keeps plain CHIP8 hashes as they were
+    if(chip8->audio_pattern_set || chip8->pitch != CHIP8_DEFAULT_PITCH)
+    {
+        hash = hash_bytes(hash, &chip8->audio_pattern_set, sizeof chip8->audio_pattern_set);
+        hash = hash_bytes(hash, chip8->audio_pattern, sizeof chip8->audio_pattern);
+        hash = hash_bytes(hash, &chip8->pitch, sizeof chip8->pitch);
+    }
+
+    return hash;
+}
+
+// Hash of a whole RAM image. Taken right after the ROM was loaded, it identifies the ROM a save
+// state or movie belongs to.
+uint64_t chip8_hash_ram(const uint8_t ram[], const uint32_t ram_size)
+{
+    return hash_bytes(0xCBF29CE484222325ull, ram, ram_size);
 }
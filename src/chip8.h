@@ -2,6 +2,37 @@
 
 #include "common.h"
 
+#include <stddef.h>
+
+// Native CHIP8 display resolution
+#define CHIP8_DISPLAY_WIDTH  64
+#define CHIP8_DISPLAY_HEIGHT 32
+
+// SUPER-CHIP / XO-CHIP high resolution mode, and the XO-CHIP bitplanes. Plain CHIP8 only draws to plane 0.
+#define CHIP8_HIRES_WIDTH    128
+#define CHIP8_HIRES_HEIGHT   64
+#define CHIP8_PLANES         2
+
+// One display row, one bit per pixel, MSB is the leftmost pixel. Low resolution rows only use the
+// top 64 bits, and only the first CHIP8_DISPLAY_HEIGHT rows, the rest stays zero.
+typedef unsigned __int128 chip8_row_t;
+
+// Low resolution row as a word, MSB is the leftmost pixel
+static inline uint64_t chip8_lores_row(const chip8_row_t row) { return row >> 64; }
+
+// CHIP8 ROMs will be loaded at 0x200, fonts loaded at 0x00
+#define CHIP8_ENTRY_POINT 0x200
+
+// RAM of a plain CHIP8, and of an XO-CHIP with CHIP8_QUIRK_LONG_MEMORY. Both are powers of 2,
+// addresses wrap around the end of RAM.
+#define CHIP8_RAM_SIZE       4096
+#define CHIP8_LONG_RAM_SIZE  65536
+
+// XO-CHIP audio: F002 loads a pattern of 128 one bit samples, played on a loop while the sound
+// timer runs at 4000 * 2^((pitch - 64) / 48) samples per second
+#define CHIP8_AUDIO_PATTERN_SIZE 16
+#define CHIP8_DEFAULT_PITCH      64
+
 // Emulator State Object
 typedef enum {
     QUIT,
@@ -9,6 +40,36 @@ typedef enum {
     PAUSED,
 } emulator_state_t;
 
+// Behaviours that differ between CHIP8 variants, each bit picks the less common choice
+typedef enum {
+    CHIP8_QUIRK_SHIFT_VY     = 1 << 0, // 8XY6/8XYE shift VY into VX instead of shifting VX
+    CHIP8_QUIRK_LOAD_STORE_I = 1 << 1, // FX55/FX65 leave I past the last register copied
+    CHIP8_QUIRK_JUMP_VX      = 1 << 2, // BNNN is BXNN, jumping to VX + XNN instead of V0 + NNN
+    CHIP8_QUIRK_VF_RESET     = 1 << 3, // 8XY1/8XY2/8XY3 clear VF
+    CHIP8_QUIRK_WRAP         = 1 << 4, // Sprites wrap around the display edges instead of being clipped
+    CHIP8_QUIRK_DISPLAY_WAIT = 1 << 5, // DXYN waits for the next 60Hz tick, ending the run
+    CHIP8_QUIRK_HIRES        = 1 << 6, // SUPER-CHIP 00FE/00FF modes, 00CN/00FB/00FC scrolls, 16x16 DXY0 sprites
+    CHIP8_QUIRK_PLANES       = 1 << 7, // XO-CHIP FN01 bitplane selection, 00DN scroll up
+    CHIP8_QUIRK_LONG_MEMORY  = 1 << 8, // XO-CHIP 64KB RAM, F000 NNNN loads a 16 bit address into I
+    CHIP8_QUIRK_AUDIO        = 1 << 9, // XO-CHIP F002 audio pattern and FX3A pitch
+} chip8_quirk_t;
+
+// Quirk profiles: X(name, command line name, chip8_quirk_t mask). The interpreter is compiled
+// once per profile, see chip8_runner().
+#define CHIP8_QUIRK_PROFILES(X) \
+    X(MODERN, "modern", 0) \
+    X(VIP,    "vip",    CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_LOAD_STORE_I | CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_DISPLAY_WAIT) \
+    X(SCHIP,  "schip",  CHIP8_QUIRK_JUMP_VX | CHIP8_QUIRK_HIRES) \
+    X(XOCHIP, "xochip", CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_LOAD_STORE_I | CHIP8_QUIRK_WRAP | CHIP8_QUIRK_HIRES | \
+                        CHIP8_QUIRK_PLANES | CHIP8_QUIRK_LONG_MEMORY | CHIP8_QUIRK_AUDIO)
+
+typedef enum {
+    #define QUIRK_PROFILE_ENUM(name, string, quirks) CHIP8_QUIRKS_##name,
+    CHIP8_QUIRK_PROFILES(QUIRK_PROFILE_ENUM)
+    #undef QUIRK_PROFILE_ENUM
+    CHIP8_QUIRKS_COUNT
+} chip8_quirk_profile_t;
+
 // Config Container Object
 typedef struct
 {
@@ -16,41 +77,75 @@ typedef struct
     uint32_t window_height;
     uint32_t fg_color;                // Foreground color 32 bit RGBA8888
     uint32_t bg_color;                // Background color 32 bit RGBA8888
+    uint32_t fg2_color;               // XO-CHIP pixels lit in plane 1 only
+    uint32_t blend_color;             // XO-CHIP pixels lit in both planes
     uint32_t scale_factor;            // Amount to scale a chip8 pixel by
     bool pixel_outlines;              // Draw pixel outlines yes/no
     uint32_t instructions_per_second; // CHIP8 CPU Clock Rate
+    uint32_t speed_percent;           // Emulation speed multiplier, 100 is real time
+    bool turbo;                       // Run uncapped, as fast as the host allows
+    uint32_t rewind_seconds;          // Seconds of frames kept for rewinding, 0 disables rewind
+    const char *movie_path;           // Record the run's input to this movie file, NULL to not record
+    chip8_quirk_profile_t quirk_profile; // Behaviour of the CHIP8 variant the ROM was written for
     uint32_t square_wave_frequency;   // Frequency of square wave sound to be played
     uint32_t audio_sample_rate;       
     int16_t volume;
 } config_t;
 
-// CHIP8 Instruction Format
+// CHIP8 Machine Object, allocated by chip8_create() with the RAM its quirk profile needs.
+// Position independent, no pointers into itself or anywhere else, so a machine is copied, compared
+// and moved between processes with plain memcpy()/memcmp() over CHIP8_MACHINE_SIZE() bytes.
+// Everything an instruction touches besides RAM and the display shares the first cache line.
+//
+// Size budget: sizeof(chip8_t) is CHIP8_MACHINE_HEADER bytes, most of it the XO-CHIP display,
+// plus the RAM. A plain CHIP8 is 6272 bytes, 100k of them take 627MB. An XO-CHIP is 67712 bytes.
 typedef struct {
-    uint16_t opcode;
-    uint16_t NNN;   // 12 bit address
-    uint8_t NN;     // 8 bit constant
-    uint8_t N;      // 4 bit constant
-    uint8_t X;      // 4 bit register identifier
-    uint8_t Y;      // 4 bit register identifier
-} instruction_t;
-
-// CHIP8 Machine Object
-typedef struct {
-    emulator_state_t state;
-    uint8_t ram[4096];
-    bool display[64*32];
-    uint16_t stack[12];       // Subroutine stack
-    uint16_t* stack_pointer;  // Pointer to the top of the stack
+    // Hot, one cache line
     uint8_t V[16];            // Data Registers V0-VF
-    uint16_t I;                // Index Register
+    uint16_t I;               // Index Register
     uint16_t PC;              // Program Counter
-    uint8_t delay_timer;      // Decrements at 60Hz when > 0 
+    uint16_t keypad;          // Bit per held key 0x0 - 0xF
+    uint8_t SP;               // Stack depth, stack[(SP - 1) & 15] is the top
+    uint8_t delay_timer;      // Decrements at 60Hz when > 0
     uint8_t sound_timer;      // Decrements at 60Hz and plays a tone when > 0
-    bool keypad[16];          // Hex keypad 0x0 - 0xF
-    const char* rom_name;     // Currently running ROM
-    instruction_t instruction; // Currently executing instruction
+    bool hires;               // 128x64 mode, switched by 00FE/00FF
+    uint8_t planes;           // Bit per XO-CHIP plane drawn, cleared and scrolled, set by FN01
+    uint8_t state;            // emulator_state_t
+    uint32_t rng_state;       // CXNN xorshift32 state, never 0
+    uint16_t stack[16];       // Subroutine stack, 12 used, indexed & 15 so a runaway SP can't leave it
+
+    // Cold
+    _Alignas(64) chip8_row_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT]; // Bitplanes of packed rows, see chip8_row_t
+    uint64_t dirty_rows;      // One bit per display row changed since the frontend last drew it
+    uint32_t ram_size;        // Bytes of RAM, CHIP8_RAM_SIZE or CHIP8_LONG_RAM_SIZE
+    uint8_t pitch;            // XO-CHIP pattern playback rate, set by FX3A
+    bool audio_pattern_set;   // F002 ran, the pattern plays instead of the frontend's tone
+    uint8_t audio_pattern[CHIP8_AUDIO_PATTERN_SIZE]; // XO-CHIP samples, MSB of the first byte first
+    _Alignas(64) uint8_t ram[]; // ram_size bytes, last so the rest of the machine has fixed offsets
 } chip8_t;
 
+#define CHIP8_MACHINE_HEADER 2176
+#define CHIP8_MACHINE_SIZE(ram_size) (sizeof(chip8_t) + (size_t) (ram_size))
+
+_Static_assert(offsetof(chip8_t, display) == 64, "the hot registers must fit in one cache line");
+_Static_assert(sizeof(chip8_t) == CHIP8_MACHINE_HEADER, "update the size budget above");
+
+// Whether `key` is held, keys past 0xF never are
+static inline bool chip8_key_down(const chip8_t *chip8, const uint8_t key)
+{
+    return key < 16 && ((chip8->keypad >> key) & 1);
+}
+
+bool chip8_quirk_profile_from_name(const char name[], chip8_quirk_profile_t *profile);
 bool set_config_from_args(config_t *config, const int argc, char** argv);
+uint32_t chip8_ram_size(const chip8_quirk_profile_t profile);
+chip8_t *chip8_create(const uint32_t ram_size);
+void chip8_destroy(chip8_t *chip8);
+void chip8_copy(chip8_t *dest, const chip8_t *src);
 bool init_chip8(chip8_t *chip8, const char rom_name[]);
-void update_timers(const sdl_t sdl, chip8_t *chip8);
\ No newline at end of file
+bool init_chip8_from_memory(chip8_t *chip8, const uint8_t *rom, const size_t rom_size, const char rom_name[]);
+void update_timers(chip8_t *chip8);
+uint32_t chip8_seed_state(const uint32_t seed);
+void chip8_seed(chip8_t *chip8, const uint32_t seed);
+uint64_t chip8_hash(const chip8_t *chip8);
+uint64_t chip8_hash_ram(const uint8_t ram[], const uint32_t ram_size);
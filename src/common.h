@@ -2,15 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
-#include "SDL.h"
-
-// SDL Container Object
-typedef struct 
-{
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-    SDL_AudioSpec want, have;
-    SDL_AudioDeviceID dev;
-} sdl_t;
\ No newline at end of file
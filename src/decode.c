@@ -0,0 +1,214 @@
+#include "decode.h"
+#include "emulator.h"
+#include "ops.h"
+
+// Use direct threaded dispatch (computed goto) where the compiler supports it,
+// otherwise fall back to a function pointer table
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(DECODE_NO_THREADED)
+    #define DECODE_THREADED 1
+#else
+    #define DECODE_THREADED 0
+#endif
+
+// Split an opcode into its handler and operands, mirrors the switch in emulate_instruction()
+decoded_t decode_instruction(const uint16_t opcode)
+{
+    decoded_t d = {
+        .handler = OP_NOP,
+        .NNN = opcode & 0x0FFF,
+        .NN = opcode & 0x0FF,
+        .N = opcode & 0x0F,
+        .X = (opcode >> 8) & 0x0F,
+        .Y = (opcode >> 4) & 0x0F,
+    };
+
+    switch((opcode >> 12) & 0x0F)
+    {
+        case 0x00:
+            if(d.NN == 0xE0) d.handler = OP_00E0;
+            else if(d.NN == 0xEE) d.handler = OP_00EE;
+            break;
+        case 0x01: d.handler = OP_1NNN; break;
+        case 0x02: d.handler = OP_2NNN; break;
+        case 0x03: d.handler = OP_3XNN; break;
+        case 0x04: d.handler = OP_4XNN; break;
+        case 0x05: d.handler = OP_5XY0; break;
+        case 0x06: d.handler = OP_6XNN; break;
+        case 0x07: d.handler = OP_7XNN; break;
+        case 0x08:
+            switch(d.N)
+            {
+                case 0x0: d.handler = OP_8XY0; break;
+                case 0x1: d.handler = OP_8XY1; break;
+                case 0x2: d.handler = OP_8XY2; break;
+                case 0x3: d.handler = OP_8XY3; break;
+                case 0x4: d.handler = OP_8XY4; break;
+                case 0x5: d.handler = OP_8XY5; break;
+                case 0x6: d.handler = OP_8XY6; break;
+                case 0x7: d.handler = OP_8XY7; break;
+                case 0xE: d.handler = OP_8XYE; break;
+                default: break;
+            }
+            break;
+        case 0x09: d.handler = OP_9XY0; break;
+        case 0x0A: d.handler = OP_ANNN; break;
+        case 0x0B: d.handler = OP_BNNN; break;
+        case 0x0C: d.handler = OP_CXNN; break;
+        case 0x0D: d.handler = OP_DXYN; break;
+        case 0x0E:
+            if(d.NN == 0x9E) d.handler = OP_EX9E;
+            else if(d.NN == 0xA1) d.handler = OP_EXA1;
+            break;
+        case 0x0F:
+            switch(d.NN)
+            {
+                case 0x0A: d.handler = OP_FX0A; break;
+                case 0x07: d.handler = OP_FX07; break;
+                case 0x15: d.handler = OP_FX15; break;
+                case 0x18: d.handler = OP_FX18; break;
+                case 0x1E: d.handler = OP_FX1E; break;
+                case 0x29: d.handler = OP_FX29; break;
+                case 0x33: d.handler = OP_FX33; break;
+                case 0x55: d.handler = OP_FX55; break;
+                case 0x65: d.handler = OP_FX65; break;
+                default: break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return d;
+}
+
+// Empty the cache, required whenever RAM is changed behind the cache's back (e.g. loading a new ROM)
+void decode_cache_reset(decode_cache_t *cache)
+{
+    memset(cache, 0, sizeof *cache);
+}
+
+// Drop every entry whose opcode overlaps the `length` bytes written at `address`.
+// An opcode at A reads A and A+1, so the entry just before the range is dropped as well.
+void decode_cache_invalidate(decode_cache_t *cache, const uint16_t address, const uint16_t length)
+{
+    const uint16_t first = (address - 1) & 0xFFF;
+    if(length < 64 && !decode_bitmap_any(cache->code_bitmap, first, length + 1)) return; // Plain data write, nothing decoded there
+
+    for(uint16_t i = 0; i <= length; i++)
+    {
+        const uint16_t entry = (first + i) & 0xFFF;
+        cache->entries[entry].handler = OP_DECODE;
+        cache->code_bitmap[entry >> 6] &= ~(1ull << (entry & 63));
+    }
+}
+
+// Fill in an empty entry in place, the run loop then dispatches on the new handler
+static inline void decode_entry(chip8_t *chip8, decode_cache_t *cache, const decoded_t *d)
+{
+    const uint16_t address = d - cache->entries;
+    cache->entries[address] = decode_instruction((chip8->ram[address] << 8) | chip8->ram[(address + 1) & 0xFFF]);
+    cache->code_bitmap[address >> 6] |= 1ull << (address & 63);
+}
+
+// Run up to `cycles` instructions through the decode cache.
+// Same contract and chip8_event_t results as chip8_run().
+uint32_t decode_cache_run(chip8_t *chip8, decode_cache_t *cache, uint32_t cycles)
+{
+    uint32_t events = CHIP8_EVENT_NONE;
+    const bool sound_was_on = chip8->sound_timer > 0;
+    const decoded_t *d;
+
+    if(chip8->state != RUNNING) cycles = 0;
+
+#if DECODE_THREADED
+    #define DECODE_LABEL(name) [OP_##name] = &&L_##name,
+    static void* const labels[OP_COUNT] = { DECODE_HANDLERS(DECODE_LABEL) };
+    #undef DECODE_LABEL
+
+    // Fetch the next cached instruction and jump straight to its handler
+    #define NEXT() do { \
+        if(cycles-- == 0) goto done; \
+        d = &cache->entries[chip8->PC & 0xFFF]; \
+        chip8->PC += 2; \
+        goto *labels[d->handler]; \
+    } while(0)
+
+    NEXT();
+
+L_DECODE:
+    decode_entry(chip8, cache, d);
+    goto *labels[d->handler];
+
+    #define DECODE_CASE(name) L_##name: op_##name(chip8, d); NEXT();
+    DECODE_PLAIN_HANDLERS(DECODE_CASE)
+    #undef DECODE_CASE
+
+L_00E0:
+    op_00E0(chip8, d);
+    events |= CHIP8_EVENT_DRAW;
+    NEXT();
+
+L_DXYN:
+    op_DXYN(chip8, d);
+    events |= CHIP8_EVENT_DRAW;
+    NEXT();
+
+L_FX0A:
+    op_FX0A(chip8, d);
+    if((chip8->PC & 0xFFF) == d - cache->entries)
+    {
+        events |= CHIP8_EVENT_WAIT_KEY;
+        goto done;
+    }
+    NEXT();
+
+L_FX33:
+    op_FX33(chip8, d);
+    decode_cache_invalidate(cache, chip8->I, 3);
+    NEXT();
+
+L_FX55:
+    op_FX55(chip8, d);
+    decode_cache_invalidate(cache, chip8->I, d->X + 1);
+    NEXT();
+
+    #undef NEXT
+#else
+    #define DECODE_POINTER(name) [OP_##name] = op_##name,
+    static void (* const handlers[OP_COUNT])(chip8_t*, const decoded_t*) = {
+        DECODE_PLAIN_HANDLERS(DECODE_POINTER)
+        DECODE_EVENT_HANDLERS(DECODE_POINTER)
+    };
+    #undef DECODE_POINTER
+
+    while(cycles-- > 0)
+    {
+        d = &cache->entries[chip8->PC & 0xFFF];
+        chip8->PC += 2;
+        if(d->handler == OP_DECODE) decode_entry(chip8, cache, d);
+
+        const uint8_t handler = d->handler;
+        handlers[handler](chip8, d);
+        if(handler < OP_00E0) continue;
+
+        if(handler == OP_FX0A && (chip8->PC & 0xFFF) == d - cache->entries)
+        {
+            events |= CHIP8_EVENT_WAIT_KEY;
+            goto done;
+        } else if(handler == OP_00E0 || handler == OP_DXYN) {
+            events |= CHIP8_EVENT_DRAW;
+        } else if(handler == OP_FX33) {
+            decode_cache_invalidate(cache, chip8->I, 3);
+        } else if(handler == OP_FX55) {
+            decode_cache_invalidate(cache, chip8->I, d->X + 1);
+        }
+    }
+#endif
+
+done:;
+    const bool sound_is_on = chip8->sound_timer > 0;
+    if(sound_is_on && !sound_was_on) events |= CHIP8_EVENT_SOUND_ON;
+    if(!sound_is_on && sound_was_on) events |= CHIP8_EVENT_SOUND_OFF;
+
+    return events;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// Every handler the decoder can select. OP_DECODE marks an empty cache entry and
+// OP_NOP covers unimplemented / invalid opcodes. Plain handlers either run straight on to the
+// next instruction or, the jump handlers, jump, call, return or skip. Event handlers either report
+// chip8_event_t flags back to the run loop or write RAM, and are kept last.
+#define DECODE_STRAIGHT_HANDLERS(X) \
+    X(NOP) X(6XNN) X(7XNN) \
+    X(8XY0) X(8XY1) X(8XY2) X(8XY3) X(8XY4) X(8XY5) X(8XY6) X(8XY7) X(8XYE) \
+    X(ANNN) X(CXNN) X(FX07) X(FX15) X(FX18) X(FX1E) X(FX29) X(FX65)
+
+#define DECODE_JUMP_HANDLERS(X) \
+    X(00EE) X(1NNN) X(2NNN) X(BNNN) X(3XNN) X(4XNN) X(5XY0) X(9XY0) X(EX9E) X(EXA1)
+
+#define DECODE_PLAIN_HANDLERS(X) \
+    DECODE_STRAIGHT_HANDLERS(X) DECODE_JUMP_HANDLERS(X)
+
+#define DECODE_EVENT_HANDLERS(X) \
+    X(00E0) X(DXYN) X(FX0A) X(FX33) X(FX55)
+
+#define DECODE_HANDLERS(X) \
+    X(DECODE) DECODE_PLAIN_HANDLERS(X) DECODE_EVENT_HANDLERS(X)
+
+typedef enum {
+#define DECODE_ENUM(name) OP_##name,
+    DECODE_HANDLERS(DECODE_ENUM)
+#undef DECODE_ENUM
+    OP_COUNT,
+} decode_op_t;
+
+// Pre-decoded instruction: handler plus the operands it needs, 8 bytes
+typedef struct {
+    uint8_t handler;    // decode_op_t
+    uint8_t X;          // 4 bit register identifier
+    uint8_t Y;          // 4 bit register identifier
+    uint8_t N;          // 4 bit constant
+    uint8_t NN;         // 8 bit constant
+    uint16_t NNN;       // 12 bit address
+} decoded_t;
+
+// Decode Cache Object, one entry per RAM address the PC can point at.
+// A zeroed cache is empty and valid.
+typedef struct {
+    decoded_t entries[4096];
+    uint64_t code_bitmap[4096 / 64];    // Bit per RAM address holding a decoded entry, lets data writes skip invalidation
+} decode_cache_t;
+
+// The bits for the `count` RAM addresses from `start` on, lowest first, of a bitmap of one bit per
+// address, count <= 64. A range running past 0xFFF wraps around to address 0 like RAM accesses do.
+static inline uint64_t decode_bitmap_bits(const uint64_t bitmap[4096 / 64], const uint16_t start, const uint8_t count)
+{
+    const uint16_t word = (start >> 6) & 63;
+    const uint8_t shift = start & 63;
+    const uint64_t bits = (bitmap[word] >> shift) | (shift ? bitmap[(word + 1) & 63] << (64 - shift) : 0);
+    return bits & (count == 64 ? ~0ull : (1ull << count) - 1);
+}
+
+// Whether any of those bits is set
+static inline bool decode_bitmap_any(const uint64_t bitmap[4096 / 64], const uint16_t start, const uint8_t count)
+{
+    return decode_bitmap_bits(bitmap, start, count) != 0;
+}
+
+// Whether the RAM ranges [a_start, a_end) and [b_start, b_end) share a byte. Starts are RAM
+// addresses (0 - 0xFFF), an end past 0x1000 means the range wraps around to address 0.
+static inline bool decode_ranges_overlap(const uint32_t a_start, const uint32_t a_end,
+                                         const uint32_t b_start, const uint32_t b_end)
+{
+    return (a_start < b_end && b_start < a_end) || a_start + 0x1000 < b_end || b_start + 0x1000 < a_end;
+}
+
+decoded_t decode_instruction(const uint16_t opcode);
+void decode_cache_reset(decode_cache_t *cache);
+void decode_cache_invalidate(decode_cache_t *cache, const uint16_t address, const uint16_t length);
+uint32_t decode_cache_run(chip8_t *chip8, decode_cache_t *cache, uint32_t cycles);
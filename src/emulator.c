@@ -1,332 +1,314 @@
 #include "emulator.h"
+#include "profile.h"
+#include "trace.h"
 
-#ifdef DEBUG
-    void print_debug_info(chip8_t *chip8) 
+// CHIP8 Instruction Format, decoded by execute()
+typedef struct {
+    uint16_t opcode;
+    uint16_t NNN;   // 12 bit address
+    uint8_t NN;     // 8 bit constant
+    uint8_t N;      // 4 bit constant
+    uint8_t X;      // 4 bit register identifier
+    uint8_t Y;      // 4 bit register identifier
+} instruction_t;
+
+// RAM address mask for a quirk set, constant wherever `quirks` is
+static inline __attribute__((always_inline)) uint16_t address_mask(const uint32_t quirks)
+{
+    return (quirks & CHIP8_QUIRK_LONG_MEMORY) ? CHIP8_LONG_RAM_SIZE - 1 : CHIP8_RAM_SIZE - 1;
+}
+
+// Draw a sprite at (VX, VY) of height N and width 8 pixels from memory location I, XORing it onto
+// every selected plane and setting VF on collision. With CHIP8_QUIRK_HIRES, DXY0 draws a 16x16
+// sprite of 2 bytes per row. Each plane's sprite data follows the previous plane's.
+// Each sprite row is shifted into place and applied to a whole display row at once. Pixels past
+// the right or bottom edge are clipped, or with CHIP8_QUIRK_WRAP drawn from the opposite edge.
+// Low resolution rows are built as a word, so plain CHIP8 draws cost what they did at 64x32.
+static inline __attribute__((always_inline))
+void draw(chip8_t* chip8, const uint8_t X, const uint8_t Y, const uint8_t N, const uint32_t quirks)
+{
+    PROFILE_DRAW_BEGIN();
+    const bool wrap = quirks & CHIP8_QUIRK_WRAP;
+    const bool hires = (quirks & CHIP8_QUIRK_HIRES) && chip8->hires;
+    const bool big = (quirks & CHIP8_QUIRK_HIRES) && N == 0;
+    const uint8_t planes = (quirks & CHIP8_QUIRK_PLANES) ? chip8->planes : 1;
+    const uint8_t width = hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    const uint8_t height = hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    const uint8_t sprite_width = big ? 16 : 8;
+    const uint8_t sprite_height = big ? 16 : N;
+    const uint8_t X_coord = chip8->V[X] % width;
+    const uint8_t Y_coord = chip8->V[Y] % height;
+    const uint16_t mask = address_mask(quirks);
+    uint16_t address = chip8->I;
+    chip8_row_t collision = 0;
+    uint64_t dirty = 0;
+    uint32_t rows_drawn = 0;
+    chip8->V[0xF] = 0; // Carry flag initialized to 0
+
+    for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
     {
-        printf("Current PC Address: 0x%04X, Opcode: 0x%04X Description: ", chip8->PC - 2, chip8->instruction.opcode);
-        switch((chip8->instruction.opcode >> 12) & 0x0F)
+        if(!(planes & (1 << plane))) continue;
+
+        // Loop over the rows of the sprite to be drawn, stopping at the bottom edge unless wrapping
+        for(uint8_t i = 0; i < sprite_height && (wrap || Y_coord + i < height); i++)
         {
-            case 0x00:
-                if(chip8->instruction.NN == 0xE0)
-                {
-                    //0x00E0: Clear the screen
-                    printf("Clear Screen\n");
-                } else if (chip8->instruction.NN == 0xEE) {
-                    // 0x00EE: Return from a subroutine
-                    // Set PC to last return address which was stored on the subroutine stack, and the pop it off
-                    printf("Return from subroutine at address 0x%04X\n", *(chip8->stack_pointer - 1));
-                } else {
-                    printf("Unimplemented opcode\n");
-                }
-                break;
-            case 0x01:
-                // 1NNN: Jump to address at NNN.
-                printf("PC set to NNN: (0x%04X)\n", chip8->instruction.NNN);
-                break;
-            case 0x02:
-                // 0x2NNN: Call Subroutine at NNN:
-                // Store the return point (PC, which has been incremented by 2 to avoid an infinite loop of calling the subroutine and returning to it)
-                // Update the PC to NNN, which is where the subroutine is located
-                printf("Call Subroutine located at 0x%04X\n", chip8->instruction.NNN);
-                break;
-            case 0x03:
-                // 0x3XNN: Skip the next instruction if value in Vx == NN
-                printf("If V%X (0x%02X) is is equal to NN (0x%02X), then skip the next instruction.\n", chip8->instruction.X, 
-                        chip8->V[chip8->instruction.X], chip8->instruction.NN);
-                break;
-            case 0x04:
-                // 0x4XNN: Skips the next instruction if VX does not equal NN
-                printf("If V%X  (0x%02X)is is not equal to NN (0x%02X), then skip the next instruction.\n", chip8->instruction.X, 
-                        chip8->V[chip8->instruction.X], chip8->instruction.NN);
-                break;
-            case 0x05:
-                // 0x5XY0: Skips the next instruction if VX equals VY
-                printf("If V%X  (0x%02X) is equal to V%X (0x%02X), then skip the next instruction.\n", 
-                        chip8->instruction.X, chip8->V[chip8->instruction.X],
-                        chip8->instruction.Y, chip8->V[chip8->instruction.Y]);
-                break;
-            case 0x06:
-                // 0x6XNN: Set Register Vx = NN
-                printf("Set Register V%01X to 0x%02X\n", chip8->instruction.X, chip8->instruction.NN);
-                break;
-            case 0x07:
-                // 0x7XNN: Vx += NN. Carry flag is not changed
-                printf("Value NN (0x%02X) was added to register V%X, which had initial value 0x%02X\n",
-                        chip8->instruction.NN, chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                break;
-            case 0x08:
-                switch(chip8->instruction.N)
-                {
-                    case 0:
-                        // 0x8XY0: Set the value of Vx equal to the value of Vy
-                        printf("Value of V%X set to value of V%X (0x%02X)\n", chip8->instruction.X, chip8->instruction.Y,
-                                chip8->V[chip8->instruction.Y]); 
-                        break;
-                    case 1:
-                        // 0x8XY1: Set Vx to Vx | Vy (Bitwise OR)
-                        printf("Set V%X to bitwise OR with V%X (0x%02X)\n", chip8->instruction.X, chip8->instruction.Y,
-                                chip8->V[chip8->instruction.Y]);
-                        break;
-                    case 2:
-                        // 0x8XY1: Set Vx to Vx & Vy (Bitwise AND)
-                        printf("Set V%X to bitwise AND with V%X (0x%02X)\n", chip8->instruction.X, chip8->instruction.Y,
-                                chip8->V[chip8->instruction.Y]);
-                        break;
-                    case 3:
-                        // 0x8XY3: Set Vx to Vx ^ Vy (Bitwise XOR)
-                        printf("Set V%X to bitwise XOR with V%X (0x%02X)\n", chip8->instruction.X, chip8->instruction.Y,
-                                chip8->V[chip8->instruction.Y]);
-                        break;
-                    case 4:
-                        // 0x8XY4: Add Vy to Vx. Set VF to 1 if overflow occurs, else set it to 0
-                        printf("V%X (0x%02X) += V%X (0x%02X)\n"
-                                , chip8->instruction.X, chip8->V[chip8->instruction.X]
-                                , chip8->instruction.Y, chip8->V[chip8->instruction.Y]);
-                        break;
-                    case 5:
-                        // 0x8XY5: Subtract Vy from Vx. Set VF to 1 when no underflow occurs, and 0 when there is underflow
-                        printf("V%X (0x%02X) -= V%X (0x%02X)\n"
-                                , chip8->instruction.X, chip8->V[chip8->instruction.X]
-                                , chip8->instruction.Y, chip8->V[chip8->instruction.Y]);
-                        break;
-                    case 6:
-                        // 0x8XY6: Shift VX to the right by 1, then store the least significant bit of VX prior to the shift into VF
-                        printf("Right shift V%X (0x%02X) by 1 bit\n", chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                        break;
-                    case 7:
-                        // 0x8XY7: Set VX to VY minus VX. VF is set to 0 when there is an underflow, and 1 when there is not.
-                        printf("V%X (0x%02X) = V%X (0x%02X) - V%X\n"
-                                , chip8->instruction.X, chip8->V[chip8->instruction.X]
-                                , chip8->instruction.Y, chip8->V[chip8->instruction.Y]
-                                , chip8->instruction.X);
-                        break;
-                    case 0xE: 
-                        // 0x8XYE: Shift VX to the left by 1. Set VF to 1 if the MSB of VX prior to that shift was set, or to 0 if it was unset.
-                        printf("Left shift V%X (0x%02X) by 1 bit\n", chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                        break;
-                    default:
-                        printf("Unimplemented Opcode");
-                        break; // unimplemented or invalid opcode
-                }
-                break;
-            case 0x09:
-                // 0x9XY0: Skips the next instruction if VX != VY
-                printf("If V%X  (0x%02X) is not equal to V%X (0x%02X), then skip the next instruction.\n", 
-                        chip8->instruction.X, chip8->V[chip8->instruction.X],
-                        chip8->instruction.Y, chip8->V[chip8->instruction.Y]);
-                break;
-            case 0x0A:
-                printf("Set the Instruction Register I to 0x%04X\n", chip8->instruction.NNN);
-                break;
-            case 0x0B:
-                // 0xBNNN: Jump to the address at V0 + NNN
-                printf("Set PC to V0 (0x%02X) + NNN (0x%04X) = 0x%04X\n", chip8->V[0], chip8->instruction.NNN, 
-                                                                        chip8->V[0] + chip8->instruction.NNN);
-                break;
-            case 0x0C:
-                // 0xCXNN: Set register Vx to NN & rand(0, 255)
-                printf("Set register V%X to NN(0x%02X) & (rand() mod 256)\n", chip8->instruction.X, chip8->instruction.NN);
-                break;
-            case 0x0D:
-                // 0xDXYN: Draw pixel Vx, Vy, heignt N and width 8
-                printf("Drawing sprite with height N (%u), at coords V%X (%02X), V%X, (%02X), from memory location I (0x%04X)\n",
-                        chip8->instruction.N, chip8->instruction.X, chip8->V[chip8->instruction.X], 
-                                              chip8->instruction.Y, chip8->V[chip8->instruction.Y], chip8->I);
-                break;
-            case 0x0E:
-                if(chip8->instruction.NN == 0x9E) 
-                {
-                    //0xEX9E: Skip the next instruction if the key is pressed:
-                    printf("Skip next instruction if key stored in V%X (%X) is being pressed %d\n", 
-                            chip8->instruction.X, chip8->V[chip8->instruction.X], chip8->keypad[chip8->V[chip8->instruction.X]]);
-
-                } else if (chip8->instruction.NN == 0xA1) {
-                    //0xEXA1: Skip the next instruction if the key is not pressed:
-                    printf("Skip next instruction if key stored in V%X (%X) is  not being pressed %d\n", 
-                            chip8->instruction.X, chip8->V[chip8->instruction.X], chip8->keypad[chip8->V[chip8->instruction.X]]);
-                }
-                break;
-            case 0x0F:
-                switch(chip8->instruction.NN)
-                {
-                    case 0x0A:
-                        // 0xFX0A: A key press is awaited, and then stored in in Vx (Blocking operation, all instructions halted until next key event)
-                        printf("Wait until a key is pressed, store key in V%X\n", chip8->instruction.X);
-                        break;
-                    case 0x07:
-                        // 0xFX07: Set Vx to the value of the delay timer
-                        printf("Set value of V%X to the value of the delay timer (0x%X)\n", chip8->instruction.X, chip8->delay_timer);
-                        break;
-                    case 0x15:
-                        // 0xFX15: Set the delay timer to value of Vx
-                        printf("Set the value of the delay timer to V%X (0x%02X)\n", chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                        break;
-                    case 0x18:
-                        // 0xFX18: Set the sound timer to the value of Vx
-                        printf("Set the value of the sound timer to V%X (0x%02X)\n", chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                        break;
-                    case 0x1E:
-                        // 0xFX1E: Add Vx to I ie I += Vx
-                        printf("Increment I (0x%04X) by V%X (%02X) = 0x%04X\n",
-                                chip8->I, chip8->instruction.X, chip8->V[chip8->instruction.X], chip8->I + chip8->V[chip8->instruction.X]);
-                        break;
-                    case 0x29:
-                        // 0xFX29: Set I to the location of the sprite for the character in Vx
-                        // Vx has 0x0 - 0xF so it is the sprite for one of those characters
-                        // Font is stored at start of RAM.
-                        // So offset into RAM by 5 * Vx
-                        printf("Set I to sprite location in memory for character in V%X =  (0x%02X) * 5\n", 
-                                chip8->instruction.X, chip8->V[chip8->instruction.X]);
-                        break;
-                    case 0x33:
-                        // 0xFX33: Stores the binary-coded decimal representation of VX, 
-                        // with the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
-                        printf("Store BCD representation of V%X (%02X) at memory offset in I (0x%04X)\n",
-                                chip8->instruction.X, chip8->V[chip8->instruction.X], chip8->I );
-                        break;
-                    case 0x55:
-                        // 0xFX55: Store V0 to VX in ram location starting at location in I.
-                        printf("Reg dump V0 to V%X (inclusive) in ram location starting at I (0x%04X)\n", 
-                                chip8->instruction.X, chip8->I);
-                        break;
-                    case 0x65:
-                        // 0xFX65: Store V0 to VX in ram location starting at location in I.
-                        printf("Reg load ram location starting at I (0x%04X) into V0 to V%X (inclusive)\n", 
-                                chip8->I, chip8->instruction.X);
-                        break;
-                    default:
-                        printf("Unimplemented opcode\n");
-                        break;
-                }
-                break;
-            default:
-                printf("Unimplemented opcode\n");
-                break; // Uninimplemented / invalid opcode
+            const uint16_t bits = big ? (chip8->ram[(address + 2 * i) & mask] << 8) | chip8->ram[(address + 2 * i + 1) & mask]
+                                      : chip8->ram[(address + i) & mask];
+
+            // Sprite row moved to the top bits, then shifted right to X. Bits shifted out are
+            // clipped, or rotated back in on the left when wrapping.
+            chip8_row_t sprite_row;
+            if(hires)
+            {
+                const chip8_row_t sprite = (chip8_row_t) bits << (CHIP8_HIRES_WIDTH - sprite_width);
+                sprite_row = wrap ? (sprite >> X_coord) | (sprite << ((CHIP8_HIRES_WIDTH - X_coord) & 127)) : sprite >> X_coord;
+            } else {
+                const uint64_t sprite = (uint64_t) bits << (CHIP8_DISPLAY_WIDTH - sprite_width);
+                sprite_row = (chip8_row_t) (wrap ? (sprite >> X_coord) | (sprite << ((CHIP8_DISPLAY_WIDTH - X_coord) & 63))
+                                                 : sprite >> X_coord) << 64;
+            }
+            const uint8_t row = (Y_coord + i) % height;
+            chip8_row_t *display_row = &chip8->display[plane][row];
+
+            // Any sprite pixel landing on a lit display pixel is a collision
+            collision |= *display_row & sprite_row;
+            *display_row ^= sprite_row;
+            dirty |= (uint64_t) (sprite_row != 0) << row;
+            rows_drawn++;
         }
+        address += sprite_height * (sprite_width / 8);
     }
-#endif
 
-// Emulate 1 CHIP8 instruction
-void emulate_instruction(chip8_t* chip8, const config_t config)
+    chip8->dirty_rows |= dirty;
+    if(collision) chip8->V[0xF] = 1;
+    PROFILE_DRAW_END(rows_drawn, collision);
+}
+
+// Clipping plain CHIP8 draw shared by every execution engine, see draw()
+void draw_sprite(chip8_t* chip8, const uint8_t X, const uint8_t Y, const uint8_t N)
+{
+    draw(chip8, X, Y, N, 0);
+}
+
+// Scroll the selected planes by `rows` display rows, down if positive, up if negative
+static void scroll_vertical(chip8_t* chip8, const uint8_t planes, const int rows)
+{
+    const int height = chip8->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    const int magnitude = rows < 0 ? -rows : rows;
+    const int distance = magnitude < height ? magnitude : height;
+
+    for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if(!(planes & (1 << plane))) continue;
+
+        chip8_row_t *display = chip8->display[plane];
+        if(rows > 0)
+        {
+            memmove(&display[distance], &display[0], (height - distance) * sizeof *display);
+            memset(&display[0], 0, distance * sizeof *display);
+        } else {
+            memmove(&display[0], &display[distance], (height - distance) * sizeof *display);
+            memset(&display[height - distance], 0, distance * sizeof *display);
+        }
+    }
+    chip8->dirty_rows = ~0ull;
+}
+
+// Scroll the selected planes by `pixels` columns, right if positive, left if negative
+static void scroll_horizontal(chip8_t* chip8, const uint8_t planes, const int pixels)
+{
+    // Low resolution rows must not spill into the unused low 64 bits
+    const chip8_row_t visible = chip8->hires ? ~(chip8_row_t) 0 : ~(chip8_row_t) 0 << 64;
+    const uint8_t height = chip8->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+
+    for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        if(!(planes & (1 << plane))) continue;
+
+        for(uint8_t y = 0; y < height; y++)
+        {
+            chip8_row_t *row = &chip8->display[plane][y];
+            *row = (pixels > 0 ? *row >> pixels : *row << -pixels) & visible;
+        }
+    }
+    chip8->dirty_rows = ~0ull;
+}
+
+// Skip the next instruction. With CHIP8_QUIRK_LONG_MEMORY that is 4 bytes if it is F000 NNNN.
+static inline __attribute__((always_inline)) void skip(chip8_t* chip8, const uint32_t quirks)
+{
+    const uint16_t mask = address_mask(quirks);
+    const bool long_load = (quirks & CHIP8_QUIRK_LONG_MEMORY) &&
+                           chip8->ram[chip8->PC & mask] == 0xF0 && chip8->ram[(chip8->PC + 1) & mask] == 0x00;
+    chip8->PC += long_load ? 4 : 2;
+}
+
+// Emulate 1 CHIP8 instruction with the given chip8_quirk_t behaviours. Always inlined with a
+// constant `quirks`, so every quirk test is resolved at compile time. Returns the opcode it ran.
+static inline __attribute__((always_inline))
+uint16_t execute(chip8_t* chip8, const uint32_t quirks)
 {
+    const uint16_t mask = address_mask(quirks);
+    instruction_t instruction;
     bool carry;
 
-    (chip8->instruction).opcode = (chip8->ram[chip8->PC] << 8) | (chip8->ram[chip8->PC + 1]);
+    instruction.opcode = (chip8->ram[chip8->PC & mask] << 8) | (chip8->ram[(chip8->PC + 1) & mask]);
     chip8->PC += 2; // Increment PC for the next opcode
 
     // Fill out the instruction format
-    chip8->instruction.NNN = chip8->instruction.opcode & 0x0FFF;
-    chip8->instruction.NN = chip8->instruction.opcode & 0x0FF;
-    chip8->instruction.N = chip8->instruction.opcode & 0x0F;
-    chip8->instruction.X = (chip8->instruction.opcode >> 8) & 0x0F;
-    chip8->instruction.Y = (chip8->instruction.opcode >> 4) & 0x0F;
-
-#ifdef DEBUG
-    print_debug_info(chip8);
-#endif
+    instruction.NNN = instruction.opcode & 0x0FFF;
+    instruction.NN = instruction.opcode & 0x0FF;
+    instruction.N = instruction.opcode & 0x0F;
+    instruction.X = (instruction.opcode >> 8) & 0x0F;
+    instruction.Y = (instruction.opcode >> 4) & 0x0F;
+
+    TRACE_BEGIN(chip8, instruction.opcode);
 
     // Emulate opcode:
-    switch((chip8->instruction.opcode >> 12) & 0x0F)
+    switch((instruction.opcode >> 12) & 0x0F)
     {
         case 0x00:
-            if(chip8->instruction.NN == 0xE0)
+            if(instruction.NN == 0xE0)
             {
-                //0x00E0: Clear the screen
-                memset(&chip8->display[0], false, sizeof(chip8->display)); 
-            } else if (chip8->instruction.NN == 0xEE) {
+                //0x00E0: Clear the screen, the selected planes with CHIP8_QUIRK_PLANES
+                for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
+                {
+                    if(((quirks & CHIP8_QUIRK_PLANES) ? chip8->planes : 1) & (1 << plane))
+                    {
+                        memset(chip8->display[plane], 0, sizeof chip8->display[plane]);
+                    }
+                }
+                chip8->dirty_rows = ~0ull;
+            } else if (instruction.NN == 0xEE) {
                 // 0x00EE: Return from a subroutine
                 // Set PC to last return address which was stored on the subroutine stack, and the pop it off
-                chip8->PC = *--chip8->stack_pointer;
+                chip8->PC = chip8->stack[--chip8->SP & 15];
+            } else if((quirks & CHIP8_QUIRK_HIRES) && (instruction.NN & 0xF0) == 0xC0) {
+                // 0x00CN: Scroll the selected planes down N rows
+                scroll_vertical(chip8, (quirks & CHIP8_QUIRK_PLANES) ? chip8->planes : 1, instruction.N);
+            } else if((quirks & CHIP8_QUIRK_PLANES) && (instruction.NN & 0xF0) == 0xD0) {
+                // 0x00DN: Scroll the selected planes up N rows
+                scroll_vertical(chip8, chip8->planes, -instruction.N);
+            } else if((quirks & CHIP8_QUIRK_HIRES) && instruction.NN == 0xFB) {
+                // 0x00FB: Scroll the selected planes right 4 pixels
+                scroll_horizontal(chip8, (quirks & CHIP8_QUIRK_PLANES) ? chip8->planes : 1, 4);
+            } else if((quirks & CHIP8_QUIRK_HIRES) && instruction.NN == 0xFC) {
+                // 0x00FC: Scroll the selected planes left 4 pixels
+                scroll_horizontal(chip8, (quirks & CHIP8_QUIRK_PLANES) ? chip8->planes : 1, -4);
+            } else if((quirks & CHIP8_QUIRK_HIRES) && (instruction.NN & 0xFE) == 0xFE) {
+                // 0x00FE / 0x00FF: Switch to low / high resolution, clearing every plane
+                chip8->hires = instruction.NN & 1;
+                memset(chip8->display, 0, sizeof chip8->display);
+                chip8->dirty_rows = ~0ull;
             }
             break;
         case 0x01:
             // 1NNN: Jump to address at NNN.
-            chip8->PC = chip8->instruction.NNN;
+            chip8->PC = instruction.NNN;
             break;
         case 0x02:
             // 0x2NNN: Call Subroutine at NNN:
             // Store the return point (PC, which has been incremented by 2 to avoid an infinite loop of calling the subroutine and returning to it)
             // Update the PC to NNN, which is where the subroutine is located
-            *chip8->stack_pointer++ = chip8->PC;
-            chip8->PC = chip8->instruction.NNN;
+            chip8->stack[chip8->SP++ & 15] = chip8->PC;
+            chip8->PC = instruction.NNN;
+            PROFILE_CALL(chip8->SP);
             break;
         case 0x03:
             // 0x3XNN: Skip the next instruction if value in Vx == NN
-            if(chip8->V[chip8->instruction.X] == chip8->instruction.NN)
+            if(chip8->V[instruction.X] == instruction.NN)
             {
-                chip8->PC += 2;
+                skip(chip8, quirks);
             }
             break;
         case 0x04:
             // 0x4XNN: Skips the next instruction if VX does not equal NN
-            if(chip8->V[chip8->instruction.X] != chip8->instruction.NN)
+            if(chip8->V[instruction.X] != instruction.NN)
             {
-                chip8->PC += 2;
+                skip(chip8, quirks);
             }
             break;
         case 0x05:
             // 0x5XY0: Skips the next instruction if VX equals VY
-            if(chip8->V[chip8->instruction.X] == chip8->V[chip8->instruction.Y])
+            if(chip8->V[instruction.X] == chip8->V[instruction.Y])
             {
-                chip8->PC += 2;
+                skip(chip8, quirks);
             }
             break;
         case 0x06:
             // 0x6XNN: Set Register Vx = NN
-            chip8->V[chip8->instruction.X] = chip8->instruction.NN;
+            chip8->V[instruction.X] = instruction.NN;
             break;
         case 0x07:
             // 0x7XNN: Vx += NN. Carry flag is not changed
-            chip8->V[chip8->instruction.X] += chip8->instruction.NN;
+            chip8->V[instruction.X] += instruction.NN;
             break;
         case 0x08:
-            switch(chip8->instruction.N)
+            switch(instruction.N)
             {
                 case 0:
                     // 0x8XY0: Set the value of Vx equal to the value of Vy
-                    chip8->V[chip8->instruction.X] = chip8->V[chip8->instruction.Y]; 
+                    chip8->V[instruction.X] = chip8->V[instruction.Y]; 
                     break;
                 case 1:
                     // 0x8XY1: Set Vx to Vx | Vy (Bitwise OR)
-                    chip8->V[chip8->instruction.X] |= chip8->V[chip8->instruction.Y];
+                    chip8->V[instruction.X] |= chip8->V[instruction.Y];
+                    if(quirks & CHIP8_QUIRK_VF_RESET) chip8->V[0xF] = 0;
                     break;
                 case 2:
                     // 0x8XY1: Set Vx to Vx & Vy (Bitwise AND)
-                    chip8->V[chip8->instruction.X] &= chip8->V[chip8->instruction.Y];
+                    chip8->V[instruction.X] &= chip8->V[instruction.Y];
+                    if(quirks & CHIP8_QUIRK_VF_RESET) chip8->V[0xF] = 0;
                     break;
                 case 3:
                     // 0x8XY3: Set Vx to Vx ^ Vy (Bitwise XOR)
-                    chip8->V[chip8->instruction.X] ^= chip8->V[chip8->instruction.Y];
+                    chip8->V[instruction.X] ^= chip8->V[instruction.Y];
+                    if(quirks & CHIP8_QUIRK_VF_RESET) chip8->V[0xF] = 0;
                     break;
                 case 4:
                     // 0x8XY4: Add Vy to Vx. Set VF to 1 if overflow occurs, else set it to 0
-                    carry = (chip8->V[chip8->instruction.X] + chip8->V[chip8->instruction.Y]) > 255;
-                    chip8->V[chip8->instruction.X] += chip8->V[chip8->instruction.Y];
+                    carry = (chip8->V[instruction.X] + chip8->V[instruction.Y]) > 255;
+                    chip8->V[instruction.X] += chip8->V[instruction.Y];
                     chip8->V[0xF] = carry;
                     break;
                 case 5:
                     // 0x8XY5: Subtract Vy from Vx. Set VF to 1 when no underflow occurs, and 0 when there is underflow
-                    carry = chip8->V[chip8->instruction.Y] <= chip8->V[chip8->instruction.X]; // No underflow
-                    chip8->V[chip8->instruction.X] -= chip8->V[chip8->instruction.Y];
+                    carry = chip8->V[instruction.Y] <= chip8->V[instruction.X]; // No underflow
+                    chip8->V[instruction.X] -= chip8->V[instruction.Y];
                     chip8->V[0xF] = carry;
                     break;
                 case 6:
                     // 0x8XY6: Shift VX to the right by 1, then store the least significant bit of VX prior to the shift into VF
-                    carry = chip8->V[chip8->instruction.X] & 1;
-                    chip8->V[chip8->instruction.X] >>= 1;
+                    // With CHIP8_QUIRK_SHIFT_VY, VY is shifted into VX instead
+                    if(quirks & CHIP8_QUIRK_SHIFT_VY)
+                    {
+                        carry = chip8->V[instruction.Y] & 1;
+                        chip8->V[instruction.X] = chip8->V[instruction.Y] >> 1;
+                    } else {
+                        carry = chip8->V[instruction.X] & 1;
+                        chip8->V[instruction.X] >>= 1;
+                    }
                     chip8->V[0xF] = carry;
                     break;
                 case 7:
                     // 0x8XY7: Set VX to VY minus VX. VF is set to 0 when there is an underflow, and 1 when there is not.
-                    carry = chip8->V[chip8->instruction.X] <= chip8->V[chip8->instruction.Y]; // No underflow
-                    chip8->V[chip8->instruction.X] = chip8->V[chip8->instruction.Y] - chip8->V[chip8->instruction.X];
+                    carry = chip8->V[instruction.X] <= chip8->V[instruction.Y]; // No underflow
+                    chip8->V[instruction.X] = chip8->V[instruction.Y] - chip8->V[instruction.X];
                     chip8->V[0xF] = carry;
                     break;
                 case 0xE: 
                     // 0x8XYE: Shift VX to the left by 1. Set VF to 1 if the MSB of VX prior to that shift was set, or to 0 if it was unset.
-                    carry = chip8->V[chip8->instruction.X] >> 7;
-                    chip8->V[0xF] = carry;
-                    chip8->V[chip8->instruction.X] <<= 1;
+                    // With CHIP8_QUIRK_SHIFT_VY, VY is shifted into VX instead
+                    if(quirks & CHIP8_QUIRK_SHIFT_VY)
+                    {
+                        carry = chip8->V[instruction.Y] >> 7;
+                        chip8->V[instruction.X] = chip8->V[instruction.Y] << 1;
+                        chip8->V[0xF] = carry;
+                    } else {
+                        carry = chip8->V[instruction.X] >> 7;
+                        chip8->V[0xF] = carry;
+                        chip8->V[instruction.X] <<= 1;
+                    }
                     break;
                 default:
                     break; // unimplemented or invalid opcode
@@ -334,144 +316,137 @@ void emulate_instruction(chip8_t* chip8, const config_t config)
             break;
         case 0x09:
             // 0x9XY0: Skips the next instruction if VX != VY
-            if(chip8->V[chip8->instruction.X] != chip8->V[chip8->instruction.Y])
+            if(chip8->V[instruction.X] != chip8->V[instruction.Y])
             {
-                chip8->PC += 2;
+                skip(chip8, quirks);
             }
             break;
         case 0x0A:
             // 0xANNN: Sets I to the address NNN. I: Instruction Register
-            chip8->I = chip8->instruction.NNN;
+            chip8->I = instruction.NNN;
             break;
         case 0x0B:
             // 0xBNNN: Jump to the address at V0 + NNN
-            chip8->PC = chip8->V[0] + chip8->instruction.NNN;
+            // With CHIP8_QUIRK_JUMP_VX this is 0xBXNN, jumping to VX + XNN
+            chip8->PC = chip8->V[(quirks & CHIP8_QUIRK_JUMP_VX) ? instruction.X : 0] + instruction.NNN;
             break;
         case 0x0C:
             // 0xCXNN: Set register Vx to NN & rand(0, 255)
-            chip8->V[chip8->instruction.X] = (rand() % 256) & chip8->instruction.NN;
+            chip8->V[instruction.X] = chip8_random(chip8) & instruction.NN;
             break;
         case 0x0D:
             // 0xDXYN: Draw a sprite at (Vx, Vy), of height N and width 8 pixels
             // Each row of 8 pixels is read as bit-coded starting from memory location I
             // VF (Carry Flag) is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn
             // Screen Pixels will be XORd with sprite bits
-            uint8_t X_coord = chip8->V[chip8->instruction.X] % config.window_width;
-            uint8_t Y_coord = chip8->V[chip8->instruction.Y] % config.window_height;
-            const uint8_t orig_X = X_coord;
-            chip8->V[0xF] = 0; // Carry flag initialized to 0
-            // Loop over the N rows of the sprite to be drawn
-            for(uint8_t i = 0; i < chip8->instruction.N; i++)
-            {
-                // Get row of sprite data
-                const uint8_t sprite_data = chip8->ram[chip8->I + i];
-                X_coord = orig_X; // Reset X for next row
-                
-                for(int8_t j = 7; j >= 0; j--) 
-                {
-                    // If the sprite pixel is on AND the display pixel is on, set the carry flag to 1.
-                    bool* pixel = &chip8->display[(Y_coord * config.window_width) + X_coord];
-                    bool sprite_bit = sprite_data & (1 << j);
-                    if(sprite_bit && (*pixel))
-                    {
-                        chip8->V[0xF] = 1;
-                    }
-                    // display pixel = (display pixel) xor (sprite pixel)
-                    *pixel ^= sprite_bit;  
-
-                    // If the right edge of the screen is hit, stop drawing this row
-                    if(++X_coord >= config.window_width) break;
-                    
-                }
-
-                // If the Y coordinate exceeds the window height, stop drawing the sprite
-                if(++Y_coord >= config.window_height) break;
-            }
+            draw(chip8, instruction.X, instruction.Y, instruction.N, quirks);
             break;
         case 0x0E:
-            if(chip8->instruction.NN == 0x9E) 
+            if(instruction.NN == 0x9E) 
             {
                 //0xEX9E: Skip the next instruction if the key is pressed:
-                if(chip8->keypad[chip8->V[chip8->instruction.X]])
+                if(chip8_key_down(chip8, chip8->V[instruction.X]))
                 {
-                    chip8->PC += 2;
+                    skip(chip8, quirks);
                 }
 
-            } else if (chip8->instruction.NN == 0xA1) {
+            } else if (instruction.NN == 0xA1) {
                 //0xEXA1: Skip the next instruction if the key is not pressed:
-                if(!chip8->keypad[chip8->V[chip8->instruction.X]])
+                if(!chip8_key_down(chip8, chip8->V[instruction.X]))
                 {
-                    chip8->PC += 2;
+                    skip(chip8, quirks);
                 }
             }
             break;
         case 0x0F:
-            switch(chip8->instruction.NN)
+            switch(instruction.NN)
             {
-                case 0x0A:
-                    // 0xFX0A: A key press is awaited, and then stored in in Vx (Blocking operation, all instructions halted until next key event)
-                    bool any_key_pressed = false;
-                    for(uint8_t i = 0; i < sizeof chip8->keypad; i++)
+                case 0x00:
+                    // 0xF000 NNNN: Set I to the 16 bit address in the next 2 bytes
+                    if((quirks & CHIP8_QUIRK_LONG_MEMORY) && instruction.X == 0)
                     {
-                        if(chip8->keypad[i])
-                        {
-                            chip8->V[chip8->instruction.X] = i;
-                            any_key_pressed = true;
-                            break;
-                        }
-
-                        if(!any_key_pressed)
+                        chip8->I = (chip8->ram[chip8->PC & mask] << 8) | chip8->ram[(chip8->PC + 1) & mask];
+                        chip8->PC += 2;
+                    }
+                    break;
+                case 0x01:
+                    // 0xFN01: Select the planes drawn, cleared and scrolled, bit per plane in N
+                    if(quirks & CHIP8_QUIRK_PLANES) chip8->planes = instruction.X & 3;
+                    break;
+                case 0x02:
+                    // 0xF002: Load the 16 byte audio pattern from the location in I
+                    if((quirks & CHIP8_QUIRK_AUDIO) && instruction.X == 0)
+                    {
+                        for(uint8_t i = 0; i < CHIP8_AUDIO_PATTERN_SIZE; i++)
                         {
-                            chip8->PC -= 2; // Repeat this instruction
+                            chip8->audio_pattern[i] = chip8->ram[(chip8->I + i) & mask];
                         }
+                        chip8->audio_pattern_set = true;
                     }
                     break;
+                case 0x3A:
+                    // 0xFX3A: Set the audio pattern pitch to Vx
+                    if(quirks & CHIP8_QUIRK_AUDIO) chip8->pitch = chip8->V[instruction.X];
+                    break;
+                case 0x0A:
+                    // 0xFX0A: A key press is awaited, and then stored in in Vx (Blocking operation, all instructions halted until next key event)
+                    const bool any_key_pressed = chip8->keypad != 0;
+                    if(any_key_pressed)
+                    {
+                        chip8->V[instruction.X] = __builtin_ctz(chip8->keypad); // Lowest held key
+                    } else {
+                        chip8->PC -= 2; // Repeat this instruction
+                    }
+                    PROFILE_KEY_WAIT(!any_key_pressed);
+                    break;
                 case 0x07:
                     // 0xFX07: Set Vx to the value of the delay timer
-                    chip8->V[chip8->instruction.X] = chip8->delay_timer;
+                    chip8->V[instruction.X] = chip8->delay_timer;
                     break;
                 case 0x15:
                     // 0xFX15: Set the delay timer to value of Vx
-                    chip8->delay_timer = chip8->V[chip8->instruction.X];
+                    chip8->delay_timer = chip8->V[instruction.X];
                     break;
                 case 0x18:
                     // 0xFX18: Set the sound timer to the value of Vx
-                    chip8->sound_timer = chip8->V[chip8->instruction.X];
+                    chip8->sound_timer = chip8->V[instruction.X];
                     break;
                 case 0x1E:
                     // 0xFX1E: Add Vx to I ie I += Vx
-                    chip8->I += chip8->V[chip8->instruction.X];
+                    chip8->I += chip8->V[instruction.X];
                     break;
                 case 0x29:
                     // 0xFX29: Set I to the location of the sprite for the character in Vx
                     // Vx has 0x0 - 0xF so it is the sprite for one of those characters
                     // Font is stored at start of RAM.
                     // So offset into RAM by 5 * Vx
-                    chip8->I = chip8->V[chip8->instruction.X] * 5;
+                    chip8->I = chip8->V[instruction.X] * 5;
                     break;
                 case 0x33:
                     // 0xFX33: Stores the binary-coded decimal representation of VX, 
                     // with the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
-                    uint8_t bcd = chip8->V[chip8->instruction.X]; 
-                    chip8->ram[chip8->I+2] = bcd % 10;
+                    uint8_t bcd = chip8->V[instruction.X]; 
+                    chip8->ram[(chip8->I + 2) & mask] = bcd % 10;
                     bcd /= 10;
-                    chip8->ram[chip8->I+1] = bcd % 10;
+                    chip8->ram[(chip8->I + 1) & mask] = bcd % 10;
                     bcd /= 10;
-                    chip8->ram[chip8->I] = bcd;
+                    chip8->ram[chip8->I & mask] = bcd;
                     break;
                 case 0x55:
                     // 0xFX55: Reg dump V0 to VX in ram location starting at location in I.
-                    for(uint8_t i = 0; i <= chip8->instruction.X; i++)
+                    for(uint8_t i = 0; i <= instruction.X; i++)
                     {
-                        chip8->ram[chip8->I + i] = chip8->V[i];
+                        chip8->ram[(chip8->I + i) & mask] = chip8->V[i];
                     }
+                    if(quirks & CHIP8_QUIRK_LOAD_STORE_I) chip8->I += instruction.X + 1;
                     break;
                 case 0x65:
                     // 0xFX65: Reg load starting from ram location in I into V0 to VX in.
-                    for(uint8_t i = 0; i <= chip8->instruction.X; i++)
+                    for(uint8_t i = 0; i <= instruction.X; i++)
                     {
-                        chip8->V[i] = chip8->ram[chip8->I + i];
+                        chip8->V[i] = chip8->ram[(chip8->I + i) & mask];
                     }
+                    if(quirks & CHIP8_QUIRK_LOAD_STORE_I) chip8->I += instruction.X + 1;
                     break;
                 default: 
                     break;
@@ -481,4 +456,125 @@ void emulate_instruction(chip8_t* chip8, const config_t config)
             break; // Uninimplemented / invalid opcode
     }
 
-}
\ No newline at end of file
+    TRACE_END(chip8);
+    return instruction.opcode;
+}
+
+// Emulate 1 CHIP8 instruction with the modern quirk profile, used for stepping by other engines.
+// Returns the opcode it ran.
+uint16_t emulate_instruction(chip8_t* chip8)
+{
+    return execute(chip8, 0);
+}
+
+static uint16_t opcode_at(const chip8_t* chip8, const uint16_t address)
+{
+    const uint16_t mask = chip8->ram_size - 1;
+    return (chip8->ram[address & mask] << 8) | chip8->ram[(address + 1) & mask];
+}
+
+// Length in instructions of the idle loop closed by the 1NNN just executed from `PC`, 0 if it is
+// not one. Within a run an idle loop ends every iteration in the state it started in, only a timer
+// tick or a key change between runs can get it out:
+//     1NNN jumping to itself
+//     FX07 polling: FX07, a skip on VX (3XNN, 4XNN, 5XY0, 9XY0), 1NNN back to the FX07
+static uint32_t idle_loop_length(const chip8_t* chip8, const uint16_t PC)
+{
+    if(chip8->PC == PC) return 1;
+    if(chip8->PC + 4 != PC) return 0;
+
+    const uint16_t load = opcode_at(chip8, chip8->PC);
+    const uint16_t test = opcode_at(chip8, chip8->PC + 2);
+    if((load & 0xF0FF) != 0xF007 || (test & 0x0F00) != (load & 0x0F00)) return 0;
+
+    const bool skip_on_NN = (test & 0xF000) == 0x3000 || (test & 0xF000) == 0x4000;     // 3XNN, 4XNN
+    const bool skip_on_VY = (test & 0xF00F) == 0x5000 || (test & 0xF00F) == 0x9000;     // 5XY0, 9XY0
+    return skip_on_NN || skip_on_VY ? 3 : 0;
+}
+
+// Whether nothing but the timers can change until a key is pressed: blocked on FX0A, or spinning
+// on a 1NNN that jumps to itself, which no key gets out of either.
+bool chip8_stalled(const chip8_t* chip8)
+{
+    const uint16_t opcode = opcode_at(chip8, chip8->PC);
+    if((opcode & 0xF000) == 0x1000) return (opcode & 0x0FFF) == chip8->PC;
+    if((opcode & 0xF0FF) != 0xF00A) return false;
+
+    return chip8->keypad == 0;
+}
+
+// Run up to `cycles` CHIP8 instructions without any frontend involvement.
+// Returns a mask of chip8_event_t flags describing what happened during the run,
+// so a frontend (or a headless host) can decide whether to redraw, start/stop sound, etc.
+// The run stops early if the machine is no longer RUNNING, is blocked on FX0A or, with
+// CHIP8_QUIRK_DISPLAY_WAIT, has drawn a sprite. The iterations of an idle loop are skipped,
+// see idle_loop_length(). Instantiated once per quirk profile below.
+static inline __attribute__((always_inline))
+uint32_t run(chip8_t* chip8, uint32_t cycles, const uint32_t quirks)
+{
+    uint32_t events = CHIP8_EVENT_NONE;
+    const bool sound_was_on = chip8->sound_timer > 0;
+    uint16_t idle_jump = UINT16_MAX;   // Last 1NNN that closed an idle loop, and when it ran
+    uint32_t idle_cycle = 0;
+
+    for(uint32_t i = 0; i < cycles && chip8->state == RUNNING; i++)
+    {
+        const uint16_t PC = chip8->PC;
+        const uint16_t opcode = execute(chip8, quirks);
+        PROFILE_INSTRUCTION(PC, opcode);
+        if((opcode & 0xF0FF) == 0x00E0 || (opcode & 0xF000) == 0xD000 ||
+           ((quirks & CHIP8_QUIRK_HIRES) && ((opcode & 0xFFE0) == 0x00C0 || (opcode & 0xFFF8) == 0x00F8)))
+        {
+            events |= CHIP8_EVENT_DRAW;
+            if((quirks & CHIP8_QUIRK_DISPLAY_WAIT) && (opcode & 0xF000) == 0xD000) break;
+        } else if((opcode & 0xF0FF) == 0xF00A && chip8->PC == PC) {
+            events |= CHIP8_EVENT_WAIT_KEY;
+            break;
+        } else if((opcode & 0xF000) == 0x1000) {
+            // Once a whole iteration ran since the last time we got here, every further one would
+            // end where it started, skip the whole ones. Before that the registers may still hold
+            // values from before the loop. Profiled and traced builds still run every iteration so
+            // the counters and the trace see them, and only report the idle loop.
+            const uint32_t length = idle_loop_length(chip8, PC);
+            if(length && idle_jump == PC && i - idle_cycle == length)
+            {
+#if !defined(PROFILE) && !defined(DEBUG)
+                i += (cycles - i - 1) / length * length;
+#endif
+                events |= CHIP8_EVENT_IDLE;
+            }
+            idle_jump = PC;
+            idle_cycle = i;
+        }
+    }
+
+    const bool sound_is_on = chip8->sound_timer > 0;
+    if(sound_is_on && !sound_was_on) events |= CHIP8_EVENT_SOUND_ON;
+    if(!sound_is_on && sound_was_on) events |= CHIP8_EVENT_SOUND_OFF;
+
+    return events;
+}
+
+// One specialized interpreter per quirk profile
+#define QUIRK_PROFILE_RUN(name, string, quirks) \
+    static uint32_t run_##name(chip8_t* chip8, uint32_t cycles) { return run(chip8, cycles, (quirks)); }
+CHIP8_QUIRK_PROFILES(QUIRK_PROFILE_RUN)
+#undef QUIRK_PROFILE_RUN
+
+// Run with the modern quirk profile, see run()
+uint32_t chip8_run(chip8_t* chip8, uint32_t cycles)
+{
+    return run_MODERN(chip8, cycles);
+}
+
+// The interpreter for a quirk profile, picked once and then called for every run of the session
+chip8_run_t chip8_runner(const chip8_quirk_profile_t profile)
+{
+    #define QUIRK_PROFILE_POINTER(name, string, quirks) [CHIP8_QUIRKS_##name] = run_##name,
+    static const chip8_run_t runners[CHIP8_QUIRKS_COUNT] = {
+        CHIP8_QUIRK_PROFILES(QUIRK_PROFILE_POINTER)
+    };
+    #undef QUIRK_PROFILE_POINTER
+
+    return runners[profile];
+}
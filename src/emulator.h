@@ -3,4 +3,38 @@
 #include "common.h"
 #include "chip8.h"
 
-void emulate_instruction(chip8_t* chip8, const config_t config);
\ No newline at end of file
+// Events reported back to the frontend by chip8_run()
+typedef enum {
+    CHIP8_EVENT_NONE      = 0,
+    CHIP8_EVENT_DRAW      = 1 << 0, // Display was changed by 00E0 or DXYN
+    CHIP8_EVENT_SOUND_ON  = 1 << 1, // Sound timer went from 0 to non-zero
+    CHIP8_EVENT_SOUND_OFF = 1 << 2, // Sound timer went from non-zero to 0
+    CHIP8_EVENT_WAIT_KEY  = 1 << 3, // FX0A is blocked waiting for a key press
+    CHIP8_EVENT_IDLE      = 1 << 4, // Spun in an idle loop, the iterations left in the run were skipped (not with PROFILE/DEBUG)
+} chip8_event_t;
+
+// chip8_run() specialized for one quirk profile
+typedef uint32_t (*chip8_run_t)(chip8_t* chip8, uint32_t cycles);
+
+// Next byte from a xorshift32 generator state, shared by every engine
+static inline uint8_t chip8_random_next(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x >> 24;
+}
+
+// Next byte from the machine's generator, used by CXNN
+static inline uint8_t chip8_random(chip8_t *chip8)
+{
+    return chip8_random_next(&chip8->rng_state);
+}
+
+void draw_sprite(chip8_t* chip8, const uint8_t X, const uint8_t Y, const uint8_t N);
+uint16_t emulate_instruction(chip8_t* chip8);
+uint32_t chip8_run(chip8_t* chip8, uint32_t cycles);
+chip8_run_t chip8_runner(const chip8_quirk_profile_t profile);
+bool chip8_stalled(const chip8_t* chip8);
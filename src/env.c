@@ -0,0 +1,348 @@
+#include "env.h"
+#include "emulator.h"
+#include "scheduler.h"
+
+#include <unistd.h>
+
+// Thread argument, the machines [first, end) are stepped by this worker
+struct env_worker {
+    env_t *env;
+    uint32_t first, end;
+    pthread_t thread;
+};
+
+// Keys held for an action. Without an action map, action 0 holds nothing and action k holds key k - 1.
+static uint16_t action_keys(const env_config_t *config, const uint32_t action)
+{
+    if(!config->action_keys) return action >= 1 && action <= 16 ? 1 << (action - 1) : 0;
+    return action < config->num_actions ? config->action_keys[action] : 0;
+}
+
+static double watch_value(const chip8_t *chip8, const env_watch_t *watch)
+{
+    uint32_t value = 0;
+    for(uint8_t i = 0; i < watch->size; i++)
+    {
+        const uint8_t byte = chip8->ram[(watch->address + i) & (chip8->ram_size - 1)];
+        value = watch->type == ENV_WATCH_BCD ? value * 10 + byte : value << 8 | byte;
+    }
+    return value;
+}
+
+// Sum of every watch's scaled value, rewards are its change over a step
+static double watch_total(const env_config_t *config, const chip8_t *chip8)
+{
+    double total = 0.0;
+    for(uint32_t i = 0; i < config->num_watches; i++)
+    {
+        total += config->watches[i].scale * watch_value(chip8, &config->watches[i]);
+    }
+    return total;
+}
+
+// Spinning on a 1NNN that jumps to itself, which nothing gets out of: the game is over
+static bool halted(const chip8_t *chip8)
+{
+    const uint16_t mask = chip8->ram_size - 1;
+    const uint16_t opcode = (chip8->ram[chip8->PC & mask] << 8) | chip8->ram[(chip8->PC + 1) & mask];
+    return (opcode & 0xF000) == 0x1000 && (opcode & 0x0FFF) == chip8->PC;
+}
+
+// Row `y` of the 64x32 observation, MSB is the leftmost pixel
+static uint64_t observation_row(const chip8_t *chip8, const uint32_t y)
+{
+    if(!chip8->hires) return chip8_lores_row(chip8->display[0][y] | chip8->display[1][y]);
+
+    // Halve the hires display, a pixel is lit if any of its 2x2 block is
+    const chip8_row_t row = chip8->display[0][2 * y] | chip8->display[1][2 * y] |
+                            chip8->display[0][2 * y + 1] | chip8->display[1][2 * y + 1];
+    uint64_t pixels = 0;
+    for(uint32_t x = 0; x < CHIP8_DISPLAY_WIDTH; x++)
+    {
+        pixels = pixels << 1 | (((row >> (126 - 2 * x)) & 3) != 0);
+    }
+    return pixels;
+}
+
+static void write_observation(const env_t *env, const uint32_t index, uint8_t *observations)
+{
+    const chip8_t *chip8 = env_machine(env, index);
+    uint8_t *out = &observations[index * env_observation_size(env->config.obs_format)];
+
+    for(uint32_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        const uint64_t row = observation_row(chip8, y);
+        if(env->config.obs_format == ENV_OBS_PACKED)
+        {
+            for(uint32_t b = 0; b < 8; b++)
+            {
+                *out++ = row >> (56 - 8 * b);
+            }
+        } else {
+            for(uint32_t x = 0; x < CHIP8_DISPLAY_WIDTH; x++)
+            {
+                *out++ = (row >> (63 - x)) & 1;
+            }
+        }
+    }
+}
+
+static void reset_machine(env_t *env, const uint32_t index, const uint32_t seed)
+{
+    chip8_t *chip8 = env_machine(env, index);
+    chip8_copy(chip8, env->boot);
+    chip8_seed(chip8, seed);
+    env->seeds[index] = seed;
+    env->episode_frames[index] = 0;
+}
+
+// Instructions run in frame `frame` of an episode, instructions_per_second split evenly over the
+// 60Hz frames like the scheduler does, so an episode runs the same whatever the step size
+static uint32_t frame_cycles(const uint32_t instructions_per_second, const uint32_t frame)
+{
+    const uint64_t ips = instructions_per_second;
+    return ips * (frame + 1) / SCHEDULER_TICK_RATE - ips * frame / SCHEDULER_TICK_RATE;
+}
+
+// Hold the action for frames_per_step frames, returns the reward. Sets `done` when the game halted
+// or the episode ran out of frames.
+static float step_machine(env_t *env, const uint32_t index, const uint32_t action, bool *done)
+{
+    const env_config_t *config = &env->config;
+    const chip8_run_t run = chip8_runner(config->quirk_profile);
+    chip8_t *chip8 = env_machine(env, index);
+    uint32_t *frame = &env->episode_frames[index];
+
+    chip8->keypad = action_keys(config, action);
+    const double before = watch_total(config, chip8);
+    bool stalled = false;
+    *done = false;
+
+    for(uint32_t f = 0; f < config->frames_per_step && !*done; f++)
+    {
+        // Only the timers change until the keys do, and they are held for the whole step
+        if(!stalled)
+        {
+            const uint32_t events = run(chip8, frame_cycles(config->instructions_per_second, *frame));
+            stalled = (events & (CHIP8_EVENT_WAIT_KEY | CHIP8_EVENT_IDLE)) && chip8_stalled(chip8);
+        }
+        update_timers(chip8);
+        (*frame)++;
+
+        *done = (stalled && halted(chip8)) || (config->max_episode_frames && *frame >= config->max_episode_frames);
+    }
+
+    return watch_total(config, chip8) - before;
+}
+
+static void run_slice(env_t *env, const struct env_worker *worker, const env_work_t *work)
+{
+    for(uint32_t i = worker->first; i < worker->end; i++)
+    {
+        if(work->reset)
+        {
+            reset_machine(env, i, work->seeds ? work->seeds[i] : i);
+        } else {
+            bool done;
+            work->rewards[i] = step_machine(env, i, work->actions[i], &done);
+            work->dones[i] = done;
+            if(done) reset_machine(env, i, env->seeds[i] + env->config.num_envs);
+        }
+        write_observation(env, i, work->observations);
+    }
+}
+
+static void *worker_thread(void *data)
+{
+    const struct env_worker *worker = data;
+    env_t *env = worker->env;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&env->lock);
+    while(true)
+    {
+        while(!env->quit && env->generation == seen)
+        {
+            pthread_cond_wait(&env->start, &env->lock);
+        }
+        if(env->quit) break;
+
+        seen = env->generation;
+        const env_work_t work = env->work;
+        pthread_mutex_unlock(&env->lock);
+
+        run_slice(env, worker, &work);
+
+        pthread_mutex_lock(&env->lock);
+        if(--env->pending == 0) pthread_cond_signal(&env->done);
+    }
+    pthread_mutex_unlock(&env->lock);
+    return NULL;
+}
+
+// Hand the work to every worker, run the first slice on this thread and wait for the rest
+static void dispatch(env_t *env, const env_work_t *work)
+{
+    pthread_mutex_lock(&env->lock);
+    env->work = *work;
+    env->pending = env->num_workers - 1;
+    env->generation++;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+
+    run_slice(env, &env->workers[0], work);
+
+    pthread_mutex_lock(&env->lock);
+    while(env->pending > 0)
+    {
+        pthread_cond_wait(&env->done, &env->lock);
+    }
+    pthread_mutex_unlock(&env->lock);
+}
+
+void env_default_config(env_config_t *config)
+{
+    *config = (env_config_t) {
+        .quirk_profile = CHIP8_QUIRKS_MODERN,
+        .num_envs = 1,
+        .frames_per_step = 4,
+        .instructions_per_second = 500,
+        .obs_format = ENV_OBS_PACKED,
+    };
+}
+
+// Bytes of one machine's observation
+size_t env_observation_size(const env_obs_format_t format)
+{
+    return format == ENV_OBS_PACKED ? CHIP8_DISPLAY_WIDTH / 8 * CHIP8_DISPLAY_HEIGHT
+                                    : CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT;
+}
+
+static bool valid_config(const env_config_t *config)
+{
+    if(config->num_envs == 0 || config->frames_per_step == 0 || config->quirk_profile >= CHIP8_QUIRKS_COUNT ||
+       config->obs_format > ENV_OBS_BYTES || config->num_watches > ENV_MAX_WATCHES)
+    {
+        fprintf(stderr, "Invalid environment configuration\n");
+        return false;
+    }
+    for(uint32_t i = 0; i < config->num_watches; i++)
+    {
+        const env_watch_t *watch = &config->watches[i];
+        if(watch->size < 1 || watch->size > 4 || watch->address + watch->size > chip8_ram_size(config->quirk_profile))
+        {
+            fprintf(stderr, "Invalid RAM watch of %u bytes at 0x%03X\n", watch->size, watch->address);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Load the ROM and allocate num_envs machines and the threads that step them. The machines are
+// ready to step, env_reset() reseeds them and gives the first observations.
+bool env_init(env_t *env, const env_config_t *config, const char rom_path[])
+{
+    memset(env, 0, sizeof *env);
+    if(!valid_config(config)) return false;
+    env->config = *config;
+
+    const uint32_t ram_size = chip8_ram_size(config->quirk_profile);
+    env->boot = chip8_create(ram_size);
+    if(!env->boot || !init_chip8(env->boot, rom_path))
+    {
+        env_free(env);
+        return false;
+    }
+
+    long num_workers = config->num_threads ? (long) config->num_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_workers < 1) num_workers = 1;
+    if(num_workers > config->num_envs) num_workers = config->num_envs;
+
+    env->machine_size = CHIP8_MACHINE_SIZE(ram_size);
+    env->machines = aligned_alloc(_Alignof(chip8_t), config->num_envs * env->machine_size);
+    env->seeds = malloc(config->num_envs * sizeof *env->seeds);
+    env->episode_frames = malloc(config->num_envs * sizeof *env->episode_frames);
+    env->workers = calloc(num_workers, sizeof *env->workers);
+    if(!env->machines || !env->seeds || !env->episode_frames || !env->workers)
+    {
+        fprintf(stderr, "Could not allocate %u environments\n", config->num_envs);
+        env_free(env);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < config->num_envs; i++)
+    {
+        reset_machine(env, i, i);
+    }
+
+    // Contiguous slices, so each thread's machines and observations share no cache lines with another's
+    pthread_mutex_init(&env->lock, NULL);
+    pthread_cond_init(&env->start, NULL);
+    pthread_cond_init(&env->done, NULL);
+    env->num_workers = 1;
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        env->workers[w] = (struct env_worker) {
+            .env = env,
+            .first = (uint64_t) config->num_envs * w / num_workers,
+            .end = (uint64_t) config->num_envs * (w + 1) / num_workers,
+        };
+    }
+    for(uint32_t w = 1; w < num_workers; w++, env->num_workers++)
+    {
+        if(pthread_create(&env->workers[w].thread, NULL, worker_thread, &env->workers[w]) != 0)
+        {
+            fprintf(stderr, "Could not create environment thread\n");
+            env_free(env);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void env_free(env_t *env)
+{
+    // num_workers counts the caller's thread plus those started, 0 before the lock exists
+    if(env->num_workers)
+    {
+        pthread_mutex_lock(&env->lock);
+        env->quit = true;
+        pthread_cond_broadcast(&env->start);
+        pthread_mutex_unlock(&env->lock);
+        for(uint32_t w = 1; w < env->num_workers; w++)
+        {
+            pthread_join(env->workers[w].thread, NULL);
+        }
+        pthread_mutex_destroy(&env->lock);
+        pthread_cond_destroy(&env->start);
+        pthread_cond_destroy(&env->done);
+    }
+
+    chip8_destroy(env->boot);
+    free(env->machines);
+    free(env->seeds);
+    free(env->episode_frames);
+    free(env->workers);
+    memset(env, 0, sizeof *env);
+}
+
+// Machine `index`, e.g. to read more of its state than the observation holds
+chip8_t *env_machine(const env_t *env, const uint32_t index)
+{
+    return (chip8_t *) &env->machines[index * env->machine_size];
+}
+
+// Start a new episode on every machine, machine i seeded with seeds[i] (i if `seeds` is NULL).
+// Writes num_envs observations.
+void env_reset(env_t *env, const uint32_t seeds[], void *observations)
+{
+    dispatch(env, &(env_work_t) {.reset = true, .seeds = seeds, .observations = observations});
+}
+
+// Step every machine with its action from `actions`. Writes num_envs observations, rewards and
+// dones. A machine that is done was reset with its last seed plus num_envs.
+void env_step(env_t *env, const uint32_t actions[], void *observations, float rewards[], bool dones[])
+{
+    dispatch(env, &(env_work_t) {.actions = actions, .observations = observations, .rewards = rewards, .dones = dones});
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+#include <pthread.h>
+
+// Vectorized reinforcement learning environment: N machines running the same ROM, stepped
+// together by env_step() on a pool of threads. Each step holds one action per machine for
+// frames_per_step 60Hz frames and writes every machine's observation straight into one
+// caller-provided buffer, with no allocation or copying per step. Rewards come from RAM watches.
+// Machines whose episode ended (or was cut short) are reset as part of the step, their
+// observation is then the first of the new episode.
+//
+// Built as the shared library libchip8env.so, e.g. for ctypes (no SDL needed):
+//     cmake -S . -B build && cmake --build build --target chip8env
+//
+// Observations are 64x32 whatever the display mode, a hires display is halved by ORing 2x2
+// pixel blocks. XO-CHIP planes are ORed together.
+
+#define ENV_MAX_WATCHES 8
+
+// Observation layout per machine, env_observation_size() bytes each, machine i at i * size
+typedef enum {
+    ENV_OBS_PACKED,   // 32 rows of 8 bytes, MSB of the first byte is the leftmost pixel, as in a PBM
+    ENV_OBS_BYTES,    // 32 rows of 64 bytes, 1 for a lit pixel and 0 otherwise
+} env_obs_format_t;
+
+typedef enum {
+    ENV_WATCH_UINT,   // Big-endian unsigned integer of `size` bytes
+    ENV_WATCH_BCD,    // `size` decimal digits, one per byte, most significant first, as FX33 stores them
+} env_watch_type_t;
+
+// RAM watch: each step adds scale * (value after - value before) to the reward
+typedef struct {
+    uint16_t address;
+    uint8_t size;             // Bytes, 1 to 4
+    env_watch_type_t type;
+    float scale;
+} env_watch_t;
+
+// Environment Configuration Object
+typedef struct {
+    chip8_quirk_profile_t quirk_profile;
+    uint32_t num_envs;
+    uint32_t num_threads;             // Threads stepping the machines, 0 for one per host core
+    uint32_t frames_per_step;         // 60Hz frames run per env_step(), the action is held throughout
+    uint32_t instructions_per_second;
+    uint32_t max_episode_frames;      // Frames after which an episode is cut short, 0 for no limit
+    env_obs_format_t obs_format;
+    const uint16_t *action_keys;      // Keypad mask held for each action, bit per key 0x0 - 0xF
+    uint32_t num_actions;
+    env_watch_t watches[ENV_MAX_WATCHES];
+    uint32_t num_watches;
+} env_config_t;
+
+// Work handed to the threads by env_reset() and env_step()
+typedef struct {
+    bool reset;                 // Reset every machine instead of stepping them
+    const uint32_t *seeds;
+    const uint32_t *actions;
+    uint8_t *observations;
+    float *rewards;
+    bool *dones;
+} env_work_t;
+
+// Environment Object. Machines live back to back in one cache line aligned block.
+typedef struct {
+    env_config_t config;
+    chip8_t *boot;              // The ROM freshly loaded, copied into a machine to reset it
+    uint8_t *machines;          // num_envs machines of machine_size bytes, see env_machine()
+    size_t machine_size;
+    uint32_t *seeds;            // Seed of each machine's current episode
+    uint32_t *episode_frames;   // Frames each machine's current episode has run
+
+    struct env_worker *workers; // One per thread, workers[0] runs on the caller's, see env.c
+    uint32_t num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;        // Bumped for every env_reset() / env_step()
+    uint32_t pending;           // Workers still busy with the current generation
+    bool quit;
+    env_work_t work;
+} env_t;
+
+void env_default_config(env_config_t *config);
+size_t env_observation_size(const env_obs_format_t format);
+bool env_init(env_t *env, const env_config_t *config, const char rom_path[]);
+void env_free(env_t *env);
+chip8_t *env_machine(const env_t *env, const uint32_t index);
+void env_reset(env_t *env, const uint32_t seeds[], void *observations);
+void env_step(env_t *env, const uint32_t actions[], void *observations, float rewards[], bool dones[]);
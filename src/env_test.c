@@ -0,0 +1,164 @@
+// Threaded environment check.
+//
+// Steps the same environments on one thread and on several, with the same seeds and actions, and
+// exits non-zero at the first step where their observations, rewards or dones differ. The test ROM
+// draws at random positions, scores while key 5 is held and halts at random, so the run covers
+// CXNN seeding, RAM watch rewards and the resets of machines whose episode ended.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_env_test
+// Usage:
+//     chip8_env_test [--threads <n>] [--steps <n>]
+
+#include "common.h"
+#include "env.h"
+
+#include <unistd.h>
+
+#define ENV_TEST_ENVS 64
+
+static const uint8_t test_rom[] = {
+    0x6A, 0x00,  // 200: VA = 0, the score
+    0xC0, 0x3F,  // 202: V0 = random x
+    0xC1, 0x1F,  // 204: V1 = random y
+    0xA2, 0x22,  // 206: I = sprite
+    0xD0, 0x15,  // 208: draw
+    0x62, 0x05,  // 20A: V2 = 5
+    0xE2, 0xA1,  // 20C: skip unless key 5 is held
+    0x12, 0x14,  // 20E:   jump 214
+    0x7A, 0x01,  // 210: VA += 1
+    0x00, 0xE0,  // 212: clear
+    0xA3, 0x00,  // 214: I = 300
+    0xFA, 0x33,  // 216: 300-302 = VA in BCD, the watched score
+    0xC3, 0xFF,  // 218: V3 = random
+    0x33, 0x00,  // 21A: skip if V3 == 0
+    0x12, 0x02,  // 21C:   jump 202
+    0x12, 0x1E,  // 21E: halt
+    0x00, 0x00,  // 220: padding
+    0xF0, 0x90, 0xF0, 0x90, 0xF0,  // 222: sprite
+};
+
+static const uint16_t test_keys[] = {0, 1 << 5};
+
+static bool write_rom(char path[])
+{
+    const int fd = mkstemp(path);
+    if(fd < 0) return false;
+    const bool ok = write(fd, test_rom, sizeof test_rom) == sizeof test_rom;
+    close(fd);
+    return ok;
+}
+
+static bool init_env(env_t *env, const uint32_t num_threads, const char rom_path[])
+{
+    env_config_t config;
+    env_default_config(&config);
+    config.num_envs = ENV_TEST_ENVS;
+    config.num_threads = num_threads;
+    config.instructions_per_second = 6000;
+    config.max_episode_frames = 600;
+    config.action_keys = test_keys;
+    config.num_actions = sizeof test_keys / sizeof test_keys[0];
+    config.watches[0] = (env_watch_t) {.address = 0x300, .size = 3, .type = ENV_WATCH_BCD, .scale = 1.0f};
+    config.num_watches = 1;
+    return env_init(env, &config, rom_path);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t threads = 4;
+    uint32_t steps = 2000;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--threads") && i + 1 < argc) threads = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "--steps") && i + 1 < argc) steps = strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--threads <n>] [--steps <n>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(threads < 2)
+    {
+        fprintf(stderr, "--threads must be at least 2\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char rom_path[] = "/tmp/chip8_env_test_XXXXXX";
+    if(!write_rom(rom_path))
+    {
+        fprintf(stderr, "Could not write the test ROM\n");
+        exit(EXIT_FAILURE);
+    }
+
+    env_t single, threaded;
+    const bool ok = init_env(&single, 1, rom_path) && init_env(&threaded, threads, rom_path);
+    unlink(rom_path);
+    if(!ok)
+    {
+        env_free(&single);
+        exit(EXIT_FAILURE);
+    }
+
+    const size_t obs_size = ENV_TEST_ENVS * env_observation_size(ENV_OBS_PACKED);
+    uint8_t *observations[2] = {malloc(obs_size), malloc(obs_size)};
+    uint32_t seeds[ENV_TEST_ENVS];
+    uint32_t actions[ENV_TEST_ENVS];
+    float rewards[2][ENV_TEST_ENVS];
+    bool dones[2][ENV_TEST_ENVS];
+    for(uint32_t i = 0; i < ENV_TEST_ENVS; i++)
+    {
+        seeds[i] = 1000 + i;
+    }
+
+    env_reset(&single, seeds, observations[0]);
+    env_reset(&threaded, seeds, observations[1]);
+    bool passed = !memcmp(observations[0], observations[1], obs_size);
+    if(!passed) printf("Observations differ after the reset\n");
+
+    uint64_t episodes = 0;
+    double reward = 0;
+    uint32_t rng = 1;
+    for(uint32_t step = 0; step < steps && passed; step++)
+    {
+        for(uint32_t i = 0; i < ENV_TEST_ENVS; i++)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            actions[i] = rng & 1;
+        }
+
+        env_step(&single, actions, observations[0], rewards[0], dones[0]);
+        env_step(&threaded, actions, observations[1], rewards[1], dones[1]);
+
+        passed = !memcmp(observations[0], observations[1], obs_size) &&
+                 !memcmp(rewards[0], rewards[1], sizeof rewards[0]) &&
+                 !memcmp(dones[0], dones[1], sizeof dones[0]);
+        if(!passed) printf("Step %u differs between 1 and %u threads\n", step, threads);
+
+        for(uint32_t i = 0; i < ENV_TEST_ENVS; i++)
+        {
+            episodes += dones[0][i];
+            reward += rewards[0][i];
+        }
+    }
+
+    // A run that never ended an episode or scored would not have checked much
+    if(passed && (episodes == 0 || reward == 0))
+    {
+        printf("The test ROM ended %llu episodes and scored %.0f, expected both\n", (unsigned long long) episodes, reward);
+        passed = false;
+    }
+    if(passed)
+    {
+        printf("%u steps of %u environments match on 1 and %u threads, %llu episodes ended\n",
+               steps, ENV_TEST_ENVS, threads, (unsigned long long) episodes);
+    }
+
+    free(observations[0]);
+    free(observations[1]);
+    env_free(&single);
+    env_free(&threaded);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
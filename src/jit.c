@@ -0,0 +1,660 @@
+#define _GNU_SOURCE // memfd_create()
+
+#include "jit.h"
+#include "emulator.h"
+#include "decode.h"
+#include "ops.h"
+
+#include <stddef.h>
+
+#if JIT_AVAILABLE
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+// Bit-exact comparison of two machines, RAM included
+static bool same_state(const chip8_t *a, const chip8_t *b)
+{
+    return a->ram_size == b->ram_size && memcmp(a, b, CHIP8_MACHINE_SIZE(a->ram_size)) == 0;
+}
+
+// Make sure the self check reference machine matches the running machine's RAM size
+static bool reserve_reference(jit_t *jit, const chip8_t *chip8)
+{
+    if(jit->reference && jit->reference->ram_size == chip8->ram_size) return true;
+
+    chip8_destroy(jit->reference);
+    jit->reference = chip8_create(chip8->ram_size);
+    return jit->reference != NULL;
+}
+
+// Whether the instruction at `address` was rewritten too often to be worth compiling again
+static bool is_hot(const jit_t *jit, const uint16_t address)
+{
+    return jit->rewrites[address] >= JIT_REWRITE_LIMIT || jit->rewrites[(address + 1) & 0xFFF] >= JIT_REWRITE_LIMIT;
+}
+
+// Drop every compiled block and interpret marker overlapping the `length` bytes written at `address`.
+// Writes land at address & 0xFFF like every other RAM access, and one running past 0xFFF wraps around to 0.
+// Bits are never cleared from the bitmap since blocks may overlap, a stale bit only costs a scan.
+void jit_invalidate(jit_t *jit, const uint16_t address, const uint16_t length)
+{
+    const uint16_t start = address & 0xFFF;
+    const uint32_t end = (uint32_t) start + length;
+    if(length < 64 && !decode_bitmap_any(jit->code_bitmap, start, length)) return; // Plain data write, no compiled code there
+
+    // Count the rewrites of code bytes, code rewritten over and over is interpreted rather than recompiled
+    for(uint16_t i = 0; i < length; i++)
+    {
+        const uint16_t byte = (start + i) & 0xFFF;
+        if(decode_bitmap_any(jit->code_bitmap, byte, 1) && jit->rewrites[byte] < JIT_REWRITE_LIMIT) jit->rewrites[byte]++;
+    }
+
+    // An opcode at A reads A and A+1, so a marker just before the range is stale as well.
+    // Markers on hot code stay, it is interpreted whatever it is rewritten to.
+    for(uint16_t i = 0; i <= length; i++)
+    {
+        const uint16_t marker = (address - 1 + i) & 0xFFF;
+        if(jit->lookup[marker] == JIT_INTERPRET && !is_hot(jit, marker)) jit->lookup[marker] = 0;
+    }
+
+    // A block covers at most 2 * longest bytes from its start, so only the block starts just
+    // before and inside the write are looked at
+    const uint16_t first = (start - 2 * jit->longest + 1) & 0xFFF;
+    const uint32_t window = 2 * jit->longest - 1 + length < 0x1000 ? 2 * jit->longest - 1 + length : 0x1000;
+    for(uint32_t offset = 0; offset < window; offset += 64)
+    {
+        const uint8_t count = window - offset < 64 ? window - offset : 64;
+        uint64_t starts = decode_bitmap_bits(jit->start_bitmap, first + offset, count);
+        for(; starts; starts &= starts - 1)
+        {
+            const uint16_t block_start = (first + offset + __builtin_ctzll(starts)) & 0xFFF;
+            jit_block_t *block = &jit->blocks[jit->lookup[block_start] - 1];
+            if(decode_ranges_overlap(block->start, block->start + 2u * block->length, start, end))
+            {
+                block->valid = false;
+                jit->lookup[block_start] = 0;
+                jit->start_bitmap[block_start >> 6] &= ~(1ull << (block_start & 63));
+            }
+        }
+    }
+}
+
+#if JIT_AVAILABLE
+
+// Host register assignment inside a compiled block:
+//   rdi      chip8_t* (first argument)
+//   eax/ecx/edx  scratch
+//   esi      guest I
+//   r8b-r11b up to 4 of the block's most used guest V registers
+#define SCRATCH_EAX 0
+#define SCRATCH_ECX 1
+#define SCRATCH_EDX 2
+#define PINNED_FIRST 8
+#define PINNED_COUNT 4
+
+#define OFFSET_V(x)   ((int32_t) (offsetof(chip8_t, V) + (x)))
+#define OFFSET_I      ((int32_t) offsetof(chip8_t, I))
+#define OFFSET_PC     ((int32_t) offsetof(chip8_t, PC))
+#define OFFSET_SP     ((int32_t) offsetof(chip8_t, SP))
+#define OFFSET_STACK  ((int32_t) offsetof(chip8_t, stack))
+#define OFFSET_DELAY  ((int32_t) offsetof(chip8_t, delay_timer))
+#define OFFSET_SOUND  ((int32_t) offsetof(chip8_t, sound_timer))
+#define OFFSET_KEYPAD ((int32_t) offsetof(chip8_t, keypad))
+#define OFFSET_RAM    ((int32_t) offsetof(chip8_t, ram))
+
+// Code emitter state for one block
+typedef struct {
+    uint8_t *p;             // Next byte to write
+    int8_t host[16];        // Host register pinned to each guest V register, -1 if it lives in memory
+} emitter_t;
+
+static void emit8(emitter_t *e, const uint8_t byte) { *e->p++ = byte; }
+static void emit16(emitter_t *e, const uint16_t value) { memcpy(e->p, &value, 2); e->p += 2; }
+static void emit32(emitter_t *e, const uint32_t value) { memcpy(e->p, &value, 4); e->p += 4; }
+
+// ModRM for [rdi + disp32] with `reg` in the reg field
+static void emit_rdi_disp(emitter_t *e, const uint8_t reg, const int32_t disp)
+{
+    emit8(e, 0x80 | ((reg & 7) << 3) | 7);
+    emit32(e, disp);
+}
+
+// movzx scratch32, V[x]
+static void load_v(emitter_t *e, const uint8_t scratch, const uint8_t x)
+{
+    if(e->host[x] >= 0)
+    {
+        emit8(e, 0x41); emit8(e, 0x0F); emit8(e, 0xB6);
+        emit8(e, 0xC0 | (scratch << 3) | (e->host[x] - 8));
+    } else {
+        emit8(e, 0x0F); emit8(e, 0xB6);
+        emit_rdi_disp(e, scratch, OFFSET_V(x));
+    }
+}
+
+// mov V[x], scratch8
+static void store_v(emitter_t *e, const uint8_t scratch, const uint8_t x)
+{
+    if(e->host[x] >= 0)
+    {
+        emit8(e, 0x41); emit8(e, 0x88);
+        emit8(e, 0xC0 | (scratch << 3) | (e->host[x] - 8));
+    } else {
+        emit8(e, 0x88);
+        emit_rdi_disp(e, scratch, OFFSET_V(x));
+    }
+}
+
+// mov word [rdi + PC], imm16
+static void store_pc_imm(emitter_t *e, const uint16_t PC)
+{
+    emit8(e, 0x66); emit8(e, 0xC7);
+    emit_rdi_disp(e, 0, OFFSET_PC);
+    emit16(e, PC);
+}
+
+// Skip epilogue: PC = condition ? next + 2 : next, flags already set by a compare
+// `cmov` is the second opcode byte of the cmovcc that selects the skip (0x42 cmovb, 0x43 cmovae,
+// 0x44 cmove, 0x45 cmovne)
+static void emit_skip(emitter_t *e, const uint8_t cmov, const uint16_t next)
+{
+    emit8(e, 0xB9); emit32(e, next);                        // mov ecx, next
+    emit8(e, 0xBA); emit32(e, next + 2);                    // mov edx, next + 2
+    emit8(e, 0x0F); emit8(e, cmov); emit8(e, 0xCA);         // cmovcc ecx, edx
+    emit8(e, 0x66); emit8(e, 0x89); emit_rdi_disp(e, SCRATCH_ECX, OFFSET_PC); // mov [PC], cx
+}
+
+// Load the pinned V registers and I from the machine
+static void load_pinned(emitter_t *e)
+{
+    for(uint8_t x = 0; x < 16; x++)
+    {
+        if(e->host[x] < 0) continue;
+        emit8(e, 0x44); emit8(e, 0x0F); emit8(e, 0xB6);                              // movzx r8d-r11d, V[x]
+        emit_rdi_disp(e, e->host[x] - 8, OFFSET_V(x));
+    }
+    emit8(e, 0x0F); emit8(e, 0xB7); emit_rdi_disp(e, 6, OFFSET_I);                   // movzx esi, word [I]
+}
+
+// Write the pinned V registers and I back to the machine
+static void store_pinned(emitter_t *e)
+{
+    for(uint8_t x = 0; x < 16; x++)
+    {
+        if(e->host[x] < 0) continue;
+        emit8(e, 0x44); emit8(e, 0x88);                                               // mov V[x], r8b-r11b
+        emit_rdi_disp(e, e->host[x] - 8, OFFSET_V(x));
+    }
+    emit8(e, 0x66); emit8(e, 0x89); emit_rdi_disp(e, 6, OFFSET_I);                    // mov [I], si
+}
+
+// Instructions compiled as a call into the shared micro-op handlers of ops.h rather than inline code.
+// The micro-op travels by value in rsi, see emit_call().
+#define JIT_CALL_HANDLERS(X) X(00E0) X(DXYN) X(CXNN) X(FX33) X(FX55)
+
+#define JIT_CALL(name) static void call_##name(chip8_t *chip8, const decoded_t d) { op_##name(chip8, &d); }
+JIT_CALL_HANDLERS(JIT_CALL)
+#undef JIT_CALL
+
+// Call `handler`(chip8, *d) with the guest registers flushed to the machine around it
+static void emit_call(emitter_t *e, void (*handler)(chip8_t *, decoded_t), const decoded_t *d)
+{
+    uint64_t operand;
+    memcpy(&operand, d, sizeof operand);
+
+    store_pinned(e);
+    emit8(e, 0x57);                                                                   // push rdi, also aligns the stack
+    emit8(e, 0x48); emit8(e, 0xBE); memcpy(e->p, &operand, 8); e->p += 8;             // mov rsi, d
+    emit8(e, 0x48); emit8(e, 0xB8);                                                   // mov rax, handler
+    const uint64_t target = (uint64_t) (uintptr_t) handler;
+    memcpy(e->p, &target, 8); e->p += 8;
+    emit8(e, 0xFF); emit8(e, 0xD0);                                                   // call rax
+    emit8(e, 0x5F);                                                                   // pop rdi
+    load_pinned(e);
+}
+
+// Can this decoded instruction be compiled? Only FX0A, which may rewind the PC, can't
+static bool is_compilable(const uint8_t handler)
+{
+    return handler != OP_DECODE && handler != OP_FX0A;
+}
+
+// Does it end a block? RAM writes do, so jit_run() can invalidate what they hit before going on
+static bool is_terminator(const uint8_t handler)
+{
+    switch(handler)
+    {
+        #define JIT_JUMP_CASE(name) case OP_##name:
+        DECODE_JUMP_HANDLERS(JIT_JUMP_CASE)
+        #undef JIT_JUMP_CASE
+        case OP_FX33: case OP_FX55:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Emit native code for one instruction at `address`
+static void emit_instruction(emitter_t *e, const decoded_t *d, const uint16_t address)
+{
+    const uint16_t next = address + 2;
+
+    switch(d->handler)
+    {
+        case OP_NOP:
+            break;
+        case OP_00EE:
+            emit8(e, 0xFE); emit_rdi_disp(e, 1, OFFSET_SP);                            // dec byte [SP]
+            emit8(e, 0x0F); emit8(e, 0xB6); emit_rdi_disp(e, SCRATCH_EAX, OFFSET_SP);  // movzx eax, byte [SP]
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F);                           // and eax, 15
+            emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x8C); emit8(e, 0x47);           // movzx ecx, word [rdi + rax * 2 + stack]
+            emit32(e, OFFSET_STACK);
+            emit8(e, 0x66); emit8(e, 0x89); emit_rdi_disp(e, SCRATCH_ECX, OFFSET_PC);  // mov [PC], cx
+            break;
+        case OP_1NNN:
+            store_pc_imm(e, d->NNN);
+            break;
+        case OP_2NNN:
+            emit8(e, 0x0F); emit8(e, 0xB6); emit_rdi_disp(e, SCRATCH_EAX, OFFSET_SP);  // movzx eax, byte [SP]
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F);                           // and eax, 15
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47);           // mov word [rdi + rax * 2 + stack], next
+            emit32(e, OFFSET_STACK); emit16(e, next);
+            emit8(e, 0xFE); emit_rdi_disp(e, 0, OFFSET_SP);                            // inc byte [SP]
+            store_pc_imm(e, d->NNN);
+            break;
+        case OP_3XNN:
+        case OP_4XNN:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x3D); emit32(e, d->NN);                                         // cmp eax, NN
+            emit_skip(e, d->handler == OP_3XNN ? 0x44 : 0x45, next);
+            break;
+        case OP_5XY0:
+        case OP_9XY0:
+            load_v(e, SCRATCH_EAX, d->X);
+            load_v(e, SCRATCH_ECX, d->Y);
+            emit8(e, 0x39); emit8(e, 0xC8);                                           // cmp eax, ecx
+            emit_skip(e, d->handler == OP_5XY0 ? 0x44 : 0x45, next);
+            break;
+        case OP_6XNN:
+            emit8(e, 0xB8); emit32(e, d->NN);                                         // mov eax, NN
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_7XNN:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x05); emit32(e, d->NN);                                         // add eax, NN
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_8XY0:
+            load_v(e, SCRATCH_EAX, d->Y);
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_8XY1:
+        case OP_8XY2:
+        case OP_8XY3:
+            load_v(e, SCRATCH_EAX, d->X);
+            load_v(e, SCRATCH_ECX, d->Y);
+            emit8(e, d->handler == OP_8XY1 ? 0x09 : d->handler == OP_8XY2 ? 0x21 : 0x31); // or/and/xor eax, ecx
+            emit8(e, 0xC8);
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_8XY4:
+            load_v(e, SCRATCH_EAX, d->X);
+            load_v(e, SCRATCH_ECX, d->Y);
+            emit8(e, 0x01); emit8(e, 0xC8);                                           // add eax, ecx
+            store_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 0x08);                           // shr eax, 8 (carry)
+            store_v(e, SCRATCH_EAX, 0xF);
+            break;
+        case OP_8XY5:
+        case OP_8XY7:
+            // 8XY5: VX = VX - VY, 8XY7: VX = VY - VX. VF = 1 when there is no underflow
+            load_v(e, SCRATCH_EAX, d->handler == OP_8XY5 ? d->X : d->Y);
+            load_v(e, SCRATCH_ECX, d->handler == OP_8XY5 ? d->Y : d->X);
+            emit8(e, 0x39); emit8(e, 0xC8);                                           // cmp eax, ecx
+            emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC2);                           // setae dl
+            emit8(e, 0x29); emit8(e, 0xC8);                                           // sub eax, ecx
+            store_v(e, SCRATCH_EAX, d->X);
+            store_v(e, SCRATCH_EDX, 0xF);
+            break;
+        case OP_8XY6:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x89); emit8(e, 0xC2);                                           // mov edx, eax
+            emit8(e, 0x83); emit8(e, 0xE2); emit8(e, 0x01);                           // and edx, 1
+            emit8(e, 0xD1); emit8(e, 0xE8);                                           // shr eax, 1
+            store_v(e, SCRATCH_EAX, d->X);
+            store_v(e, SCRATCH_EDX, 0xF);
+            break;
+        case OP_8XYE:
+            // VF is written before the shift, so re-read VX in case X is F
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 0x07);                           // shr eax, 7
+            store_v(e, SCRATCH_EAX, 0xF);
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0xD1); emit8(e, 0xE0);                                           // shl eax, 1
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_ANNN:
+            emit8(e, 0xBE); emit32(e, d->NNN);                                        // mov esi, NNN
+            break;
+        case OP_BNNN:
+            load_v(e, SCRATCH_EAX, 0);
+            emit8(e, 0x05); emit32(e, d->NNN);                                        // add eax, NNN
+            emit8(e, 0x66); emit8(e, 0x89); emit_rdi_disp(e, SCRATCH_EAX, OFFSET_PC);  // mov [PC], ax
+            break;
+        case OP_EX9E:
+        case OP_EXA1:
+            // Keys past 0xF are clamped to bit 16, which the zero extended keypad never has set
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0xBA); emit32(e, 16);                                            // mov edx, 16
+            emit8(e, 0x39); emit8(e, 0xD0);                                           // cmp eax, edx
+            emit8(e, 0x0F); emit8(e, 0x43); emit8(e, 0xC2);                           // cmovae eax, edx
+            emit8(e, 0x0F); emit8(e, 0xB7); emit_rdi_disp(e, SCRATCH_ECX, OFFSET_KEYPAD); // movzx ecx, word [keypad]
+            emit8(e, 0x0F); emit8(e, 0xA3); emit8(e, 0xC1);                           // bt ecx, eax
+            emit_skip(e, d->handler == OP_EX9E ? 0x42 : 0x43, next);
+            break;
+        case OP_FX07:
+            emit8(e, 0x0F); emit8(e, 0xB6); emit_rdi_disp(e, SCRATCH_EAX, OFFSET_DELAY); // movzx eax, [delay_timer]
+            store_v(e, SCRATCH_EAX, d->X);
+            break;
+        case OP_FX15:
+        case OP_FX18:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x88); emit_rdi_disp(e, SCRATCH_EAX, d->handler == OP_FX15 ? OFFSET_DELAY : OFFSET_SOUND);
+            break;
+        case OP_FX1E:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x01); emit8(e, 0xC6);                                           // add esi, eax
+            break;
+        case OP_FX29:
+            load_v(e, SCRATCH_EAX, d->X);
+            emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80);                           // lea eax, [rax + rax * 4]
+            emit8(e, 0x89); emit8(e, 0xC6);                                           // mov esi, eax
+            break;
+        case OP_FX65:
+            for(uint8_t i = 0; i <= d->X; i++)
+            {
+                emit8(e, 0x8D); emit8(e, 0x46); emit8(e, i);                          // lea eax, [rsi + i]
+                emit8(e, 0x25); emit32(e, 0xFFF);                                     // and eax, 0xFFF
+                emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x84); emit8(e, 0x07);       // movzx eax, byte [rdi + rax + ram]
+                emit32(e, OFFSET_RAM);
+                store_v(e, SCRATCH_EAX, i);
+            }
+            break;
+        #define JIT_CALL_CASE(name) case OP_##name: emit_call(e, call_##name, d); break;
+        JIT_CALL_HANDLERS(JIT_CALL_CASE)
+        #undef JIT_CALL_CASE
+        default:
+            break;
+    }
+}
+
+// Change the protection of the pages holding code buffer bytes [offset, offset + length),
+// only needed when the buffer isn't double mapped
+static bool protect_code(const jit_t *jit, const size_t offset, const size_t length, const int protection)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t first = offset / page * page;
+    const size_t end = offset + length < JIT_CODE_SIZE ? offset + length : JIT_CODE_SIZE;
+    return mprotect(jit->code + first, (end + page - 1) / page * page - first, protection) == 0;
+}
+
+// Compile the block starting at `start`, returns its index + 1, or JIT_INTERPRET if the
+// first instruction can't be compiled
+static uint16_t compile(const chip8_t *chip8, jit_t *jit, const uint16_t start)
+{
+    decoded_t ops[JIT_MAX_BLOCK_LENGTH];
+    uint8_t length = 0;
+    uint16_t address = start;
+
+    // FX65 of every register is the longest instruction at about 350 bytes of code
+    const size_t worst_case = 384 * (JIT_MAX_BLOCK_LENGTH + 2);
+    if(jit->count == JIT_MAX_BLOCKS || jit->code_used + worst_case > JIT_CODE_SIZE) jit_reset(jit);
+
+    // Find the run of compilable instructions
+    while(length < JIT_MAX_BLOCK_LENGTH)
+    {
+        const uint16_t next = (address + 1) & 0xFFF;
+        const decoded_t d = decode_instruction((chip8->ram[address] << 8) | chip8->ram[next]);
+        jit->code_bitmap[address >> 6] |= 1ull << (address & 63);
+        jit->code_bitmap[next >> 6] |= 1ull << (next & 63);
+        if(!is_compilable(d.handler) || is_hot(jit, address)) break;
+
+        ops[length++] = d;
+        address = (address + 2) & 0xFFF;
+        if(is_terminator(d.handler) || address < 2) break; // Never run a block past the end of RAM
+    }
+
+    if(length == 0)
+    {
+        jit->lookup[start] = JIT_INTERPRET;
+        return JIT_INTERPRET;
+    }
+
+    // Pin the most used V registers in r8-r11 for the whole block
+    uint8_t uses[16] = {0};
+    for(uint8_t i = 0; i < length; i++)
+    {
+        uses[ops[i].X]++;
+        uses[ops[i].Y]++;
+    }
+    emitter_t e = {.p = jit->code + jit->code_used};
+    memset(e.host, -1, sizeof e.host);
+    for(uint8_t host = PINNED_FIRST; host < PINNED_FIRST + PINNED_COUNT; host++)
+    {
+        int8_t best = -1;
+        for(uint8_t x = 0; x < 16; x++)
+        {
+            if(e.host[x] < 0 && uses[x] > 0 && (best < 0 || uses[x] > uses[best])) best = x;
+        }
+        if(best < 0) break;
+        e.host[best] = host;
+    }
+
+    const bool double_mapped = jit->exec != jit->code;
+    if(!double_mapped && !protect_code(jit, jit->code_used, worst_case, PROT_READ | PROT_WRITE))
+    {
+        // Interpret this address from now on rather than retrying the syscall on every dispatch
+        jit->lookup[start] = JIT_INTERPRET;
+        return JIT_INTERPRET;
+    }
+
+    load_pinned(&e);
+    uint8_t events = CHIP8_EVENT_NONE;
+    for(uint8_t i = 0; i < length; i++)
+    {
+        emit_instruction(&e, &ops[i], start + 2 * i);
+        if(ops[i].handler == OP_00E0 || ops[i].handler == OP_DXYN) events |= CHIP8_EVENT_DRAW;
+    }
+    const decoded_t *last = &ops[length - 1];
+    if(!is_terminator(last->handler) || last->handler == OP_FX33 || last->handler == OP_FX55)
+    {
+        store_pc_imm(&e, start + 2 * length);
+    }
+    store_pinned(&e);
+    emit8(&e, 0xC3);                                                                  // ret
+
+    if(!double_mapped && !protect_code(jit, jit->code_used, worst_case, PROT_READ | PROT_EXEC))
+    {
+        // The buffer can't be executed, give up on the JIT for good instead of jumping into it
+        fprintf(stderr, "Could not make JIT code executable, falling back to the interpreter\n");
+        munmap(jit->code, JIT_CODE_SIZE);
+        jit->code = jit->exec = NULL;
+        return JIT_INTERPRET;
+    }
+
+    jit_block_t *block = &jit->blocks[jit->count++];
+    *block = (jit_block_t) {
+        .code = (jit_block_fn) (jit->exec + jit->code_used),
+        .start = start,
+        .length = length,
+        .events = events,
+        .writes = last->handler == OP_FX33 ? 3 : last->handler == OP_FX55 ? last->X + 1 : 0,
+        .valid = true,
+    };
+    jit->code_used = e.p - jit->code;
+    if(length > jit->longest) jit->longest = length;
+    jit->lookup[start] = jit->count;
+    jit->start_bitmap[start >> 6] |= 1ull << (start & 63);
+    return jit->count;
+}
+
+// Map the code buffer. Where the host allows it the buffer is mapped twice, writable and executable,
+// so compiling never changes page protection. Returns false if the host can't provide a buffer,
+// in which case jit_run() still works but only interprets.
+bool jit_init(jit_t *jit)
+{
+    memset(jit, 0, sizeof *jit);
+
+#ifdef MFD_CLOEXEC
+    const int fd = memfd_create("chip8-jit", MFD_CLOEXEC);
+    if(fd >= 0)
+    {
+        void *code = MAP_FAILED, *exec = MAP_FAILED;
+        if(ftruncate(fd, JIT_CODE_SIZE) == 0)
+        {
+            code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            exec = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+
+        if(code != MAP_FAILED && exec != MAP_FAILED)
+        {
+            jit->code = code;
+            jit->exec = exec;
+            return true;
+        }
+        if(code != MAP_FAILED) munmap(code, JIT_CODE_SIZE);
+        if(exec != MAP_FAILED) munmap(exec, JIT_CODE_SIZE);
+    }
+#endif
+
+    // Single mapping, compile() flips the pages it writes between writable and executable
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map JIT code buffer, falling back to the interpreter\n");
+        return false;
+    }
+    jit->code = jit->exec = code;
+    return true;
+}
+
+void jit_destroy(jit_t *jit)
+{
+    if(jit->exec && jit->exec != jit->code) munmap(jit->exec, JIT_CODE_SIZE);
+    if(jit->code) munmap(jit->code, JIT_CODE_SIZE);
+    jit->code = jit->exec = NULL;
+    chip8_destroy(jit->reference);
+    jit->reference = NULL;
+}
+
+#else
+
+bool jit_init(jit_t *jit)
+{
+    memset(jit, 0, sizeof *jit);
+    return false;
+}
+
+void jit_destroy(jit_t *jit)
+{
+    chip8_destroy(jit->reference);
+    jit->reference = NULL;
+}
+
+#endif
+
+// Flush every compiled block, required whenever RAM is changed behind the JIT's back (e.g. loading a new ROM)
+void jit_reset(jit_t *jit)
+{
+    memset(jit->lookup, 0, sizeof jit->lookup);
+    memset(jit->code_bitmap, 0, sizeof jit->code_bitmap);
+    memset(jit->start_bitmap, 0, sizeof jit->start_bitmap);
+    memset(jit->rewrites, 0, sizeof jit->rewrites);
+    jit->count = 0;
+    jit->longest = 0;
+    jit->code_used = 0;
+}
+
+// Run up to `cycles` instructions, natively where a compiled block fits in the remaining cycles
+// and through emulate_instruction() otherwise (key waits, code rewritten too often, etc.).
+// Same contract and chip8_event_t results as chip8_run().
+uint32_t jit_run(chip8_t *chip8, jit_t *jit, uint32_t cycles)
+{
+    uint32_t events = CHIP8_EVENT_NONE;
+    const bool sound_was_on = chip8->sound_timer > 0;
+
+    while(cycles > 0 && chip8->state == RUNNING)
+    {
+#if JIT_AVAILABLE
+        // Compiled code keeps the PC in 0x000 - 0xFFF (plus the final +2), the interpreter lets it
+        // run further with only fetches wrapping. Past 0xFFF the machine is interpreted, so the PC
+        // and the return addresses 2NNN pushes keep their upper bits exactly as execute() leaves them.
+        if(jit->code && chip8->PC <= 0xFFF)
+        {
+            const uint16_t PC = chip8->PC;
+            uint16_t index = jit->lookup[PC];
+            if(!index) index = compile(chip8, jit, PC);
+
+            if(index != JIT_INTERPRET && jit->blocks[index - 1].length <= cycles)
+            {
+                const jit_block_t *block = &jit->blocks[index - 1];
+                cycles -= block->length;
+
+                if(jit->self_check && !reserve_reference(jit, chip8)) jit->self_check = false;
+                if(jit->self_check)
+                {
+                    // Lockstep: run the interpreter on a copy, then compare after the native block
+                    chip8_t *reference = jit->reference;
+                    chip8_copy(reference, chip8);
+                    for(uint8_t i = 0; i < block->length; i++)
+                    {
+                        emulate_instruction(reference);
+                    }
+
+                    block->code(chip8);
+
+                    if(!same_state(reference, chip8))
+                    {
+                        fprintf(stderr, "JIT mismatch in block at 0x%04X (%u instructions), using interpreter state\n",
+                                block->start, block->length);
+                        jit->mismatches++;
+                        chip8_copy(chip8, reference);
+                    }
+                } else {
+                    block->code(chip8);
+                }
+
+                // A block ending in FX33/FX55 may have just rewritten compiled code
+                events |= block->events;
+                if(block->writes) jit_invalidate(jit, chip8->I, block->writes);
+                continue;
+            }
+        }
+#endif
+
+        // Interpreter fallback, one instruction at a time
+        const uint16_t PC = chip8->PC;
+        const uint16_t opcode = emulate_instruction(chip8);
+        cycles--;
+
+        if((opcode & 0xF0FF) == 0x00E0 || (opcode & 0xF000) == 0xD000)
+        {
+            events |= CHIP8_EVENT_DRAW;
+        } else if((opcode & 0xF0FF) == 0xF00A && chip8->PC == PC) {
+            events |= CHIP8_EVENT_WAIT_KEY;
+            break;
+        } else if((opcode & 0xF0FF) == 0xF033) {
+            jit_invalidate(jit, chip8->I, 3);
+        } else if((opcode & 0xF0FF) == 0xF055) {
+            jit_invalidate(jit, chip8->I, ((opcode >> 8) & 0x0F) + 1);
+        }
+    }
+
+    const bool sound_is_on = chip8->sound_timer > 0;
+    if(sound_is_on && !sound_was_on) events |= CHIP8_EVENT_SOUND_ON;
+    if(!sound_is_on && sound_was_on) events |= CHIP8_EVENT_SOUND_OFF;
+
+    return events;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// The JIT only targets x86-64 hosts with mmap(), everywhere else jit_init() fails and
+// jit_run() simply runs the interpreter
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+    #define JIT_AVAILABLE 1
+#else
+    #define JIT_AVAILABLE 0
+#endif
+
+#define JIT_MAX_BLOCK_LENGTH 32         // Instructions per compiled block
+#define JIT_MAX_BLOCKS       2048       // Compiled blocks held before the whole cache is flushed
+#define JIT_CODE_SIZE        (1 << 20)  // Size of the executable code buffer
+#define JIT_INTERPRET        0xFFFF     // Lookup marker: instruction at this address can't be compiled
+#define JIT_REWRITE_LIMIT    4          // Writes to a code byte after which it is only interpreted
+
+typedef void (*jit_block_fn)(chip8_t *chip8);
+
+// Compiled Block Object
+typedef struct {
+    jit_block_fn code;      // Native entry point, runs the whole block and sets the PC
+    uint16_t start;         // RAM address of the first instruction
+    uint8_t length;         // Number of CHIP8 instructions in the block
+    uint8_t events;         // CHIP8_EVENT_DRAW if the block runs 00E0 or DXYN
+    uint8_t writes;         // Bytes its last instruction (FX33/FX55) writes at I, 0 if none
+    bool valid;
+} jit_block_t;
+
+// JIT Object
+typedef struct {
+    uint8_t *code;                      // Writable view of the mmap'd code buffer, NULL if the JIT is unavailable
+    uint8_t *exec;                      // Executable view of the same buffer, equal to `code` without double mapping
+    size_t code_used;
+    uint16_t lookup[4096];              // Block index + 1 for each start address, 0 if untranslated
+    uint64_t code_bitmap[4096 / 64];    // One bit per RAM byte covered by compiled code or an interpret marker
+    uint64_t start_bitmap[4096 / 64];   // One bit per start address of a compiled block
+    uint8_t rewrites[4096];             // Writes to each code byte, up to JIT_REWRITE_LIMIT
+    uint16_t count;                     // Blocks compiled since the last flush
+    uint8_t longest;                    // Length of the longest of them, bounds the blocks a write can hit
+    jit_block_t blocks[JIT_MAX_BLOCKS];
+    bool self_check;                    // Run every block against the interpreter in lockstep
+    chip8_t *reference;                 // Interpreter copy of the machine in self check mode
+    uint64_t mismatches;                // Blocks that disagreed with the interpreter in self check mode
+} jit_t;
+
+bool jit_init(jit_t *jit);
+void jit_destroy(jit_t *jit);
+void jit_reset(jit_t *jit);
+void jit_invalidate(jit_t *jit, const uint16_t address, const uint16_t length);
+uint32_t jit_run(chip8_t *chip8, jit_t *jit, uint32_t cycles);
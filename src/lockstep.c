@@ -0,0 +1,654 @@
+#include "lockstep.h"
+#include "emulator.h"
+
+_Static_assert(LOCKSTEP_LANES == 32, "lane masks are kept in a uint32_t");
+
+#define LOCKSTEP_ALL_LANES 0xFFFFFFFFu
+#define LOCKSTEP_MAX_GROUPS 4       // Groups in one step past which the lanes are run one by one
+#define LOCKSTEP_LANE_STEPS 256     // Steps each lane runs on its own before checking whether the lanes met again
+
+// Build the run loop for AVX2 and for the baseline ISA (SSE2 on x86-64), picked at load time
+#if defined(__x86_64__) && defined(__linux__) && !defined(LOCKSTEP_NO_CLONES)
+    #define LOCKSTEP_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+    #define LOCKSTEP_TARGETS
+#endif
+
+typedef int8_t lane_s8_t __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int16_t lane_s16_t __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+
+// Pick `new` in the lanes set in `mask` (all ones / all zeroes per lane), keep `old` elsewhere
+#define BLEND(mask, new, old) (((new) & (mask)) | ((old) & ~(mask)))
+
+// Iterate over the lane numbers set in a uint32_t lane mask
+#define FOR_EACH_LANE(lanes, lane) \
+    for(uint32_t bits_ = (lanes), lane; bits_ && (lane = __builtin_ctz(bits_), 1); bits_ &= bits_ - 1)
+
+// Whether every lane of `v` equals `x`
+static inline __attribute__((always_inline)) bool all_equal(const lane_u16_t *v, const uint16_t x)
+{
+    const lane_u16_t diff = *v ^ x;
+    uint64_t words[sizeof diff / sizeof(uint64_t)];
+    memcpy(words, &diff, sizeof diff);
+
+    uint64_t any = 0;
+    for(size_t i = 0; i < sizeof words / sizeof words[0]; i++)
+    {
+        any |= words[i];
+    }
+    return !any;
+}
+
+// Per byte lane weights within each group of 8 lanes, used to convert between vector masks and lane bits
+static const lane_u8_t lane_weights = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+};
+
+// Vector mask (all ones / all zeroes per lane) to a uint32_t lane mask.
+// The weighted bytes of 8 lanes never overlap, so multiplying sums them into the top byte.
+static inline __attribute__((always_inline)) uint32_t mask_to_lanes(const lane_u8_t *mask)
+{
+    const lane_u8_t weighted = *mask & lane_weights;
+    uint64_t groups[LOCKSTEP_LANES / 8];
+    memcpy(groups, &weighted, sizeof groups);
+
+    uint32_t lanes = 0;
+    for(uint32_t i = 0; i < LOCKSTEP_LANES / 8; i++)
+    {
+        lanes |= (uint32_t) ((groups[i] * 0x0101010101010101ull) >> 56) << (8 * i);
+    }
+    return lanes;
+}
+
+// uint32_t lane mask to a vector mask
+static inline __attribute__((always_inline)) void lanes_to_mask(const uint32_t lanes, lane_u8_t *mask)
+{
+    uint64_t groups[LOCKSTEP_LANES / 8];
+    for(uint32_t i = 0; i < LOCKSTEP_LANES / 8; i++)
+    {
+        groups[i] = ((lanes >> (8 * i)) & 0xFF) * 0x0101010101010101ull;
+    }
+
+    memcpy(mask, groups, sizeof *mask);
+    *mask = (lane_u8_t) ((*mask & lane_weights) != 0);
+}
+
+// Widen the range of RAM the lanes may differ in by a write of `length` bytes at `I`, and drop the
+// instructions decoded there. An opcode at A reads A and A+1, so the one just before goes too.
+static inline __attribute__((always_inline)) void widen_written(lockstep_t *lockstep, const uint16_t I, const uint8_t length)
+{
+    if(lockstep->decoding && decode_bitmap_any(lockstep->decoded_bitmap, (I - 1) & 0xFFF, length + 1))
+    {
+        for(uint8_t i = 0; i <= length; i++)
+        {
+            lockstep->decoded[(I - 1 + i) & 0xFFF].handler = OP_DECODE;
+        }
+    }
+
+    const uint16_t start = I & 0xFFF;
+    const uint16_t end = start + length;
+    if(end > CHIP8_RAM_SIZE)
+    {
+        // Wrapped around the end of RAM
+        lockstep->written_start = 0;
+        lockstep->written_end = CHIP8_RAM_SIZE;
+        return;
+    }
+    if(start < lockstep->written_start) lockstep->written_start = start;
+    if(end > lockstep->written_end) lockstep->written_end = end;
+}
+
+// Find the lanes whose RAM now differs from lane 0's. Outside the written range every lane still
+// holds the same RAM, so only that range is compared. A ROM rewriting the same few bytes stays
+// cheap, and once every lane holds the same RAM again the range is emptied and the all-lanes
+// fast path is back.
+static void update_written(lockstep_t *lockstep)
+{
+    const uint16_t start = lockstep->written_start;
+    const uint16_t end = lockstep->written_end;
+    uint32_t written = 0;
+    for(uint32_t lane = 1; start < end && lane < LOCKSTEP_LANES; lane++)
+    {
+        if(memcmp(&lockstep->ram[lane][start], &lockstep->ram[0][start], end - start)) written |= 1u << lane;
+    }
+
+    lockstep->written = written;
+    if(!written)
+    {
+        lockstep->written_start = CHIP8_RAM_SIZE;
+        lockstep->written_end = 0;
+    }
+}
+
+// Seed one lane's CXNN generator, same sequence as chip8_seed() on a scalar machine
+void lockstep_seed(lockstep_t *lockstep, const uint8_t lane, const uint32_t seed)
+{
+    lockstep->rng_state[lane] = chip8_seed_state(seed);
+}
+
+// Extract one lane as a regular machine. Lanes only run plain CHIP8, so the display is low
+// resolution plane 0 and only the first CHIP8_RAM_SIZE bytes of RAM are used.
+void lockstep_load_lane(const lockstep_t *lockstep, const uint8_t lane, chip8_t *chip8)
+{
+    memcpy(chip8->ram, lockstep->ram[lane], sizeof lockstep->ram[lane]);
+    memset(chip8->display, 0, sizeof chip8->display);
+    for(uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        chip8->display[0][y] = (chip8_row_t) lockstep->display[lane][y] << 64;
+    }
+    memcpy(chip8->stack, lockstep->stack[lane], sizeof chip8->stack);
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        chip8->V[i] = lockstep->V[i][lane];
+    }
+
+    chip8->state = RUNNING;
+    chip8->keypad = lockstep->keypad[lane];
+    chip8->SP = lockstep->depth[lane];
+    chip8->I = lockstep->I[lane];
+    chip8->PC = lockstep->PC[lane];
+    chip8->delay_timer = lockstep->delay_timer[lane];
+    chip8->sound_timer = lockstep->sound_timer[lane];
+    chip8->rng_state = lockstep->rng_state[lane];
+    chip8->dirty_rows = lockstep->dirty_rows[lane];
+    chip8->hires = false;
+    chip8->planes = 1;
+    chip8->audio_pattern_set = false;
+    chip8->pitch = CHIP8_DEFAULT_PITCH;
+}
+
+// Copy a machine into one lane, leaving the written lanes to the caller
+static void store_lane(lockstep_t *lockstep, const uint8_t lane, const chip8_t *chip8)
+{
+    memcpy(lockstep->ram[lane], chip8->ram, sizeof lockstep->ram[lane]);
+    for(uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        lockstep->display[lane][y] = chip8_lores_row(chip8->display[0][y]);
+    }
+    memcpy(lockstep->stack[lane], chip8->stack, sizeof chip8->stack);
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        lockstep->V[i][lane] = chip8->V[i];
+    }
+
+    lockstep->keypad[lane] = chip8->keypad;
+    lockstep->depth[lane] = chip8->SP;
+    lockstep->I[lane] = chip8->I;
+    lockstep->PC[lane] = chip8->PC;
+    lockstep->delay_timer[lane] = chip8->delay_timer;
+    lockstep->sound_timer[lane] = chip8->sound_timer;
+    lockstep->rng_state[lane] = chip8->rng_state;
+    lockstep->dirty_rows[lane] = chip8->dirty_rows;
+}
+
+// Replace one lane with a regular plain CHIP8 machine. Its RAM may differ anywhere.
+void lockstep_store_lane(lockstep_t *lockstep, const uint8_t lane, const chip8_t *chip8)
+{
+    store_lane(lockstep, lane, chip8);
+    memset(lockstep->decoded, 0, sizeof lockstep->decoded);
+    memset(lockstep->decoded_bitmap, 0, sizeof lockstep->decoded_bitmap);
+    lockstep->decoding = false;
+    lockstep->written_start = 0;
+    lockstep->written_end = CHIP8_RAM_SIZE;
+    update_written(lockstep);
+}
+
+// Copy one machine into every lane, all lanes then run the same code
+void lockstep_init(lockstep_t *lockstep, const chip8_t *chip8)
+{
+    memset(lockstep, 0, sizeof *lockstep);
+    for(uint8_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        store_lane(lockstep, lane, chip8);
+    }
+
+    // Every lane holds the same RAM
+    lockstep->written = 0;
+    lockstep->written_start = CHIP8_RAM_SIZE;
+    lockstep->written_end = 0;
+}
+
+// Same as draw_sprite() for one lane, the sprite at I drawn at (x, y). Returns the new VF.
+static bool draw_lane(lockstep_t *lockstep, const uint32_t lane, const uint8_t x, const uint8_t y, const uint16_t I, const uint8_t N)
+{
+    const uint8_t X_coord = x % CHIP8_DISPLAY_WIDTH;
+    const uint8_t Y_coord = y % CHIP8_DISPLAY_HEIGHT;
+    uint64_t collision = 0;
+    uint64_t dirty = 0;
+
+    for(uint8_t i = 0; i < N && Y_coord + i < CHIP8_DISPLAY_HEIGHT; i++)
+    {
+        const uint64_t sprite_row = ((uint64_t) lockstep->ram[lane][(I + i) & 0xFFF] << 56) >> X_coord;
+        uint64_t *display_row = &lockstep->display[lane][Y_coord + i];
+
+        collision |= *display_row & sprite_row;
+        *display_row ^= sprite_row;
+        dirty |= (uint64_t) (sprite_row != 0) << (Y_coord + i);
+    }
+
+    lockstep->dirty_rows[lane] |= dirty;
+    return collision != 0;
+}
+
+// Execute `opcode` in every lane of `lanes`, also given as 8 and 16 bit vector masks.
+// Register, timer and PC updates are single vector operations, stack, RAM, display, keypad and
+// RNG accesses go lane by lane.
+static inline __attribute__((always_inline))
+void execute(lockstep_t *lockstep, const uint16_t opcode, const uint32_t lanes, const lane_u8_t *lane_mask8, const lane_u16_t *lane_mask16)
+{
+    const lane_u8_t m8 = *lane_mask8;
+    const lane_u16_t m16 = *lane_mask16;
+    const uint16_t NNN = opcode & 0x0FFF;
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t N = opcode & 0x0F;
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+
+    lane_u8_t *VX = &lockstep->V[X];
+    const lane_u8_t VY = lockstep->V[Y];
+    lane_u8_t *VF = &lockstep->V[0xF];
+    lane_u8_t skip = {0}; // Lanes that skip the next instruction, all ones / all zeroes
+    lane_u8_t carry;
+
+    lockstep->PC += m16 & 2;
+
+    switch(opcode >> 12)
+    {
+        case 0x00:
+            if(NN == 0xE0)
+            {
+                FOR_EACH_LANE(lanes, lane)
+                {
+                    memset(lockstep->display[lane], 0, sizeof lockstep->display[lane]);
+                    lockstep->dirty_rows[lane] = ~0ull;
+                }
+            } else if(NN == 0xEE) {
+                FOR_EACH_LANE(lanes, lane)
+                {
+                    lockstep->PC[lane] = lockstep->stack[lane][--lockstep->depth[lane] & 15];
+                }
+            }
+            break;
+        case 0x01:
+            lockstep->PC = BLEND(m16, NNN + (lane_u16_t) {0}, lockstep->PC);
+            break;
+        case 0x02:
+            FOR_EACH_LANE(lanes, lane)
+            {
+                lockstep->stack[lane][lockstep->depth[lane]++ & 15] = lockstep->PC[lane];
+            }
+            lockstep->PC = BLEND(m16, NNN + (lane_u16_t) {0}, lockstep->PC);
+            break;
+        case 0x03: skip = (lane_u8_t) (*VX == NN); break;
+        case 0x04: skip = (lane_u8_t) (*VX != NN); break;
+        case 0x05: skip = (lane_u8_t) (*VX == VY); break;
+        case 0x06: *VX = BLEND(m8, NN + (lane_u8_t) {0}, *VX); break;
+        case 0x07: *VX += NN & m8; break;
+        case 0x08:
+            switch(N)
+            {
+                case 0x0: *VX = BLEND(m8, VY, *VX); break;
+                case 0x1: *VX |= VY & m8; break;
+                case 0x2: *VX &= VY | ~m8; break;
+                case 0x3: *VX ^= VY & m8; break;
+                case 0x4:
+                    carry = (lane_u8_t) (*VX + VY < *VX);
+                    *VX = BLEND(m8, *VX + VY, *VX);
+                    *VF = BLEND(m8, carry & 1, *VF);
+                    break;
+                case 0x5:
+                    carry = (lane_u8_t) (VY <= *VX); // No underflow
+                    *VX = BLEND(m8, *VX - VY, *VX);
+                    *VF = BLEND(m8, carry & 1, *VF);
+                    break;
+                case 0x6:
+                    carry = *VX & 1;
+                    *VX = BLEND(m8, *VX >> 1, *VX);
+                    *VF = BLEND(m8, carry, *VF);
+                    break;
+                case 0x7:
+                    carry = (lane_u8_t) (*VX <= VY); // No underflow
+                    *VX = BLEND(m8, VY - *VX, *VX);
+                    *VF = BLEND(m8, carry & 1, *VF);
+                    break;
+                case 0xE:
+                    carry = *VX >> 7;
+                    *VF = BLEND(m8, carry, *VF);
+                    *VX = BLEND(m8, *VX << 1, *VX);
+                    break;
+                default:
+                    break; // unimplemented or invalid opcode
+            }
+            break;
+        case 0x09: skip = (lane_u8_t) (*VX != VY); break;
+        case 0x0A:
+            lockstep->I = BLEND(m16, NNN + (lane_u16_t) {0}, lockstep->I);
+            break;
+        case 0x0B:
+            lockstep->PC = BLEND(m16, __builtin_convertvector(lockstep->V[0], lane_u16_t) + NNN, lockstep->PC);
+            break;
+        case 0x0C:
+            FOR_EACH_LANE(lanes, lane)
+            {
+                (*VX)[lane] = chip8_random_next(&lockstep->rng_state[lane]) & NN;
+            }
+            break;
+        case 0x0D:
+            FOR_EACH_LANE(lanes, lane)
+            {
+                (*VF)[lane] = draw_lane(lockstep, lane, (*VX)[lane], VY[lane], lockstep->I[lane], N);
+            }
+            break;
+        case 0x0E:
+            if(NN != 0x9E && NN != 0xA1) break;
+            FOR_EACH_LANE(lanes, lane)
+            {
+                const bool pressed = (*VX)[lane] < 16 && ((lockstep->keypad[lane] >> (*VX)[lane]) & 1);
+                skip[lane] = pressed == (NN == 0x9E) ? 0xFF : 0;
+            }
+            break;
+        case 0x0F:
+            switch(NN)
+            {
+                case 0x0A:
+                    FOR_EACH_LANE(lanes, lane)
+                    {
+                        if(lockstep->keypad[lane]) (*VX)[lane] = __builtin_ctz(lockstep->keypad[lane]);
+                        else lockstep->PC[lane] -= 2; // Repeat this instruction
+                    }
+                    break;
+                case 0x07: *VX = BLEND(m8, lockstep->delay_timer, *VX); break;
+                case 0x15: lockstep->delay_timer = BLEND(m8, *VX, lockstep->delay_timer); break;
+                case 0x18: lockstep->sound_timer = BLEND(m8, *VX, lockstep->sound_timer); break;
+                case 0x1E: lockstep->I += __builtin_convertvector(*VX, lane_u16_t) & m16; break;
+                case 0x29: lockstep->I = BLEND(m16, __builtin_convertvector(*VX, lane_u16_t) * 5, lockstep->I); break;
+                case 0x33:
+                    FOR_EACH_LANE(lanes, lane)
+                    {
+                        const uint16_t I = lockstep->I[lane];
+                        uint8_t bcd = (*VX)[lane];
+                        lockstep->ram[lane][(I + 2) & 0xFFF] = bcd % 10;
+                        bcd /= 10;
+                        lockstep->ram[lane][(I + 1) & 0xFFF] = bcd % 10;
+                        bcd /= 10;
+                        lockstep->ram[lane][I & 0xFFF] = bcd;
+                        widen_written(lockstep, I, 3);
+                    }
+                    update_written(lockstep);
+                    break;
+                case 0x55:
+                    FOR_EACH_LANE(lanes, lane)
+                    {
+                        for(uint8_t i = 0; i <= X; i++)
+                        {
+                            lockstep->ram[lane][(lockstep->I[lane] + i) & 0xFFF] = lockstep->V[i][lane];
+                        }
+                        widen_written(lockstep, lockstep->I[lane], X + 1);
+                    }
+                    update_written(lockstep);
+                    break;
+                case 0x65:
+                    FOR_EACH_LANE(lanes, lane)
+                    {
+                        for(uint8_t i = 0; i <= X; i++)
+                        {
+                            lockstep->V[i][lane] = lockstep->ram[lane][(lockstep->I[lane] + i) & 0xFFF];
+                        }
+                    }
+                    break;
+                default:
+                    break; // unimplemented or invalid opcode
+            }
+            break;
+        default:
+            break;
+    }
+
+    // Skips from 3XNN/4XNN/5XY0/9XY0/EX9E/EXA1, widened to the 16 bit PC lanes
+    lockstep->PC += (__builtin_convertvector((lane_s8_t) (skip & m8), lane_s16_t) & 2);
+}
+
+// One lane's registers, copied out of the vectors while the lane runs on its own
+typedef struct {
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t depth;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+} lane_registers_t;
+
+// Same as execute() for the single lane `lane` with plain scalar operations on its registers `r`.
+// Outside the written range every lane holds the same code, so it is decoded once for all of them.
+// RAM writes only widen the written range, the caller runs update_written().
+static inline __attribute__((always_inline)) void execute_lane(lockstep_t *lockstep, const uint32_t lane, lane_registers_t *r)
+{
+    uint8_t *ram = lockstep->ram[lane];
+    const uint16_t PC = r->PC & 0xFFF;
+    decoded_t d = lockstep->decoded[PC];
+    if(d.handler == OP_DECODE)
+    {
+        d = decode_instruction((ram[PC] << 8) | ram[(PC + 1) & 0xFFF]);
+        if(!decode_ranges_overlap(PC, PC + 2, lockstep->written_start, lockstep->written_end))
+        {
+            const uint16_t next = (PC + 1) & 0xFFF;
+            lockstep->decoded[PC] = d;
+            lockstep->decoding = true;
+            lockstep->decoded_bitmap[PC >> 6] |= 1ull << (PC & 63);
+            lockstep->decoded_bitmap[next >> 6] |= 1ull << (next & 63);
+        }
+    }
+
+    uint8_t *VX = &r->V[d.X];
+    const uint8_t VY = r->V[d.Y];
+    uint8_t *VF = &r->V[0xF];
+    bool skip = false;
+    uint8_t carry;
+
+    r->PC += 2;
+
+    switch(d.handler)
+    {
+        case OP_00E0:
+            memset(lockstep->display[lane], 0, sizeof lockstep->display[lane]);
+            lockstep->dirty_rows[lane] = ~0ull;
+            break;
+        case OP_00EE: r->PC = lockstep->stack[lane][--r->depth & 15]; break;
+        case OP_1NNN: r->PC = d.NNN; break;
+        case OP_2NNN:
+            lockstep->stack[lane][r->depth++ & 15] = r->PC;
+            r->PC = d.NNN;
+            break;
+        case OP_3XNN: skip = *VX == d.NN; break;
+        case OP_4XNN: skip = *VX != d.NN; break;
+        case OP_5XY0: skip = *VX == VY; break;
+        case OP_6XNN: *VX = d.NN; break;
+        case OP_7XNN: *VX += d.NN; break;
+        case OP_8XY0: *VX = VY; break;
+        case OP_8XY1: *VX |= VY; break;
+        case OP_8XY2: *VX &= VY; break;
+        case OP_8XY3: *VX ^= VY; break;
+        case OP_8XY4:
+            carry = (uint8_t) (*VX + VY) < *VX;
+            *VX += VY;
+            *VF = carry;
+            break;
+        case OP_8XY5:
+            carry = VY <= *VX; // No underflow
+            *VX -= VY;
+            *VF = carry;
+            break;
+        case OP_8XY6:
+            carry = *VX & 1;
+            *VX >>= 1;
+            *VF = carry;
+            break;
+        case OP_8XY7:
+            carry = *VX <= VY; // No underflow
+            *VX = VY - *VX;
+            *VF = carry;
+            break;
+        case OP_8XYE:
+            carry = *VX >> 7;
+            *VF = carry;
+            *VX <<= 1;
+            break;
+        case OP_9XY0: skip = *VX != VY; break;
+        case OP_ANNN: r->I = d.NNN; break;
+        case OP_BNNN: r->PC = r->V[0] + d.NNN; break;
+        case OP_CXNN: *VX = chip8_random_next(&lockstep->rng_state[lane]) & d.NN; break;
+        case OP_DXYN: *VF = draw_lane(lockstep, lane, *VX, VY, r->I, d.N); break;
+        case OP_EX9E: skip = *VX < 16 && ((lockstep->keypad[lane] >> *VX) & 1); break;
+        case OP_EXA1: skip = !(*VX < 16 && ((lockstep->keypad[lane] >> *VX) & 1)); break;
+        case OP_FX0A:
+            if(lockstep->keypad[lane]) *VX = __builtin_ctz(lockstep->keypad[lane]);
+            else r->PC -= 2; // Repeat this instruction
+            break;
+        case OP_FX07: *VX = r->delay_timer; break;
+        case OP_FX15: r->delay_timer = *VX; break;
+        case OP_FX18: r->sound_timer = *VX; break;
+        case OP_FX1E: r->I += *VX; break;
+        case OP_FX29: r->I = *VX * 5; break;
+        case OP_FX33:
+            ram[(r->I + 2) & 0xFFF] = *VX % 10;
+            ram[(r->I + 1) & 0xFFF] = *VX / 10 % 10;
+            ram[r->I & 0xFFF] = *VX / 100;
+            widen_written(lockstep, r->I, 3);
+            break;
+        case OP_FX55:
+            for(uint8_t i = 0; i <= d.X; i++)
+            {
+                ram[(r->I + i) & 0xFFF] = r->V[i];
+            }
+            widen_written(lockstep, r->I, d.X + 1);
+            break;
+        case OP_FX65:
+            for(uint8_t i = 0; i <= d.X; i++)
+            {
+                r->V[i] = ram[(r->I + i) & 0xFFF];
+            }
+            break;
+        default:
+            break; // unimplemented or invalid opcode
+    }
+
+    if(skip) r->PC += 2;
+}
+
+// Run `steps` instructions on each lane in turn, every lane on its own. They only share the
+// written range, which grows with their writes until update_written() once the lanes meet again.
+static inline __attribute__((always_inline)) void run_lanes(lockstep_t *lockstep, const uint32_t steps)
+{
+    for(uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        lane_registers_t r = {
+            .I = lockstep->I[lane],
+            .PC = lockstep->PC[lane],
+            .depth = lockstep->depth[lane],
+            .delay_timer = lockstep->delay_timer[lane],
+            .sound_timer = lockstep->sound_timer[lane],
+        };
+        for(uint8_t x = 0; x < 16; x++)
+        {
+            r.V[x] = lockstep->V[x][lane];
+        }
+
+        for(uint32_t step = 0; step < steps; step++)
+        {
+            execute_lane(lockstep, lane, &r);
+        }
+
+        for(uint8_t x = 0; x < 16; x++)
+        {
+            lockstep->V[x][lane] = r.V[x];
+        }
+        lockstep->I[lane] = r.I;
+        lockstep->PC[lane] = r.PC;
+        lockstep->depth[lane] = r.depth;
+        lockstep->delay_timer[lane] = r.delay_timer;
+        lockstep->sound_timer[lane] = r.sound_timer;
+    }
+}
+
+// Run `cycles` instructions on every lane. Each step the lanes are split into groups sharing a
+// PC and opcode, and each group executes its opcode once for all of its lanes. Once a step needs
+// more than LOCKSTEP_MAX_GROUPS groups the lanes have gone their own way and regrouping them
+// every step costs more than it saves, so they run one by one LOCKSTEP_LANE_STEPS at a time
+// until every PC matches again. Per lane results match chip8_run() on the same machine.
+LOCKSTEP_TARGETS
+void lockstep_run(lockstep_t *lockstep, uint32_t cycles)
+{
+    const lane_u8_t all8 = ~(lane_u8_t) {0};
+    const lane_u16_t all16 = ~(lane_u16_t) {0};
+
+    while(cycles > 0)
+    {
+        const uint16_t PC = lockstep->PC[0];
+        const bool same_PC = all_equal(&lockstep->PC, PC);
+        if(lockstep->diverged && !same_PC)
+        {
+            const uint32_t steps = cycles < LOCKSTEP_LANE_STEPS ? cycles : LOCKSTEP_LANE_STEPS;
+            run_lanes(lockstep, steps);
+            cycles -= steps;
+            continue;
+        }
+        if(lockstep->diverged)
+        {
+            // Back together, find out which lanes the writes made while apart left with different RAM
+            update_written(lockstep);
+            lockstep->diverged = false;
+        }
+        cycles--;
+
+        // Fast path: every lane is at the same PC and holds the same RAM
+        if(!lockstep->written && same_PC)
+        {
+            const uint16_t opcode = (lockstep->ram[0][PC & 0xFFF] << 8) | lockstep->ram[0][(PC + 1) & 0xFFF];
+            execute(lockstep, opcode, LOCKSTEP_ALL_LANES, &all8, &all16);
+            continue;
+        }
+
+        // Divergent lanes: regroup by PC and opcode, one masked execution per group
+        uint32_t pending = LOCKSTEP_ALL_LANES;
+        uint32_t groups = 0;
+        while(pending)
+        {
+            const uint32_t leader = __builtin_ctz(pending);
+            const uint16_t leader_PC = lockstep->PC[leader];
+            const uint16_t opcode = (lockstep->ram[leader][leader_PC & 0xFFF] << 8) | lockstep->ram[leader][(leader_PC + 1) & 0xFFF];
+
+            const lane_u8_t same_PC = (lane_u8_t) __builtin_convertvector((lane_s16_t) (lockstep->PC == leader_PC), lane_s8_t);
+            uint32_t group = mask_to_lanes(&same_PC) & pending;
+
+            // Lanes whose RAM differs may hold different code at the same address
+            if(lockstep->written)
+            {
+                const uint32_t check = (lockstep->written >> leader) & 1 ? group : group & lockstep->written;
+                FOR_EACH_LANE(check, lane)
+                {
+                    const uint16_t lane_opcode = (lockstep->ram[lane][leader_PC & 0xFFF] << 8) |
+                                                 lockstep->ram[lane][(leader_PC + 1) & 0xFFF];
+                    if(lane_opcode != opcode) group &= ~(1u << lane);
+                }
+            }
+
+            lane_u8_t m8;
+            lanes_to_mask(group, &m8);
+            const lane_u16_t m16 = (lane_u16_t) __builtin_convertvector((lane_s8_t) m8, lane_s16_t);
+            execute(lockstep, opcode, group, &m8, &m16);
+            pending &= ~group;
+            groups++;
+        }
+        lockstep->diverged = groups > LOCKSTEP_MAX_GROUPS;
+    }
+}
+
+// Same as update_timers() for every lane
+LOCKSTEP_TARGETS
+void lockstep_update_timers(lockstep_t *lockstep)
+{
+    // Comparisons give -1 in true lanes, so adding them decrements every non-zero timer
+    lockstep->delay_timer += (lane_u8_t) (lockstep->delay_timer != 0);
+    lockstep->sound_timer += (lane_u8_t) (lockstep->sound_timer != 0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+#include "decode.h"
+
+// The lockstep engine is written with GCC/clang vector extensions, which compile to AVX2 or SSE2
+// on x86-64 and to NEON or plain scalar code elsewhere
+#if !defined(__GNUC__) && !defined(__clang__)
+    #error "lockstep.c needs GCC or clang vector extensions"
+#endif
+
+#define LOCKSTEP_LANES 32   // Machines per lockstep_t, one AVX2 register of 8 bit registers
+
+typedef uint8_t lane_u8_t __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t lane_u16_t __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+
+// Lockstep Machine Object: LOCKSTEP_LANES CHIP8 machines in structure-of-arrays form, so
+// lanes running the same instruction update their registers with single vector operations.
+// Contains vector members, allocate it statically or with aligned_alloc(64, ...).
+typedef struct {
+    lane_u8_t V[16];                                        // V[register][lane]
+    lane_u16_t I;
+    lane_u16_t PC;
+    lane_u8_t delay_timer;
+    lane_u8_t sound_timer;
+    lane_u8_t depth;                                        // Subroutine stack depth
+    uint16_t stack[LOCKSTEP_LANES][16];                     // 12 used, padded so a runaway depth can't reach the next lane
+    uint16_t keypad[LOCKSTEP_LANES];                        // Bit per held key 0x0 - 0xF
+    uint32_t rng_state[LOCKSTEP_LANES];                     // CXNN xorshift32 state, never 0
+    uint64_t dirty_rows[LOCKSTEP_LANES];                    // Same as chip8_t.dirty_rows
+    uint32_t written;                                       // Lanes whose RAM differs from lane 0's
+    uint16_t written_start, written_end;                    // RAM the lanes wrote since it last all matched, empty if start >= end
+    bool diverged;                                          // Lanes run one by one until their PCs meet again, see lockstep_run()
+    uint64_t display[LOCKSTEP_LANES][CHIP8_DISPLAY_HEIGHT];
+    uint8_t ram[LOCKSTEP_LANES][CHIP8_RAM_SIZE];
+    decoded_t decoded[CHIP8_RAM_SIZE];                      // Code decoded by lanes running on their own, shared since it lies outside the written range
+    uint64_t decoded_bitmap[CHIP8_RAM_SIZE / 64];           // Bit per RAM byte read by a decoded instruction, lets data writes skip invalidation
+    bool decoding;                                          // Whether anything was decoded, spares lanes that never ran apart the bitmap
+} lockstep_t;
+
+void lockstep_init(lockstep_t *lockstep, const chip8_t *chip8);
+void lockstep_seed(lockstep_t *lockstep, const uint8_t lane, const uint32_t seed);
+void lockstep_load_lane(const lockstep_t *lockstep, const uint8_t lane, chip8_t *chip8);
+void lockstep_store_lane(lockstep_t *lockstep, const uint8_t lane, const chip8_t *chip8);
+void lockstep_run(lockstep_t *lockstep, uint32_t cycles);
+void lockstep_update_timers(lockstep_t *lockstep);
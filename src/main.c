@@ -2,13 +2,16 @@
 #include "sdl_config.h"
 #include "chip8.h"
 #include "emulator.h"
+#include "pipeline.h"
+#include "movie.h"
+#include "profile.h"
 
 int main(int argc, char** argv) 
 {
     // Default usage message for args
     if(argc < 2)
     {
-        fprintf(stderr, "Usage: %s <rom_path>", argv[0]);
+        fprintf(stderr, "Usage: %s <rom_path> [--speed <multiplier>] [--turbo] [--rewind <seconds>] [--record <movie_path>] [--quirks <profile>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -18,49 +21,61 @@ int main(int argc, char** argv)
     
     // Initialize SDL
     sdl_t sdl = {0};
-    if(!init_sdl(&sdl, &config)) exit(EXIT_FAILURE);
+    audio_t audio;
+    if(!init_sdl(&sdl, &config, &audio)) exit(EXIT_FAILURE);
 
-    // Initialize CHIP8 machine
-    chip8_t chip8 = {0};
+    // Initialize CHIP8 machine, with as much RAM as the quirk profile needs
+    chip8_t *chip8 = chip8_create(chip8_ram_size(config.quirk_profile));
     const char* rom_name = argv[1];
-    if(!init_chip8(&chip8, rom_name)) exit(EXIT_FAILURE);
+    if(!chip8 || !init_chip8(chip8, rom_name)) exit(EXIT_FAILURE);
 
     // Initial Screen Clear
     clear_screen(sdl, config);
 
-    // Set seed for rand()
-    srand(time(NULL));
+    // Seed CXNN's random numbers
+    const uint32_t seed = time(NULL);
+    chip8_seed(chip8, seed);
 
-    // Emulator loop
-    while (chip8.state != QUIT)
-    {
-        // Handle user input
-        handle_input(&chip8);
+    // A movie holds the seed and every frame's input, chip8_replay reproduces the run from it
+    uint8_t *base_ram = malloc(chip8->ram_size);
+    if(!base_ram) exit(EXIT_FAILURE);
+    memcpy(base_ram, chip8->ram, chip8->ram_size);
+    movie_t movie;
+    movie_init(&movie, seed, config.quirk_profile);
 
-        if(chip8.state == PAUSED) continue;
+    // Emulation runs on its own thread from here on, this thread only handles input and rendering
+    pipeline_t pipeline;
+    if(!pipeline_start(&pipeline, chip8, &config, &audio, config.movie_path ? &movie : NULL)) exit(EXIT_FAILURE);
 
-        // get_time()
-        const uint64_t start = SDL_GetPerformanceCounter();
+    input_t input = {.state = chip8->state};
 
-        // Emulate CHIP8 Instructions for this Emulator "Frame"
-        // Number of instructions per frame = number of instructions per second / frame rate
-        for(uint32_t i = 0; i < (config.instructions_per_second) / 60; i++)
+    // Render loop
+    while (input.state != QUIT)
+    {
+        // Handle user input
+        handle_input(&input);
+        pipeline_set_input(&pipeline, &input);
+        input.dump_profile = false;
+
+        // Update the screen with changes, presentation waits for vsync
+        bool fresh;
+        const frame_t *frame = pipeline_acquire_frame(&pipeline, &fresh);
+        if(fresh || input.redraw)
         {
-            emulate_instruction(&chip8, config);
+            update_screen(sdl, config, frame->display, frame->hires, input.redraw ? ~0ull : frame->dirty_rows);
+            input.redraw = false;
+        } else {
+            SDL_Delay(1); // Nothing new to show
         }
+    }
 
-        // time elapsed since get_time()
-        const uint64_t end = SDL_GetPerformanceCounter();
-        
-        // Delay for 60fps (approximatley)
-        const uint64_t time_elapsed = (double) ((end - start) * 1000) / (SDL_GetPerformanceCounter());
-        // SDL_Delay(16 - time elapsed)
-        SDL_Delay(16.67f > time_elapsed ? 16.67f - time_elapsed : 0);
+    pipeline_stop(&pipeline);
+    PROFILE_DUMP();
 
-        // Update the screen with changes
-        update_screen(sdl, config, chip8);
-        update_timers(sdl, &chip8);
-    }
+    if(config.movie_path) movie_save(&movie, base_ram, config.movie_path);
+    movie_free(&movie);
+    free(base_ram);
+    chip8_destroy(chip8);
 
     // Cleanup and Exit
     final_cleanup(sdl);
@@ -0,0 +1,242 @@
+#include "movie.h"
+#include "emulator.h"
+#include "bytes.h"
+
+static const char magic[4] = {'C', '8', 'M', 'V'};
+
+// Start an empty recording for a machine seeded with `seed`, running with `quirk_profile`
+void movie_init(movie_t *movie, const uint32_t seed, const chip8_quirk_profile_t quirk_profile)
+{
+    *movie = (movie_t) {.seed = seed, .quirk_profile = quirk_profile};
+}
+
+void movie_free(movie_t *movie)
+{
+    free(movie->frames);
+    free(movie->events);
+    movie_init(movie, movie->seed, movie->quirk_profile);
+}
+
+// Append one frame, called after update_timers() with the keypad the frame ran with and its
+// instruction count. Keypad changes become events. Returns false if out of memory.
+bool movie_record(movie_t *movie, const chip8_t *chip8, const uint16_t keypad, const uint32_t cycles)
+{
+    const uint16_t previous = movie->num_events ? movie->events[movie->num_events - 1].keypad : 0;
+    if(keypad != previous)
+    {
+        if(movie->num_events == movie->event_capacity)
+        {
+            const uint32_t capacity = movie->event_capacity ? movie->event_capacity * 2 : 256;
+            movie_event_t *events = realloc(movie->events, capacity * sizeof *events);
+            if(!events) return false;
+            movie->events = events;
+            movie->event_capacity = capacity;
+        }
+        movie->events[movie->num_events++] = (movie_event_t) {
+            .frame = movie->num_frames,
+            .cycle = movie->cycles,
+            .keypad = keypad,
+        };
+    }
+
+    if(movie->num_frames == movie->frame_capacity)
+    {
+        const uint32_t capacity = movie->frame_capacity ? movie->frame_capacity * 2 : 4096;
+        movie_frame_t *frames = realloc(movie->frames, capacity * sizeof *frames);
+        if(!frames) return false;
+        movie->frames = frames;
+        movie->frame_capacity = capacity;
+    }
+    movie->frames[movie->num_frames++] = (movie_frame_t) {.cycles = cycles, .hash = chip8_hash(chip8)};
+    movie->cycles += cycles;
+    return true;
+}
+
+// Forget every frame from `num_frames` on, e.g. after rewinding
+void movie_truncate(movie_t *movie, const uint32_t num_frames)
+{
+    while(movie->num_frames > num_frames)
+    {
+        movie->cycles -= movie->frames[--movie->num_frames].cycles;
+    }
+    while(movie->num_events > 0 && movie->events[movie->num_events - 1].frame >= num_frames)
+    {
+        movie->num_events--;
+    }
+}
+
+// Write the movie to a file, `base_ram` is the RAM right after the ROM was loaded
+bool movie_save(const movie_t *movie, const uint8_t base_ram[], const char path[])
+{
+    FILE *file = fopen(path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not open movie %s for writing\n", path);
+        return false;
+    }
+
+    uint8_t header[MOVIE_HEADER_SIZE] = {0};
+    memcpy(&header[0], magic, sizeof magic);
+    put_u16(&header[4], MOVIE_VERSION);
+    put_u16(&header[6], MOVIE_HEADER_SIZE);
+    put_u64(&header[8], chip8_hash_ram(base_ram, chip8_ram_size(movie->quirk_profile)));
+    put_u32(&header[16], movie->seed);
+    put_u32(&header[20], movie->num_frames);
+    put_u32(&header[24], movie->num_events);
+    put_u32(&header[28], movie->quirk_profile);
+    bool ok = fwrite(header, sizeof header, 1, file) == 1;
+
+    for(uint32_t i = 0; ok && i < movie->num_frames; i++)
+    {
+        uint8_t record[MOVIE_FRAME_SIZE];
+        put_u32(&record[0], movie->frames[i].cycles);
+        put_u64(&record[4], movie->frames[i].hash);
+        ok = fwrite(record, sizeof record, 1, file) == 1;
+    }
+    for(uint32_t i = 0; ok && i < movie->num_events; i++)
+    {
+        uint8_t record[MOVIE_EVENT_SIZE];
+        put_u32(&record[0], movie->events[i].frame);
+        put_u64(&record[4], movie->events[i].cycle);
+        put_u16(&record[12], movie->events[i].keypad);
+        ok = fwrite(record, sizeof record, 1, file) == 1;
+    }
+
+    if(fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "Could not write movie %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Read a movie. Its quirk profile tells how large a machine to load the ROM into before
+// checking it with movie_matches_rom().
+bool movie_load(movie_t *movie, const char path[])
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Movie %s is invalid or does not exist\n", path);
+        return false;
+    }
+
+    uint8_t header[MOVIE_HEADER_SIZE];
+    if(fread(header, sizeof header, 1, file) != 1 || memcmp(header, magic, sizeof magic) != 0 ||
+       get_u16(&header[4]) != MOVIE_VERSION || get_u16(&header[6]) != MOVIE_HEADER_SIZE)
+    {
+        fprintf(stderr, "%s is not a supported CHIP8 movie\n", path);
+        fclose(file);
+        return false;
+    }
+    if(get_u32(&header[28]) >= CHIP8_QUIRKS_COUNT)
+    {
+        fprintf(stderr, "Movie %s uses an unknown quirk profile\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // The records must fit in what is left of the file, checked before anything is allocated for them
+    const uint32_t num_frames = get_u32(&header[20]);
+    const uint32_t num_events = get_u32(&header[24]);
+    const long records_start = ftell(file);
+    const long file_size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if(records_start < 0 || file_size < records_start || fseek(file, records_start, SEEK_SET) != 0 ||
+       (uint64_t) num_frames * MOVIE_FRAME_SIZE + (uint64_t) num_events * MOVIE_EVENT_SIZE > (uint64_t) (file_size - records_start))
+    {
+        fprintf(stderr, "Movie %s is truncated or corrupt\n", path);
+        fclose(file);
+        return false;
+    }
+
+    movie_init(movie, get_u32(&header[16]), get_u32(&header[28]));
+    movie->rom_hash = get_u64(&header[8]);
+    movie->frames = malloc((num_frames ? num_frames : 1) * sizeof *movie->frames);
+    movie->events = malloc((num_events ? num_events : 1) * sizeof *movie->events);
+    bool ok = movie->frames && movie->events;
+    movie->frame_capacity = num_frames;
+    movie->event_capacity = num_events;
+
+    for(; ok && movie->num_frames < num_frames; movie->num_frames++)
+    {
+        uint8_t record[MOVIE_FRAME_SIZE];
+        ok = fread(record, sizeof record, 1, file) == 1;
+        movie->frames[movie->num_frames] = (movie_frame_t) {.cycles = get_u32(&record[0]), .hash = get_u64(&record[4])};
+        movie->cycles += movie->frames[movie->num_frames].cycles;
+    }
+    for(; ok && movie->num_events < num_events; movie->num_events++)
+    {
+        uint8_t record[MOVIE_EVENT_SIZE];
+        ok = fread(record, sizeof record, 1, file) == 1;
+        movie->events[movie->num_events] = (movie_event_t) {
+            .frame = get_u32(&record[0]),
+            .cycle = get_u64(&record[4]),
+            .keypad = get_u16(&record[12]),
+        };
+    }
+    fclose(file);
+
+    // Events must come in frame order, at most one per frame, for replay to find them
+    for(uint32_t i = 0; ok && i < movie->num_events; i++)
+    {
+        ok = movie->events[i].frame < num_frames && (i == 0 || movie->events[i].frame > movie->events[i - 1].frame);
+    }
+
+    if(!ok)
+    {
+        fprintf(stderr, "Movie %s is truncated or corrupt\n", path);
+        movie_free(movie);
+        return false;
+    }
+    return true;
+}
+
+// Whether the movie was recorded with the ROM whose freshly loaded RAM is `base_ram`
+bool movie_matches_rom(const movie_t *movie, const uint8_t base_ram[])
+{
+    return chip8_hash_ram(base_ram, chip8_ram_size(movie->quirk_profile)) == movie->rom_hash;
+}
+
+// Play the movie back on a freshly initialized machine as fast as possible, checking the state
+// after every frame. On a mismatch returns false with the first diverging frame in `mismatch`.
+// The machine must have the RAM size of the movie's quirk profile.
+bool movie_replay(const movie_t *movie, chip8_t *chip8, uint32_t *mismatch)
+{
+    if(chip8->ram_size != chip8_ram_size(movie->quirk_profile))
+    {
+        *mismatch = 0;
+        return false;
+    }
+
+    const chip8_run_t run = chip8_runner(movie->quirk_profile);
+    chip8_seed(chip8, movie->seed);
+
+    uint64_t cycle = 0;
+    uint32_t event = 0;
+    for(uint32_t frame = 0; frame < movie->num_frames; frame++)
+    {
+        for(; event < movie->num_events && movie->events[event].frame == frame; event++)
+        {
+            chip8->keypad = movie->events[event].keypad;
+
+            // The frame counts and the instruction counts must tell the same story
+            if(movie->events[event].cycle != cycle)
+            {
+                *mismatch = frame;
+                return false;
+            }
+        }
+
+        run(chip8, movie->frames[frame].cycles);
+        update_timers(chip8);
+        cycle += movie->frames[frame].cycles;
+
+        if(chip8_hash(chip8) != movie->frames[frame].hash)
+        {
+            *mismatch = frame;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// Movie Format, all fields little-endian:
+//     0   char[4]   magic "C8MV"
+//     4   uint16    version
+//     6   uint16    header size, offset of the first frame
+//     8   uint64    FNV-1a hash of the RAM right after the ROM was loaded, as large as the
+//                   quirk profile needs
+//     16  uint32    CXNN seed
+//     20  uint32    number of frames
+//     24  uint32    number of input events
+//     28  uint32    quirk profile, chip8_quirk_profile_t
+//     32  frames:   uint32 instructions run, uint64 chip8_hash() after update_timers()
+//     ... events:   uint32 frame, uint64 instructions run before it, uint16 keypad from then on
+#define MOVIE_VERSION      1
+#define MOVIE_HEADER_SIZE  32
+#define MOVIE_FRAME_SIZE   12
+#define MOVIE_EVENT_SIZE   14
+
+// One recorded 60Hz frame
+typedef struct {
+    uint32_t cycles;    // Instructions run in the frame
+    uint64_t hash;      // Machine state at the end of the frame
+} movie_frame_t;
+
+// Keypad change, applied before its frame runs
+typedef struct {
+    uint32_t frame;
+    uint64_t cycle;     // Instructions run by all earlier frames
+    uint16_t keypad;    // Bit per held key
+} movie_event_t;
+
+// Movie Object: everything needed to reproduce a run from power-on
+typedef struct {
+    uint32_t seed;
+    chip8_quirk_profile_t quirk_profile;
+    uint64_t rom_hash;  // chip8_hash_ram() of the freshly loaded ROM, set by movie_load()
+    movie_frame_t *frames;
+    uint32_t num_frames, frame_capacity;
+    movie_event_t *events;
+    uint32_t num_events, event_capacity;
+    uint64_t cycles;    // Instructions run by all recorded frames
+} movie_t;
+
+void movie_init(movie_t *movie, const uint32_t seed, const chip8_quirk_profile_t quirk_profile);
+void movie_free(movie_t *movie);
+bool movie_record(movie_t *movie, const chip8_t *chip8, const uint16_t keypad, const uint32_t cycles);
+void movie_truncate(movie_t *movie, const uint32_t num_frames);
+bool movie_save(const movie_t *movie, const uint8_t base_ram[], const char path[]);
+bool movie_load(movie_t *movie, const char path[]);
+bool movie_matches_rom(const movie_t *movie, const uint8_t base_ram[]);
+bool movie_replay(const movie_t *movie, chip8_t *chip8, uint32_t *mismatch);
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+#include "emulator.h"
+#include "decode.h"
+
+// Instruction handlers shared by the cached execution engines (decode cache, block cache).
+// The PC has already been advanced past the instruction when a handler runs.
+// Semantics must match emulate_instruction() exactly.
+// FX33/FX55 only write RAM, invalidating translated code is left to the calling engine.
+#define OP_HANDLER(name) static inline void op_##name(chip8_t *chip8, const decoded_t *d)
+
+OP_HANDLER(NOP) { (void) chip8; (void) d; }
+
+OP_HANDLER(00E0)
+{
+    (void) d;
+    memset(chip8->display[0], 0, sizeof chip8->display[0]);
+    chip8->dirty_rows = ~0ull;
+}
+OP_HANDLER(00EE) { (void) d; chip8->PC = chip8->stack[--chip8->SP & 15]; }
+OP_HANDLER(1NNN) { chip8->PC = d->NNN; }
+OP_HANDLER(2NNN) { chip8->stack[chip8->SP++ & 15] = chip8->PC; chip8->PC = d->NNN; }
+OP_HANDLER(3XNN) { if(chip8->V[d->X] == d->NN) chip8->PC += 2; }
+OP_HANDLER(4XNN) { if(chip8->V[d->X] != d->NN) chip8->PC += 2; }
+OP_HANDLER(5XY0) { if(chip8->V[d->X] == chip8->V[d->Y]) chip8->PC += 2; }
+OP_HANDLER(6XNN) { chip8->V[d->X] = d->NN; }
+OP_HANDLER(7XNN) { chip8->V[d->X] += d->NN; }
+
+OP_HANDLER(8XY0) { chip8->V[d->X] = chip8->V[d->Y]; }
+OP_HANDLER(8XY1) { chip8->V[d->X] |= chip8->V[d->Y]; }
+OP_HANDLER(8XY2) { chip8->V[d->X] &= chip8->V[d->Y]; }
+OP_HANDLER(8XY3) { chip8->V[d->X] ^= chip8->V[d->Y]; }
+
+OP_HANDLER(8XY4)
+{
+    const bool carry = (chip8->V[d->X] + chip8->V[d->Y]) > 255;
+    chip8->V[d->X] += chip8->V[d->Y];
+    chip8->V[0xF] = carry;
+}
+
+OP_HANDLER(8XY5)
+{
+    const bool carry = chip8->V[d->Y] <= chip8->V[d->X]; // No underflow
+    chip8->V[d->X] -= chip8->V[d->Y];
+    chip8->V[0xF] = carry;
+}
+
+OP_HANDLER(8XY6)
+{
+    const bool carry = chip8->V[d->X] & 1;
+    chip8->V[d->X] >>= 1;
+    chip8->V[0xF] = carry;
+}
+
+OP_HANDLER(8XY7)
+{
+    const bool carry = chip8->V[d->X] <= chip8->V[d->Y]; // No underflow
+    chip8->V[d->X] = chip8->V[d->Y] - chip8->V[d->X];
+    chip8->V[0xF] = carry;
+}
+
+OP_HANDLER(8XYE)
+{
+    const bool carry = chip8->V[d->X] >> 7;
+    chip8->V[0xF] = carry;
+    chip8->V[d->X] <<= 1;
+}
+
+OP_HANDLER(9XY0) { if(chip8->V[d->X] != chip8->V[d->Y]) chip8->PC += 2; }
+OP_HANDLER(ANNN) { chip8->I = d->NNN; }
+OP_HANDLER(BNNN) { chip8->PC = chip8->V[0] + d->NNN; }
+OP_HANDLER(CXNN) { chip8->V[d->X] = chip8_random(chip8) & d->NN; }
+// Plain CHIP8 draw_sprite(), inlined: 8 pixel wide rows clipped at the right and bottom edges,
+// low resolution rows live in the top 64 bits of chip8_row_t
+OP_HANDLER(DXYN)
+{
+    const uint8_t X_coord = chip8->V[d->X] % CHIP8_DISPLAY_WIDTH;
+    const uint8_t Y_coord = chip8->V[d->Y] % CHIP8_DISPLAY_HEIGHT;
+    const uint8_t rows = Y_coord + d->N <= CHIP8_DISPLAY_HEIGHT ? d->N : CHIP8_DISPLAY_HEIGHT - Y_coord;
+    const uint16_t I = chip8->I;
+    uint64_t collision = 0;
+    uint64_t dirty = 0;
+
+    for(uint8_t i = 0; i < rows; i++)
+    {
+        const uint64_t sprite_row = ((uint64_t) chip8->ram[(I + i) & 0xFFF] << 56) >> X_coord;
+        chip8_row_t *display_row = &chip8->display[0][Y_coord + i];
+
+        collision |= (uint64_t) (*display_row >> 64) & sprite_row;
+        *display_row ^= (chip8_row_t) sprite_row << 64;
+        dirty |= (uint64_t) (sprite_row != 0) << (Y_coord + i);
+    }
+
+    chip8->dirty_rows |= dirty;
+    chip8->V[0xF] = collision != 0;
+}
+OP_HANDLER(EX9E) { if(chip8_key_down(chip8, chip8->V[d->X])) chip8->PC += 2; }
+OP_HANDLER(EXA1) { if(!chip8_key_down(chip8, chip8->V[d->X])) chip8->PC += 2; }
+
+OP_HANDLER(FX0A)
+{
+    if(chip8->keypad)
+    {
+        chip8->V[d->X] = __builtin_ctz(chip8->keypad); // Lowest held key
+        return;
+    }
+    chip8->PC -= 2; // Repeat this instruction
+}
+
+OP_HANDLER(FX07) { chip8->V[d->X] = chip8->delay_timer; }
+OP_HANDLER(FX15) { chip8->delay_timer = chip8->V[d->X]; }
+OP_HANDLER(FX18) { chip8->sound_timer = chip8->V[d->X]; }
+OP_HANDLER(FX1E) { chip8->I += chip8->V[d->X]; }
+OP_HANDLER(FX29) { chip8->I = chip8->V[d->X] * 5; }
+
+OP_HANDLER(FX33)
+{
+    const uint16_t I = chip8->I;
+    uint8_t bcd = chip8->V[d->X];
+    chip8->ram[(I + 2) & 0xFFF] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[(I + 1) & 0xFFF] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[I & 0xFFF] = bcd;
+}
+
+// Copy bytes 0 - `last` of `from` over `to`, as two 64 bit blends of all 16 bytes
+static inline void merge_16(uint8_t *to, const uint8_t *from, const uint8_t last)
+{
+    static const uint8_t ones[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    };
+    uint64_t mask[2], old[2], new[2];
+    memcpy(mask, &ones[15 - last], sizeof mask);
+    memcpy(old, to, sizeof old);
+    memcpy(new, from, sizeof new);
+    old[0] = (old[0] & ~mask[0]) | (new[0] & mask[0]);
+    old[1] = (old[1] & ~mask[1]) | (new[1] & mask[1]);
+    memcpy(to, old, sizeof old);
+}
+
+// FX55/FX65 move V0 - VX with one 16 byte merge unless that would run past the end of RAM
+OP_HANDLER(FX55)
+{
+    const uint16_t I = chip8->I & 0xFFF;
+    if(I + 16 <= 0x1000)
+    {
+        merge_16(&chip8->ram[I], chip8->V, d->X);
+        return;
+    }
+    for(uint8_t i = 0; i <= d->X; i++)
+    {
+        chip8->ram[(I + i) & 0xFFF] = chip8->V[i];
+    }
+}
+
+OP_HANDLER(FX65)
+{
+    const uint16_t I = chip8->I & 0xFFF;
+    if(I + 16 <= 0x1000)
+    {
+        merge_16(chip8->V, &chip8->ram[I], d->X);
+        return;
+    }
+    for(uint8_t i = 0; i <= d->X; i++)
+    {
+        chip8->V[i] = chip8->ram[(I + i) & 0xFFF];
+    }
+}
+
+#undef OP_HANDLER
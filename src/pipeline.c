@@ -0,0 +1,172 @@
+#include "pipeline.h"
+#include "emulator.h"
+#include "scheduler.h"
+#include "profile.h"
+
+// Copy the machine's display into the write frame and swap it into `latest`
+static void publish_frame(triple_buffer_t *buffer, chip8_t *chip8)
+{
+    frame_t *frame = &buffer->frames[buffer->write_index];
+    const uint64_t dirty_rows = chip8->dirty_rows;
+    memcpy(frame->display, chip8->display, sizeof frame->display);
+    frame->hires = chip8->hires;
+    const uint64_t published_rows = dirty_rows | buffer->carry_rows;
+    frame->dirty_rows = published_rows;
+    chip8->dirty_rows = 0;
+
+    const int previous = SDL_AtomicSet(&buffer->latest, buffer->write_index | PIPELINE_FRESH);
+    buffer->write_index = previous & 3;
+
+    // If the previous frame was never shown, the render thread is still on an older one and the
+    // next frame has to redraw everything this one does. Otherwise it only has to cover this frame.
+    buffer->carry_rows = (previous & PIPELINE_FRESH) ? published_rows : dirty_rows;
+}
+
+// Emulation thread: runs the CHIP8 at its scheduled 60 Hz ticks, publishes frames that changed and tone edges
+static int emulation_thread(void *data)
+{
+    pipeline_t *pipeline = data;
+    chip8_t *chip8 = pipeline->chip8;
+    const config_t *config = pipeline->config;
+    const chip8_run_t run = chip8_runner(config->quirk_profile);
+    bool sound_was_on = false;
+    audio_tone_t tone = audio_tone(chip8);  // Last tone handed to the audio callback
+
+    scheduler_t scheduler;
+    scheduler_init(&scheduler, SDL_GetPerformanceFrequency(), SDL_GetPerformanceCounter(),
+                   config->speed_percent, config->turbo);
+
+    while((chip8->state = SDL_AtomicGet(&pipeline->state)) != QUIT)
+    {
+        // The profile is dumped from this thread, which is the only one updating it
+        if(SDL_AtomicSet(&pipeline->profile, 0)) PROFILE_DUMP();
+
+        if(chip8->state == PAUSED)
+        {
+            // Silence the tone while paused, the next tick restarts it if the timer is still running
+            if(sound_was_on && audio_push(pipeline->audio, false, &tone, SDL_GetPerformanceCounter())) sound_was_on = false;
+
+            // Idle without spinning, and don't try to catch up on the paused time afterwards
+            SDL_Delay(16);
+            scheduler_resync(&scheduler, SDL_GetPerformanceCounter());
+            continue;
+        }
+
+        // Rewinding replaces emulation, stepping back one recorded frame per real 60Hz frame
+        // whatever the speed setting
+        if(SDL_AtomicGet(&pipeline->rewinding))
+        {
+            if(sound_was_on && audio_push(pipeline->audio, false, &tone, SDL_GetPerformanceCounter())) sound_was_on = false;
+            if(rewind_step_back(&pipeline->rewind, chip8))
+            {
+                if(pipeline->movie) movie_truncate(pipeline->movie, pipeline->movie->num_frames - 1);
+                publish_frame(&pipeline->frames, chip8);
+            }
+
+            SDL_Delay(16);
+            scheduler_resync(&scheduler, SDL_GetPerformanceCounter());
+            continue;
+        }
+
+        const uint16_t keypad = SDL_AtomicGet(&pipeline->keypad);
+        chip8->keypad = keypad;
+
+        // Emulate CHIP8 Instructions for this Emulator "Frame"
+        const uint32_t cycles = scheduler_cycles(&scheduler, config->instructions_per_second);
+        run(chip8, cycles);
+        update_timers(chip8);
+        rewind_capture(&pipeline->rewind, chip8);
+
+        if(pipeline->movie && !movie_record(pipeline->movie, chip8, keypad, cycles))
+        {
+            SDL_Log("Out of memory recording the movie, recording stopped\n");
+            pipeline->movie = NULL;
+        }
+
+        // Tone edges go straight to the audio callback, timestamped so they play sample accurately.
+        // So do XO-CHIP pattern and pitch changes while the tone plays.
+        const bool sound_is_on = chip8->sound_timer > 0;
+        const audio_tone_t next_tone = audio_tone(chip8);
+        const bool tone_changed = sound_is_on && memcmp(&next_tone, &tone, sizeof tone) != 0;
+        if((sound_is_on != sound_was_on || tone_changed) &&
+           audio_push(pipeline->audio, sound_is_on, &next_tone, SDL_GetPerformanceCounter()))
+        {
+            sound_was_on = sound_is_on;
+            tone = next_tone;
+        }
+
+        // Only frames that changed something visible are handed over
+        if(chip8->dirty_rows && scheduler_present_due(&scheduler, SDL_GetPerformanceCounter()))
+        {
+            publish_frame(&pipeline->frames, chip8);
+        }
+
+        wait_until(scheduler_next_tick(&scheduler, SDL_GetPerformanceCounter()));
+    }
+
+    return 0;
+}
+
+// Hand the machine over to a new emulation thread
+bool pipeline_start(pipeline_t *pipeline, chip8_t *chip8, const config_t *config, audio_t *audio, movie_t *movie)
+{
+    *pipeline = (pipeline_t) {
+        .chip8 = chip8,
+        .config = config,
+        .audio = audio,
+        .movie = movie,
+        .frames = {.write_index = 0, .read_index = 2},
+    };
+    SDL_AtomicSet(&pipeline->frames.latest, 1);
+    SDL_AtomicSet(&pipeline->keypad, 0);
+    SDL_AtomicSet(&pipeline->state, chip8->state);
+    SDL_AtomicSet(&pipeline->rewinding, 0);
+    SDL_AtomicSet(&pipeline->profile, 0);
+
+    // Without rewind the buffer stays unallocated and capturing does nothing
+    if(config->rewind_seconds && !rewind_init(&pipeline->rewind, config->rewind_seconds, chip8->ram_size)) return false;
+
+    pipeline->thread = SDL_CreateThread(emulation_thread, "chip8", pipeline);
+    if(!pipeline->thread)
+    {
+        SDL_Log("Could not create emulation thread, %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+// Ask the emulation thread to quit and wait for it, the machine belongs to the caller again afterwards
+void pipeline_stop(pipeline_t *pipeline)
+{
+    if(!pipeline->thread) return;
+
+    SDL_AtomicSet(&pipeline->state, QUIT);
+    SDL_WaitThread(pipeline->thread, NULL);
+    pipeline->thread = NULL;
+    rewind_free(&pipeline->rewind);
+}
+
+// Forward the render thread's input to the emulation thread
+void pipeline_set_input(pipeline_t *pipeline, const input_t *input)
+{
+    SDL_AtomicSet(&pipeline->keypad, input->keypad);
+    SDL_AtomicSet(&pipeline->state, input->state);
+    SDL_AtomicSet(&pipeline->rewinding, input->rewind);
+    if(input->dump_profile) SDL_AtomicSet(&pipeline->profile, 1);
+}
+
+// Take the newest published frame if there is one, `fresh` tells whether it wasn't seen before.
+// The returned frame stays valid until the next call.
+const frame_t *pipeline_acquire_frame(pipeline_t *pipeline, bool *fresh)
+{
+    triple_buffer_t *buffer = &pipeline->frames;
+
+    *fresh = SDL_AtomicGet(&buffer->latest) & PIPELINE_FRESH;
+    if(*fresh)
+    {
+        buffer->read_index = SDL_AtomicSet(&buffer->latest, buffer->read_index) & 3;
+    }
+
+    return &buffer->frames[buffer->read_index];
+}
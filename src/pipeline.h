@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+#include "sdl_config.h"
+#include "rewind.h"
+#include "movie.h"
+
+#define PIPELINE_FRESH 4    // Set in the triple buffer's `latest` index until the render thread picks it up
+
+// Completed frame handed from the emulation thread to the render thread
+typedef struct {
+    chip8_row_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT];
+    bool hires;
+    uint64_t dirty_rows;    // Rows changed since the last frame the render thread consumed
+} frame_t;
+
+// Lock-free single producer / single consumer triple buffer. Each side owns one frame,
+// the third is swapped in and out of `latest` atomically.
+typedef struct {
+    frame_t frames[3];
+    SDL_atomic_t latest;    // Index of the most recently published frame, | PIPELINE_FRESH if unread
+    int write_index;        // Emulation thread only
+    int read_index;         // Render thread only
+    uint64_t carry_rows;    // Emulation thread only: rows changed since a frame the render thread may be showing
+} triple_buffer_t;
+
+// Emulation Thread Object
+typedef struct {
+    chip8_t *chip8;         // Owned by the emulation thread while it runs
+    const config_t *config;
+    audio_t *audio;         // Receives sound timer edges
+    triple_buffer_t frames;
+    SDL_atomic_t keypad;    // Bit per held key, written by the render thread
+    SDL_atomic_t state;     // emulator_state_t requested by the render thread
+    SDL_atomic_t rewinding; // Rewind key held, written by the render thread
+    SDL_atomic_t profile;   // Profile dump requested by the render thread
+    rewind_t rewind;        // Emulation thread only, unallocated if rewind is off
+    movie_t *movie;         // Emulation thread only, records every frame, NULL if not recording
+    SDL_Thread *thread;
+} pipeline_t;
+
+bool pipeline_start(pipeline_t *pipeline, chip8_t *chip8, const config_t *config, audio_t *audio, movie_t *movie);
+void pipeline_stop(pipeline_t *pipeline);
+void pipeline_set_input(pipeline_t *pipeline, const input_t *input);
+const frame_t *pipeline_acquire_frame(pipeline_t *pipeline, bool *fresh);
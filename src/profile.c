@@ -0,0 +1,158 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+profile_t chip8_profile;
+
+// Opcode classes reported in the JSON dump, the first matching (opcode & mask) == pattern wins
+static const struct {
+    uint16_t mask;
+    uint16_t pattern;
+    const char *name;
+} classes[] = {
+    {0xFFFF, 0x00E0, "00E0"}, {0xFFFF, 0x00EE, "00EE"}, {0xF000, 0x0000, "0NNN"},
+    {0xF000, 0x1000, "1NNN"}, {0xF000, 0x2000, "2NNN"}, {0xF000, 0x3000, "3XNN"},
+    {0xF000, 0x4000, "4XNN"}, {0xF00F, 0x5000, "5XY0"}, {0xF000, 0x6000, "6XNN"},
+    {0xF000, 0x7000, "7XNN"}, {0xF00F, 0x8000, "8XY0"}, {0xF00F, 0x8001, "8XY1"},
+    {0xF00F, 0x8002, "8XY2"}, {0xF00F, 0x8003, "8XY3"}, {0xF00F, 0x8004, "8XY4"},
+    {0xF00F, 0x8005, "8XY5"}, {0xF00F, 0x8006, "8XY6"}, {0xF00F, 0x8007, "8XY7"},
+    {0xF00F, 0x800E, "8XYE"}, {0xF00F, 0x9000, "9XY0"}, {0xF000, 0xA000, "ANNN"},
+    {0xF000, 0xB000, "BNNN"}, {0xF000, 0xC000, "CXNN"}, {0xF000, 0xD000, "DXYN"},
+    {0xF0FF, 0xE09E, "EX9E"}, {0xF0FF, 0xE0A1, "EXA1"}, {0xF0FF, 0xF007, "FX07"},
+    {0xF0FF, 0xF00A, "FX0A"}, {0xF0FF, 0xF015, "FX15"}, {0xF0FF, 0xF018, "FX18"},
+    {0xF0FF, 0xF01E, "FX1E"}, {0xF0FF, 0xF029, "FX29"}, {0xF0FF, 0xF033, "FX33"},
+    {0xF0FF, 0xF055, "FX55"}, {0xF0FF, 0xF065, "FX65"}, {0x0000, 0x0000, "invalid"},
+};
+
+#define NUM_CLASSES (sizeof classes / sizeof classes[0])
+#define HOT_ADDRESSES 32
+
+// Track FX0A waits, called with whether the current FX0A found no key pressed
+void profile_key_wait(const bool blocked)
+{
+    if(blocked && !chip8_profile.key_waiting)
+    {
+        chip8_profile.key_waiting = true;
+        chip8_profile.key_wait_start = profile_now_ns();
+        chip8_profile.key_waits++;
+    } else if(!blocked && chip8_profile.key_waiting) {
+        chip8_profile.key_waiting = false;
+        chip8_profile.key_wait_ns += profile_now_ns() - chip8_profile.key_wait_start;
+    }
+}
+
+// profile_ticks() per ns, measured over a few ms
+static double ticks_per_ns(void)
+{
+    const uint64_t start_ns = profile_now_ns();
+    const uint64_t start_ticks = profile_ticks();
+    while(profile_now_ns() - start_ns < 5000000);
+    return (double) (profile_ticks() - start_ticks) / (profile_now_ns() - start_ns);
+}
+
+static void dump_json(FILE *file)
+{
+    const profile_t *p = &chip8_profile;
+    const double ns_per_draw = p->timed_draws ? p->draw_ticks / ticks_per_ns() / p->timed_draws : 0.0;
+
+    uint64_t class_counts[NUM_CLASSES] = {0};
+    uint64_t instructions = 0;
+    for(uint32_t opcode = 0; opcode < 0x10000; opcode++)
+    {
+        if(!p->opcodes[opcode]) continue;
+
+        uint32_t c = 0;
+        while((opcode & classes[c].mask) != classes[c].pattern) c++;
+        class_counts[c] += p->opcodes[opcode];
+        instructions += p->opcodes[opcode];
+    }
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"opcode_classes\": {", (unsigned long long) instructions);
+    for(uint32_t c = 0; c < NUM_CLASSES; c++)
+    {
+        fprintf(file, "%s\n    \"%s\": %llu", c ? "," : "", classes[c].name, (unsigned long long) class_counts[c]);
+    }
+
+    // Hottest addresses, repeatedly picking the largest count below the previous pick
+    fprintf(file, "\n  },\n  \"hot_addresses\": [");
+    uint64_t limit = UINT64_MAX;
+    uint32_t listed = 0;
+    while(listed < HOT_ADDRESSES)
+    {
+        uint64_t best = 0;
+        for(uint32_t pc = 0; pc < 4096; pc++)
+        {
+            if(p->addresses[pc] < limit && p->addresses[pc] > best) best = p->addresses[pc];
+        }
+        if(best == 0) break;
+
+        for(uint32_t pc = 0; pc < 4096 && listed < HOT_ADDRESSES; pc++)
+        {
+            if(p->addresses[pc] != best) continue;
+            fprintf(file, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu}", listed ? "," : "", pc, (unsigned long long) best);
+            listed++;
+        }
+        limit = best;
+    }
+
+    fprintf(file, "\n  ],\n  \"draw\": {\"count\": %llu, \"rows\": %llu, \"collisions\": %llu, "
+                  "\"collision_rate\": %.4f, \"ns\": %.0f, \"ns_per_draw\": %.1f},\n",
+            (unsigned long long) p->draws, (unsigned long long) p->draw_rows, (unsigned long long) p->draw_collisions,
+            p->draws ? (double) p->draw_collisions / p->draws : 0.0, ns_per_draw * p->draws, ns_per_draw);
+    fprintf(file, "  \"max_stack_depth\": %u,\n", p->max_depth);
+    fprintf(file, "  \"key_wait\": {\"count\": %llu, \"ns\": %llu},\n",
+            (unsigned long long) p->key_waits, (unsigned long long) p->key_wait_ns);
+
+    fprintf(file, "  \"heatmap\": [");
+    for(uint32_t pc = 0; pc < 4096; pc++)
+    {
+        fprintf(file, "%s%llu", pc % 64 ? ", " : (pc ? ",\n    " : "\n    "), (unsigned long long) p->addresses[pc]);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+// Number of significant bits, a cheap log2
+static uint32_t bit_length(uint64_t x)
+{
+    uint32_t bits = 0;
+    for(; x; x >>= 1) bits++;
+    return bits;
+}
+
+// 64x64 greyscale image, row = address / 64, log scaled so cold code still shows up
+static void dump_heatmap(FILE *file)
+{
+    uint64_t max = 0;
+    for(uint32_t pc = 0; pc < 4096; pc++)
+    {
+        if(chip8_profile.addresses[pc] > max) max = chip8_profile.addresses[pc];
+    }
+    const uint32_t max_bits = bit_length(max);
+
+    fprintf(file, "P5\n64 64\n255\n");
+    for(uint32_t pc = 0; pc < 4096; pc++)
+    {
+        const uint64_t count = chip8_profile.addresses[pc];
+        fputc(count ? 255 * bit_length(count) / max_bits : 0, file);
+    }
+}
+
+// Write the profile gathered so far to PROFILE_JSON_PATH and PROFILE_HEATMAP_PATH
+void profile_dump(void)
+{
+    FILE *json = fopen(PROFILE_JSON_PATH, "w");
+    FILE *heatmap = fopen(PROFILE_HEATMAP_PATH, "wb");
+    if(!json || !heatmap)
+    {
+        fprintf(stderr, "Could not write profile to %s and %s\n", PROFILE_JSON_PATH, PROFILE_HEATMAP_PATH);
+    } else {
+        dump_json(json);
+        dump_heatmap(heatmap);
+        printf("Profile written to %s and %s\n", PROFILE_JSON_PATH, PROFILE_HEATMAP_PATH);
+    }
+
+    if(json) fclose(json);
+    if(heatmap) fclose(heatmap);
+}
+
+#endif
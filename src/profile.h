@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// Opcode and address profiler for the reference interpreter (chip8_run() / emulate_instruction()).
+// Build with -DPROFILE to enable it. Otherwise every PROFILE_* hook expands to nothing and
+// profile.c compiles to an empty object.
+// Counters are global, so profile one machine at a time.
+#ifdef PROFILE
+
+#define PROFILE_JSON_PATH    "chip8_profile.json"
+#define PROFILE_HEATMAP_PATH "chip8_heatmap.pgm"   // 64x64 image, one pixel per RAM address
+#define PROFILE_DRAW_SAMPLE  64                    // Time one DXYN in this many, timestamps cost more than a draw
+
+typedef struct {
+    uint64_t opcodes[0x10000];  // Executions per opcode, grouped into classes when dumped
+    uint64_t addresses[4096];   // Executions per PC
+    uint64_t draws;             // DXYN executions
+    uint64_t draw_rows;         // Sprite rows actually drawn, after clipping
+    uint64_t draw_collisions;   // DXYN executions that set VF
+    uint64_t timed_draws;       // Draws that were timed, one in PROFILE_DRAW_SAMPLE
+    uint64_t draw_ticks;        // profile_ticks() spent inside the timed draws
+    uint8_t max_depth;          // Stack depth high-water mark
+    uint64_t key_waits;         // FX0A executions that had to wait for a key
+    uint64_t key_wait_ns;       // Time from the first blocked FX0A to the key press
+    uint64_t key_wait_start;
+    bool key_waiting;
+} profile_t;
+
+extern profile_t chip8_profile;
+
+static inline uint64_t profile_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Cheap timestamp for timing short sections, converted to ns when the profile is dumped
+static inline uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return profile_now_ns();
+#endif
+}
+
+void profile_key_wait(const bool blocked);
+void profile_dump(void);
+
+#define PROFILE_INSTRUCTION(PC, opcode) \
+    (chip8_profile.addresses[(PC) & 0xFFF]++, chip8_profile.opcodes[(opcode)]++)
+#define PROFILE_CALL(depth) \
+    (chip8_profile.max_depth = (depth) > chip8_profile.max_depth ? (depth) : chip8_profile.max_depth)
+#define PROFILE_DRAW_BEGIN() \
+    const bool profile_draw_timed = chip8_profile.draws % PROFILE_DRAW_SAMPLE == 0; \
+    const uint64_t profile_draw_start = profile_draw_timed ? profile_ticks() : 0
+#define PROFILE_DRAW_END(rows, collision) \
+    (chip8_profile.draws++, chip8_profile.draw_rows += (rows), chip8_profile.draw_collisions += (collision) != 0, \
+     profile_draw_timed ? (chip8_profile.timed_draws++, chip8_profile.draw_ticks += profile_ticks() - profile_draw_start) : 0)
+#define PROFILE_KEY_WAIT(blocked) profile_key_wait(blocked)
+#define PROFILE_DUMP() profile_dump()
+
+#else
+
+#define PROFILE_INSTRUCTION(PC, opcode) ((void) 0)
+#define PROFILE_CALL(depth) ((void) 0)
+#define PROFILE_DRAW_BEGIN() ((void) 0)
+#define PROFILE_DRAW_END(rows, collision) ((void) 0)
+#define PROFILE_KEY_WAIT(blocked) ((void) 0)
+#define PROFILE_DUMP() ((void) 0)
+
+#endif
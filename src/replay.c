@@ -0,0 +1,85 @@
+// Headless movie replay.
+//
+// Plays a movie recorded with `chip8 <rom> --record <movie>` back on a fresh machine at unthrottled
+// speed, checking the machine state after every frame against the recording. Exits non-zero and
+// reports the first diverging frame if the run no longer reproduces, which makes recorded movies
+// usable as regression tests and benchmarks.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_replay
+// Usage:
+//     chip8_replay [--repeat <n>] <rom_path> <movie_path>
+
+#include "common.h"
+#include "chip8.h"
+#include "emulator.h"
+#include "movie.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t repeat = 1;
+    int arg = 1;
+    if(argc > 2 && !strcmp(argv[1], "--repeat"))
+    {
+        repeat = strtoul(argv[2], NULL, 0);
+        arg = 3;
+    }
+    if(argc - arg != 2 || repeat == 0)
+    {
+        fprintf(stderr, "Usage: %s [--repeat <n>] <rom_path> <movie_path>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *rom_path = argv[arg];
+    const char *movie_path = argv[arg + 1];
+
+    movie_t movie;
+    if(!movie_load(&movie, movie_path)) exit(EXIT_FAILURE);
+
+    // The movie's quirk profile decides how much RAM the machine gets
+    const uint32_t ram_size = chip8_ram_size(movie.quirk_profile);
+    chip8_t *boot = chip8_create(ram_size);
+    chip8_t *chip8 = chip8_create(ram_size);
+    if(!boot || !chip8 || !init_chip8(boot, rom_path)) exit(EXIT_FAILURE);
+    if(!movie_matches_rom(&movie, boot->ram))
+    {
+        fprintf(stderr, "Movie %s was recorded with a different ROM\n", movie_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Every repetition starts from the same freshly loaded machine
+    uint64_t best = UINT64_MAX;
+    for(uint32_t i = 0; i < repeat; i++)
+    {
+        chip8_copy(chip8, boot);
+
+        uint32_t mismatch;
+        const uint64_t start = now_ns();
+        const bool ok = movie_replay(&movie, chip8, &mismatch);
+        const uint64_t elapsed = now_ns() - start;
+
+        if(!ok)
+        {
+            printf("%s: diverged at frame %u of %u (%.2f s into the recording)\n",
+                   movie_path, mismatch, movie.num_frames, mismatch / 60.0);
+            movie_free(&movie);
+            exit(EXIT_FAILURE);
+        }
+        if(elapsed < best) best = elapsed;
+    }
+
+    printf("%s: %u frames (%.1f s), %llu instructions, %u input events, replayed in %.3f ms (%.0fx real time)\n",
+           movie_path, movie.num_frames, movie.num_frames / 60.0, (unsigned long long) movie.cycles, movie.num_events,
+           best / 1e6, movie.num_frames / 60.0 / (best / 1e9));
+
+    movie_free(&movie);
+    chip8_destroy(chip8);
+    chip8_destroy(boot);
+    exit(EXIT_SUCCESS);
+}
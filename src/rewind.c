@@ -0,0 +1,230 @@
+#include "rewind.h"
+
+_Static_assert(sizeof(rewind_image_t) % sizeof(uint64_t) == 0, "images are XORed a word at a time");
+_Static_assert(REWIND_BUFFER_SIZE >= 4 * REWIND_KEYFRAME_INTERVAL * REWIND_MAX_ENCODED(sizeof(rewind_image_t) + CHIP8_RAM_SIZE),
+               "a full keyframe interval must always fit, deltas are never left without their keyframe");
+
+// Allocate a ring covering `seconds` of 60Hz frames of a machine with `ram_size` bytes of RAM, or
+// as many as fit in the buffer. The buffer is REWIND_BUFFER_SIZE, or larger when RAM is so large
+// that a full keyframe interval would not fit in it.
+bool rewind_init(rewind_t *rewind, const uint32_t seconds, const uint32_t ram_size)
+{
+    memset(rewind, 0, sizeof *rewind);
+    rewind->capacity = seconds * 60 > 2 * REWIND_KEYFRAME_INTERVAL ? seconds * 60 : 2 * REWIND_KEYFRAME_INTERVAL;
+    rewind->image_size = sizeof(rewind_image_t) + ram_size;
+    const uint32_t interval_size = 4 * REWIND_KEYFRAME_INTERVAL * REWIND_MAX_ENCODED(rewind->image_size);
+    rewind->buffer_size = interval_size > REWIND_BUFFER_SIZE ? interval_size : REWIND_BUFFER_SIZE;
+
+    rewind->buffer = malloc(rewind->buffer_size);
+    rewind->entries = malloc(rewind->capacity * sizeof *rewind->entries);
+    rewind->keyframe = calloc(1, rewind->image_size);
+    rewind->image = calloc(1, rewind->image_size);
+    rewind->empty = calloc(1, rewind->image_size);
+    rewind->scratch = malloc(REWIND_MAX_ENCODED(rewind->image_size));
+
+    if(!rewind->buffer || !rewind->entries || !rewind->keyframe || !rewind->image || !rewind->empty || !rewind->scratch)
+    {
+        fprintf(stderr, "Could not allocate %u seconds of rewind\n", seconds);
+        rewind_free(rewind);
+        return false;
+    }
+    return true;
+}
+
+void rewind_free(rewind_t *rewind)
+{
+    free(rewind->buffer);
+    free(rewind->entries);
+    free(rewind->keyframe);
+    free(rewind->image);
+    free(rewind->empty);
+    free(rewind->scratch);
+    rewind->buffer = NULL;
+    rewind->entries = NULL;
+    rewind->keyframe = rewind->image = rewind->empty = NULL;
+    rewind->scratch = NULL;
+    rewind->count = 0;
+}
+
+// The image must have room for the machine's RAM, any bytes past it are left zero
+static void capture_image(rewind_image_t *image, const chip8_t *chip8)
+{
+    memset(image, 0, sizeof *image); // Padding must be identical in every image
+    memcpy(image->ram, chip8->ram, chip8->ram_size);
+    memcpy(image->display, chip8->display, sizeof image->display);
+    memcpy(image->stack, chip8->stack, sizeof image->stack);
+    memcpy(image->V, chip8->V, sizeof image->V);
+    image->I = chip8->I;
+    image->PC = chip8->PC;
+    image->delay_timer = chip8->delay_timer;
+    image->sound_timer = chip8->sound_timer;
+    image->depth = chip8->SP;
+    image->hires = chip8->hires;
+    image->planes = chip8->planes;
+    image->audio_pattern_set = chip8->audio_pattern_set;
+    memcpy(image->audio_pattern, chip8->audio_pattern, sizeof image->audio_pattern);
+    image->pitch = chip8->pitch;
+    image->keypad = chip8->keypad;
+    image->rng_state = chip8->rng_state;
+}
+
+static void restore_image(chip8_t *chip8, const rewind_image_t *image)
+{
+    memcpy(chip8->ram, image->ram, chip8->ram_size);
+    memcpy(chip8->display, image->display, sizeof image->display);
+    memcpy(chip8->stack, image->stack, sizeof image->stack);
+    memcpy(chip8->V, image->V, sizeof image->V);
+    chip8->I = image->I;
+    chip8->PC = image->PC;
+    chip8->delay_timer = image->delay_timer;
+    chip8->sound_timer = image->sound_timer;
+    chip8->SP = image->depth;
+    chip8->hires = image->hires;
+    chip8->planes = image->planes;
+    chip8->audio_pattern_set = image->audio_pattern_set;
+    memcpy(chip8->audio_pattern, image->audio_pattern, sizeof image->audio_pattern);
+    chip8->pitch = image->pitch;
+    chip8->keypad = image->keypad;
+    chip8->rng_state = image->rng_state;
+    chip8->dirty_rows = ~0ull; // Every row may differ from what is on screen
+}
+
+static uint64_t image_word(const rewind_image_t *image, const uint32_t i)
+{
+    uint64_t word;
+    memcpy(&word, (const uint8_t *) image + i * sizeof word, sizeof word);
+    return word;
+}
+
+// Run-length encode the `words` words of `image` XOR `base` into `out` as tokens of (uint16 zero
+// words, uint16 literal words) followed by the literal words. Returns the encoded size.
+static uint32_t encode(const rewind_image_t *image, const rewind_image_t *base, const uint32_t words, uint8_t *out)
+{
+    uint32_t size = 0;
+    for(uint32_t i = 0; i < words; )
+    {
+        uint16_t zeros = 0, literals = 0;
+        while(i < words && image_word(image, i) == image_word(base, i))
+        {
+            zeros++;
+            i++;
+        }
+
+        uint8_t *token = &out[size];
+        size += 4;
+        while(i < words && image_word(image, i) != image_word(base, i))
+        {
+            const uint64_t delta = image_word(image, i) ^ image_word(base, i);
+            memcpy(&out[size], &delta, sizeof delta);
+            size += sizeof delta;
+            literals++;
+            i++;
+        }
+
+        memcpy(&token[0], &zeros, sizeof zeros);
+        memcpy(&token[2], &literals, sizeof literals);
+    }
+
+    return size;
+}
+
+// Inverse of encode(): `image` becomes `base` XOR the decoded delta
+static void decode(rewind_image_t *image, const rewind_image_t *base, const uint32_t words, const uint8_t *in, const uint32_t size)
+{
+    uint8_t *bytes = (uint8_t *) image;
+    memcpy(bytes, base, words * sizeof(uint64_t));
+
+    uint32_t i = 0;
+    for(uint32_t at = 0; at < size; )
+    {
+        uint16_t zeros, literals;
+        memcpy(&zeros, &in[at], sizeof zeros);
+        memcpy(&literals, &in[at + 2], sizeof literals);
+        at += 4;
+        i += zeros;
+
+        for(uint16_t n = 0; n < literals; n++, i++, at += sizeof(uint64_t))
+        {
+            uint64_t delta;
+            memcpy(&delta, &in[at], sizeof delta);
+            delta ^= image_word(image, i);
+            memcpy(&bytes[i * sizeof delta], &delta, sizeof delta);
+        }
+    }
+}
+
+static rewind_entry_t *entry(rewind_t *rewind, const uint32_t index)
+{
+    return &rewind->entries[(rewind->head + index) % rewind->capacity];
+}
+
+// Drop the oldest frame, along with the deltas that depended on it if it was a keyframe
+static void drop_oldest(rewind_t *rewind)
+{
+    do {
+        rewind->head = (rewind->head + 1) % rewind->capacity;
+        rewind->count--;
+    } while(rewind->count > 0 && !entry(rewind, 0)->keyframe);
+}
+
+// Record the machine's state at the end of a frame, called after update_timers()
+void rewind_capture(rewind_t *rewind, const chip8_t *chip8)
+{
+    if(!rewind->buffer) return;
+
+    const uint32_t words = rewind->image_size / sizeof(uint64_t);
+    capture_image(rewind->image, chip8);
+    const bool keyframe = rewind->count == 0 || rewind->since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL;
+    const uint32_t size = encode(rewind->image, keyframe ? rewind->empty : rewind->keyframe, words, rewind->scratch);
+
+    // Frames are stored back to back, wrapping to the start of the buffer when one doesn't fit
+    uint32_t offset = rewind->write_offset;
+    if(offset + size > rewind->buffer_size) offset = 0;
+
+    if(rewind->count == rewind->capacity) drop_oldest(rewind);
+    while(rewind->count > 0 && entry(rewind, 0)->offset < offset + size &&
+          entry(rewind, 0)->offset + entry(rewind, 0)->size > offset)
+    {
+        drop_oldest(rewind);
+    }
+
+    memcpy(&rewind->buffer[offset], rewind->scratch, size);
+    *entry(rewind, rewind->count++) = (rewind_entry_t) {.offset = offset, .size = size, .keyframe = keyframe};
+    rewind->write_offset = offset + size;
+
+    if(keyframe)
+    {
+        memcpy(rewind->keyframe, rewind->image, rewind->image_size);
+        rewind->since_keyframe = 0;
+    } else {
+        rewind->since_keyframe++;
+    }
+}
+
+// Discard the newest frame and restore the one before it. Returns false, leaving the machine
+// alone, once only the oldest frame is left.
+bool rewind_step_back(rewind_t *rewind, chip8_t *chip8)
+{
+    if(rewind->count < 2) return false;
+    const uint32_t words = rewind->image_size / sizeof(uint64_t);
+
+    rewind->count--;
+    const rewind_entry_t *newest = entry(rewind, rewind->count - 1);
+    rewind->write_offset = newest->offset + newest->size;
+
+    // Find and decode the newest frame's keyframe, it becomes the base of the frames captured next
+    uint32_t key = rewind->count - 1;
+    while(!entry(rewind, key)->keyframe) key--;
+    const rewind_entry_t *keyframe = entry(rewind, key);
+    decode(rewind->keyframe, rewind->empty, words, &rewind->buffer[keyframe->offset], keyframe->size);
+    rewind->since_keyframe = rewind->count - 1 - key;
+
+    if(newest->keyframe)
+    {
+        restore_image(chip8, rewind->keyframe);
+    } else {
+        decode(rewind->image, rewind->keyframe, words, &rewind->buffer[newest->offset], newest->size);
+        restore_image(chip8, rewind->image);
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+#define REWIND_KEYFRAME_INTERVAL 60                 // Frames per full keyframe, one second at 60Hz
+#define REWIND_BUFFER_SIZE       (8 * 1024 * 1024)  // Bytes of encoded frames, the oldest are dropped beyond it.
+                                                    // Grown for large RAM, see rewind_init().
+
+// Architectural state of one frame, flat so frames can be XORed a word at a time
+typedef struct {
+    chip8_row_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT];
+    uint16_t stack[16];
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t depth;
+    bool hires;
+    uint8_t planes;
+    bool audio_pattern_set;
+    uint8_t audio_pattern[CHIP8_AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    uint16_t keypad;
+    uint32_t rng_state;
+    uint8_t ram[];              // The machine's RAM, image_size covers it
+} rewind_image_t;
+
+// Worst case encoding of an image of `size` bytes: a 4 byte token per literal word
+#define REWIND_MAX_ENCODED(size) ((size) / sizeof(uint64_t) * (sizeof(uint64_t) + 4) + 4)
+
+// Location of one encoded frame in the byte ring
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    bool keyframe;
+} rewind_entry_t;
+
+// Rewind Buffer Object: a ring of per-frame states. Keyframes are stored whole, the frames in
+// between as the XOR against their keyframe, both run-length encoded over zero words.
+typedef struct {
+    uint8_t *buffer;            // buffer_size bytes of encoded frames
+    uint32_t buffer_size;
+    uint32_t write_offset;      // End of the newest frame in `buffer`
+    rewind_entry_t *entries;    // Oldest frame at `head`, always a keyframe
+    uint32_t capacity;          // Frames kept at most
+    uint32_t head;
+    uint32_t count;
+    uint32_t since_keyframe;    // Frames captured after the newest keyframe
+    uint32_t image_size;        // Bytes per image, a whole number of words
+    rewind_image_t *keyframe;   // Decoded newest keyframe, the base of new deltas
+    rewind_image_t *image;      // Scratch
+    rewind_image_t *empty;      // All zero, the base of keyframes
+    uint8_t *scratch;           // REWIND_MAX_ENCODED(image_size) bytes
+} rewind_t;
+
+bool rewind_init(rewind_t *rewind, const uint32_t seconds, const uint32_t ram_size);
+void rewind_free(rewind_t *rewind);
+void rewind_capture(rewind_t *rewind, const chip8_t *chip8);
+bool rewind_step_back(rewind_t *rewind, chip8_t *chip8);
@@ -0,0 +1,282 @@
+#include "savestate.h"
+#include "bytes.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define SAVESTATE_MMAP 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #define SAVESTATE_MMAP 0
+#endif
+
+static const char magic[4] = {'C', '8', 'S', 'T'};
+
+// Offset of the first byte at or after `i` where RAM differs from the base, `size` if none
+static size_t next_difference(const uint8_t ram[], const uint8_t base_ram[], const size_t size, size_t i)
+{
+    // Unchanged RAM is skipped 8 bytes at a time, most of it never differs from the ROM
+    for(; i % sizeof(uint64_t) && i < size; i++)
+    {
+        if(ram[i] != base_ram[i]) return i;
+    }
+    for(; i < size; i += sizeof(uint64_t))
+    {
+        uint64_t a, b;
+        memcpy(&a, &ram[i], sizeof a);
+        memcpy(&b, &base_ram[i], sizeof b);
+        if(a != b) break;
+    }
+    for(; i < size; i++)
+    {
+        if(ram[i] != base_ram[i]) return i;
+    }
+    return size;
+}
+
+// Serialize the machine into `buffer`, RAM as runs of bytes that differ from `base_ram` (the RAM
+// right after the ROM was loaded). Returns the state size, or 0 if `size` is too small;
+// CHIP8_STATE_MAX_SIZE(chip8->ram_size) always fits.
+size_t chip8_save_state(const chip8_t *chip8, const uint8_t base_ram[], uint8_t *buffer, const size_t size)
+{
+    if(size < CHIP8_STATE_HEADER_SIZE) return 0;
+
+    memset(buffer, 0, CHIP8_STATE_HEADER_SIZE);
+    memcpy(&buffer[0], magic, sizeof magic);
+    put_u16(&buffer[4], CHIP8_STATE_VERSION);
+    put_u16(&buffer[6], CHIP8_STATE_HEADER_SIZE);
+    put_u64(&buffer[8], chip8_hash_ram(base_ram, chip8->ram_size));
+    memcpy(&buffer[24], chip8->V, sizeof chip8->V);
+    put_u16(&buffer[40], chip8->I);
+    put_u16(&buffer[42], chip8->PC);
+    buffer[44] = chip8->delay_timer;
+    buffer[45] = chip8->sound_timer;
+    buffer[46] = chip8->SP;
+    buffer[47] = chip8->hires;
+    put_u16(&buffer[48], chip8->keypad);
+    buffer[50] = chip8->planes;
+    put_u32(&buffer[52], chip8->rng_state);
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        put_u16(&buffer[56 + 2 * i], chip8->stack[i]);
+    }
+    for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        for(uint8_t y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+        {
+            uint8_t *row = &buffer[88 + 16 * (plane * CHIP8_HIRES_HEIGHT + y)];
+            put_u64(&row[0], chip8->display[plane][y] >> 64);
+            put_u64(&row[8], chip8->display[plane][y]);
+        }
+    }
+    put_u32(&buffer[2136], chip8->ram_size);
+    buffer[2140] = chip8->audio_pattern_set;
+    buffer[2141] = chip8->pitch;
+    memcpy(&buffer[2144], chip8->audio_pattern, sizeof chip8->audio_pattern);
+
+    // RAM runs. Differences closer together than a run header are merged into one run.
+    const size_t ram_size = chip8->ram_size;
+    size_t used = CHIP8_STATE_HEADER_SIZE;
+    uint32_t runs = 0;
+    for(size_t start = next_difference(chip8->ram, base_ram, ram_size, 0); start < ram_size; )
+    {
+        size_t end = start + 1;
+        for(size_t next; end - start < UINT16_MAX; end = next + 1)
+        {
+            next = next_difference(chip8->ram, base_ram, ram_size, end);
+            if(next >= ram_size || next - end >= CHIP8_STATE_RUN_HEADER || next + 1 - start > UINT16_MAX) break;
+        }
+
+        const size_t length = end - start;
+        if(size - used < CHIP8_STATE_RUN_HEADER + length) return 0;
+
+        put_u16(&buffer[used], start);
+        put_u16(&buffer[used + 2], length);
+        memcpy(&buffer[used + CHIP8_STATE_RUN_HEADER], &chip8->ram[start], length);
+        used += CHIP8_STATE_RUN_HEADER + length;
+        runs++;
+
+        start = next_difference(chip8->ram, base_ram, ram_size, end);
+    }
+
+    put_u32(&buffer[16], used);
+    put_u32(&buffer[20], runs);
+    return used;
+}
+
+// Restore a state written by chip8_save_state() against the same `base_ram`. The state is fully
+// validated before the machine is touched, so on failure `chip8` is left as it was.
+// Every display row is marked dirty.
+bool chip8_load_state(chip8_t *chip8, const uint8_t base_ram[], const uint8_t *buffer, const size_t size)
+{
+    if(size < CHIP8_STATE_HEADER_SIZE || memcmp(buffer, magic, sizeof magic) != 0)
+    {
+        fprintf(stderr, "Save state is not a CHIP8 state\n");
+        return false;
+    }
+    const uint16_t version = get_u16(&buffer[4]);
+    if(version != CHIP8_STATE_VERSION || get_u16(&buffer[6]) != CHIP8_STATE_HEADER_SIZE)
+    {
+        fprintf(stderr, "Save state version %u is not supported, expected %u\n", version, CHIP8_STATE_VERSION);
+        return false;
+    }
+    const uint32_t ram_size = get_u32(&buffer[2136]);
+    if(ram_size != chip8->ram_size)
+    {
+        fprintf(stderr, "Save state was made with %u bytes of RAM, the machine has %u\n", ram_size, chip8->ram_size);
+        return false;
+    }
+    if(get_u64(&buffer[8]) != chip8_hash_ram(base_ram, ram_size))
+    {
+        fprintf(stderr, "Save state was made with a different ROM\n");
+        return false;
+    }
+
+    const size_t total = get_u32(&buffer[16]);
+    const uint32_t runs = get_u32(&buffer[20]);
+    const uint8_t depth = buffer[46];
+    const bool hires = buffer[47];
+    const uint8_t planes = buffer[50];
+    // Any depth can be reached, 2NNN and 00EE wrap within the 16 entries
+    bool valid = total <= size && total >= CHIP8_STATE_HEADER_SIZE && buffer[47] <= 1 && planes <= 3 && buffer[2140] <= 1;
+
+    // A low resolution display only uses the left half of the first 32 rows
+    for(uint8_t plane = 0; !hires && plane < CHIP8_PLANES; plane++)
+    {
+        for(uint8_t y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+        {
+            const uint8_t *row = &buffer[88 + 16 * (plane * CHIP8_HIRES_HEIGHT + y)];
+            if(get_u64(&row[8]) || (y >= CHIP8_DISPLAY_HEIGHT && get_u64(&row[0]))) valid = false;
+        }
+    }
+
+    // Every run must lie within both the state and RAM
+    size_t used = CHIP8_STATE_HEADER_SIZE;
+    for(uint32_t run = 0; valid && run < runs; run++)
+    {
+        valid = total - used >= CHIP8_STATE_RUN_HEADER;
+        if(!valid) break;
+
+        const size_t offset = get_u16(&buffer[used]);
+        const size_t length = get_u16(&buffer[used + 2]);
+        used += CHIP8_STATE_RUN_HEADER;
+        valid = offset + length <= ram_size && total - used >= length;
+        used += length;
+    }
+    if(!valid || used != total)
+    {
+        fprintf(stderr, "Save state is truncated or corrupt\n");
+        return false;
+    }
+
+    memcpy(chip8->ram, base_ram, ram_size);
+    for(uint32_t run = 0, at = CHIP8_STATE_HEADER_SIZE; run < runs; run++)
+    {
+        const uint16_t offset = get_u16(&buffer[at]);
+        const uint16_t length = get_u16(&buffer[at + 2]);
+        memcpy(&chip8->ram[offset], &buffer[at + CHIP8_STATE_RUN_HEADER], length);
+        at += CHIP8_STATE_RUN_HEADER + length;
+    }
+
+    memcpy(chip8->V, &buffer[24], sizeof chip8->V);
+    chip8->I = get_u16(&buffer[40]);
+    chip8->PC = get_u16(&buffer[42]);
+    chip8->delay_timer = buffer[44];
+    chip8->sound_timer = buffer[45];
+    chip8->SP = depth;
+    chip8->keypad = get_u16(&buffer[48]);
+    chip8->rng_state = get_u32(&buffer[52]);
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        chip8->stack[i] = get_u16(&buffer[56 + 2 * i]);
+    }
+    for(uint8_t plane = 0; plane < CHIP8_PLANES; plane++)
+    {
+        for(uint8_t y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+        {
+            const uint8_t *row = &buffer[88 + 16 * (plane * CHIP8_HIRES_HEIGHT + y)];
+            chip8->display[plane][y] = (chip8_row_t) get_u64(&row[0]) << 64 | get_u64(&row[8]);
+        }
+    }
+    chip8->hires = hires;
+    chip8->planes = planes;
+    chip8->audio_pattern_set = buffer[2140];
+    chip8->pitch = buffer[2141];
+    memcpy(chip8->audio_pattern, &buffer[2144], sizeof chip8->audio_pattern);
+    chip8->dirty_rows = ~0ull;
+
+    return true;
+}
+
+// Write the machine's state to a file
+bool chip8_save_state_file(const chip8_t *chip8, const uint8_t base_ram[], const char path[])
+{
+    const size_t max_size = CHIP8_STATE_MAX_SIZE(chip8->ram_size);
+    uint8_t *buffer = malloc(max_size);
+    if(!buffer)
+    {
+        fprintf(stderr, "Could not allocate save state %s\n", path);
+        return false;
+    }
+    const size_t size = chip8_save_state(chip8, base_ram, buffer, max_size);
+
+    FILE *file = fopen(path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not open save state %s for writing\n", path);
+        free(buffer);
+        return false;
+    }
+
+    const bool ok = fwrite(buffer, size, 1, file) == 1;
+    free(buffer);
+    if(fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "Could not write save state %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Restore the machine from a state file. The file is memory-mapped where possible and decoded in place.
+bool chip8_load_state_file(chip8_t *chip8, const uint8_t base_ram[], const char path[])
+{
+#if SAVESTATE_MMAP
+    const int fd = open(path, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "Save state %s is invalid or does not exist\n", path);
+        if(fd >= 0) close(fd);
+        return false;
+    }
+
+    void *state = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(state == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map save state %s\n", path);
+        return false;
+    }
+
+    const bool ok = chip8_load_state(chip8, base_ram, state, info.st_size);
+    munmap(state, info.st_size);
+    return ok;
+#else
+    FILE *file = fopen(path, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Save state %s is invalid or does not exist\n", path);
+        return false;
+    }
+
+    const size_t max_size = CHIP8_STATE_MAX_SIZE(chip8->ram_size);
+    uint8_t *buffer = malloc(max_size);
+    const size_t size = buffer ? fread(buffer, 1, max_size, file) : 0;
+    fclose(file);
+    const bool ok = buffer && chip8_load_state(chip8, base_ram, buffer, size);
+    free(buffer);
+    return ok;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// Save State Format, all fields little-endian:
+//     0   char[4]   magic "C8ST"
+//     4   uint16    version
+//     6   uint16    header size, offset of the first RAM run
+//     8   uint64    FNV-1a hash of the base RAM the delta was taken against
+//     16  uint32    total size in bytes
+//     20  uint32    number of RAM runs
+//     24  uint8[16] V0-VF
+//     40  uint16    I
+//     42  uint16    PC
+//     44  uint8     delay timer
+//     45  uint8     sound timer
+//     46  uint8     stack depth (SP) as the interpreter left it, stack[(SP - 1) & 15] is the top
+//     47  uint8     1 in high resolution mode, else 0
+//     48  uint16    keypad, bit per held key
+//     50  uint8     selected XO-CHIP planes
+//     51  uint8     reserved, 0
+//     52  uint32    CXNN RNG state
+//     56  uint16[16] stack entries
+//     88  uint64[2][64][2] display, plane by plane, row by row, left half first. MSB is the
+//                   leftmost pixel. Low resolution uses the left half of the first 32 rows.
+//     2136 uint32   RAM size in bytes
+//     2140 uint8    1 if F002 loaded an XO-CHIP audio pattern, else 0
+//     2141 uint8    XO-CHIP audio pitch
+//     2142 uint16   reserved, 0
+//     2144 uint8[16] XO-CHIP audio pattern
+//     2160 RAM runs: uint16 offset, uint16 length, then `length` bytes replacing the base RAM there
+// Every field sits at a fixed offset, so a state can be read in place from a memory-mapped file.
+#define CHIP8_STATE_VERSION     1
+#define CHIP8_STATE_HEADER_SIZE 2160
+#define CHIP8_STATE_RUN_HEADER  4
+// Largest possible state of a machine with `ram_size` bytes of RAM: runs are separated by at least
+// a run header of unchanged bytes, so the whole delta never exceeds RAM plus two headers (a run
+// longer than 64KB is split in two)
+#define CHIP8_STATE_MAX_SIZE(ram_size) (CHIP8_STATE_HEADER_SIZE + 2 * CHIP8_STATE_RUN_HEADER + (size_t) (ram_size))
+
+size_t chip8_save_state(const chip8_t *chip8, const uint8_t base_ram[], uint8_t *buffer, const size_t size);
+bool chip8_load_state(chip8_t *chip8, const uint8_t base_ram[], const uint8_t *buffer, const size_t size);
+bool chip8_save_state_file(const chip8_t *chip8, const uint8_t base_ram[], const char path[]);
+bool chip8_load_state_file(chip8_t *chip8, const uint8_t base_ram[], const char path[]);
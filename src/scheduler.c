@@ -0,0 +1,78 @@
+#include "scheduler.h"
+
+// Set up a schedule whose first tick starts at `now`.
+// speed_percent scales emulated time: 200 runs twice as fast, 50 at half speed.
+void scheduler_init(scheduler_t *scheduler, const uint64_t frequency, const uint64_t now,
+                    const uint32_t speed_percent, const bool turbo)
+{
+    *scheduler = (scheduler_t) {
+        .frequency = frequency,
+        .speed_percent = speed_percent ? speed_percent : 100,
+        .turbo = turbo,
+    };
+
+    // One tick lasts frequency * 100 / (60 * speed_percent) counter ticks, kept as an exact fraction
+    scheduler->period_divisor = (uint64_t) SCHEDULER_TICK_RATE * scheduler->speed_percent;
+    scheduler->period = frequency * 100 / scheduler->period_divisor;
+    scheduler->period_remainder = frequency * 100 % scheduler->period_divisor;
+
+    scheduler_resync(scheduler, now);
+}
+
+// Restart the schedule from `now`, e.g. after a pause, without trying to catch up on lost time
+void scheduler_resync(scheduler_t *scheduler, const uint64_t now)
+{
+    scheduler->deadline = now;
+    scheduler->fraction = 0;
+    scheduler->next_present = now;
+}
+
+// Instructions to run this tick. instructions_per_second is rarely a multiple of 60,
+// the remainder is carried over so exactly instructions_per_second run every 60 ticks.
+uint32_t scheduler_cycles(scheduler_t *scheduler, const uint32_t instructions_per_second)
+{
+    scheduler->cycle_remainder += instructions_per_second % SCHEDULER_TICK_RATE;
+    uint32_t cycles = instructions_per_second / SCHEDULER_TICK_RATE;
+
+    if(scheduler->cycle_remainder >= SCHEDULER_TICK_RATE)
+    {
+        scheduler->cycle_remainder -= SCHEDULER_TICK_RATE;
+        cycles++;
+    }
+
+    return cycles;
+}
+
+// Whether the frontend should show this tick. Always true when paced,
+// in turbo mode frames are only shown at the host's real time 60 Hz.
+bool scheduler_present_due(scheduler_t *scheduler, const uint64_t now)
+{
+    if(!scheduler->turbo) return true;
+    if(now < scheduler->next_present) return false;
+
+    scheduler->next_present = now + scheduler->frequency / SCHEDULER_TICK_RATE;
+    return true;
+}
+
+// Close the current tick and return the counter value the frontend should wait for before starting
+// the next one. A host that fell more than SCHEDULER_MAX_LAG ticks behind is resynced instead of
+// bursting through the backlog. Returns `now` (no wait) in turbo mode.
+uint64_t scheduler_next_tick(scheduler_t *scheduler, const uint64_t now)
+{
+    if(scheduler->turbo) return now;
+
+    scheduler->deadline += scheduler->period;
+    scheduler->fraction += scheduler->period_remainder;
+    if(scheduler->fraction >= scheduler->period_divisor)
+    {
+        scheduler->fraction -= scheduler->period_divisor;
+        scheduler->deadline++;
+    }
+
+    if(now > scheduler->deadline + SCHEDULER_MAX_LAG * scheduler->period)
+    {
+        scheduler_resync(scheduler, now);
+    }
+
+    return scheduler->deadline;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+#define SCHEDULER_TICK_RATE 60      // Timer / frame ticks per emulated second
+#define SCHEDULER_MAX_LAG   6       // Ticks the host may fall behind before the schedule is restarted
+
+// Frame Scheduler Object. Works on any monotonic counter (e.g. SDL_GetPerformanceCounter()).
+// Deadlines advance by the exact tick period, fraction included, so late wakeups never accumulate into drift.
+typedef struct {
+    uint64_t frequency;         // Host counter ticks per second
+    uint64_t deadline;          // Counter value at which the current tick ends
+    uint64_t period;            // Whole counter ticks per emulated tick
+    uint64_t period_remainder;  // Fractional part of the period, in 1/period_divisor counter ticks
+    uint64_t period_divisor;
+    uint64_t fraction;          // Accumulated fractional counter ticks
+    uint64_t next_present;      // Turbo mode: counter value at which the next frame should be shown
+    uint32_t cycle_remainder;   // Instructions per second not yet handed out, in 1/SCHEDULER_TICK_RATE
+    uint32_t speed_percent;     // Emulation speed, 100 is real time
+    bool turbo;                 // Run uncapped, as fast as the host allows
+} scheduler_t;
+
+void scheduler_init(scheduler_t *scheduler, const uint64_t frequency, const uint64_t now,
+                    const uint32_t speed_percent, const bool turbo);
+void scheduler_resync(scheduler_t *scheduler, const uint64_t now);
+uint32_t scheduler_cycles(scheduler_t *scheduler, const uint32_t instructions_per_second);
+bool scheduler_present_due(scheduler_t *scheduler, const uint64_t now);
+uint64_t scheduler_next_tick(scheduler_t *scheduler, const uint64_t now);
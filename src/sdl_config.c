@@ -1,22 +1,50 @@
 #include "sdl_config.h"
 
-void audio_callback(void* userdata, uint8_t *stream, int len)
+// Pre-render the pixel outlines: a background colored border around every scaled pixel,
+// transparent everywhere else so it can be blended over the framebuffer each frame
+static bool init_grid(sdl_t *sdl, const config_t *config)
 {
-    config_t *config = (config_t *)&userdata;
+    const uint32_t width = CHIP8_DISPLAY_WIDTH * config->scale_factor;
+    const uint32_t height = CHIP8_DISPLAY_HEIGHT * config->scale_factor;
 
-    // Fill out stream/audio buffer with data
-    int16_t *audio_data = (int16_t *)userdata;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->audio_sample_rate / config->square_wave_frequency;
-    const int32_t half_square_wave_period = square_wave_period / 2;
+    uint32_t *pixels = calloc(width * height, sizeof *pixels);
+    if(!pixels)
+    {
+        SDL_Log("Could not allocate pixel outline grid\n");
+        return false;
+    }
 
-    for(int i = 0; i < len / 2; i++)
+    for(uint32_t y = 0; y < height; y++)
     {
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ? config->volume : -config->volume;
+        for(uint32_t x = 0; x < width; x++)
+        {
+            const uint32_t cell_x = x % config->scale_factor;
+            const uint32_t cell_y = y % config->scale_factor;
+            if(cell_x == 0 || cell_y == 0 || cell_x == config->scale_factor - 1 || cell_y == config->scale_factor - 1)
+            {
+                pixels[y * width + x] = config->bg_color;
+            }
+        }
     }
+
+    sdl->grid = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, width, height);
+    if(sdl->grid)
+    {
+        SDL_UpdateTexture(sdl->grid, NULL, pixels, width * sizeof *pixels);
+        SDL_SetTextureBlendMode(sdl->grid, SDL_BLENDMODE_BLEND);
+    }
+    free(pixels);
+
+    if(!sdl->grid)
+    {
+        SDL_Log("Could not create pixel outline texture, %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;
 }
 
-bool init_sdl(sdl_t *sdl, config_t *config) 
+bool init_sdl(sdl_t *sdl, config_t *config, audio_t *audio) 
 {
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) 
     {
@@ -35,21 +63,34 @@ bool init_sdl(sdl_t *sdl, config_t *config)
         return false;
     }
 
-    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED);
+    // Presentation is synced to the display, emulation runs on its own thread and is never blocked by it
+    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
     if(!sdl->renderer) {
         SDL_Log("Could not create Renderer, %s\n", SDL_GetError());
         return false;
     }
 
-    // Initialize Audio:
+    // Framebuffer texture at high resolution, low resolution pixels are drawn 2x2. The renderer
+    // scales it up to the window.
+    sdl->screen = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                    CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+
+    if(!sdl->screen) {
+        SDL_Log("Could not create screen texture, %s\n", SDL_GetError());
+        return false;
+    }
+
+    if(config->pixel_outlines && !init_grid(sdl, config)) return false;
+
+    // Initialize Audio, a small buffer keeps the delay from a sound timer edge to the speaker under a frame
     sdl->want = (SDL_AudioSpec){
-        .freq = 44100,
-        .format = AUDIO_S16LSB, // Signed 16 bit little endian audio
+        .freq = config->audio_sample_rate,
+        .format = AUDIO_S16SYS, // Signed 16 bit native endian audio
         .channels = 1,
-        .samples = 4096,
+        .samples = AUDIO_BUFFER_SAMPLES,
         .callback = audio_callback,
-        .userdata = &config,
+        .userdata = audio,
     };
 
     sdl->dev = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
@@ -66,11 +107,17 @@ bool init_sdl(sdl_t *sdl, config_t *config)
         return false;
     }
 
+    // The device runs for the whole session, the callback renders silence while the tone is off
+    audio_init(audio, config, sdl->have.freq, sdl->have.samples);
+    SDL_PauseAudioDevice(sdl->dev, 0);
+
     return true;
 }
 
 void final_cleanup(const sdl_t sdl)
 {
+    if(sdl.grid) SDL_DestroyTexture(sdl.grid);
+    if(sdl.screen) SDL_DestroyTexture(sdl.screen);
     SDL_DestroyRenderer(sdl.renderer);
     SDL_DestroyWindow(sdl.window);
     SDL_CloseAudioDevice(sdl.dev);
@@ -89,56 +136,61 @@ void clear_screen(const sdl_t sdl, const config_t config)
     SDL_RenderClear(sdl.renderer);
 }
 
-void update_screen(sdl_t sdl, config_t config, chip8_t chip8)
+// Redraw the given dirty rows of a display's planes, nothing is uploaded or presented if none are
+void update_screen(const sdl_t sdl, const config_t config, const chip8_row_t display[][CHIP8_HIRES_HEIGHT],
+                   const bool hires, const uint64_t dirty_rows)
 {
-    SDL_Rect rect = {.x = 0, .y = 0, .w = config.scale_factor, .h = config.scale_factor};
+    const uint32_t width = hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    const uint32_t height = hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    const uint32_t scale = hires ? 1 : 2;   // Texels per pixel in each direction
+    if(!(dirty_rows & (~0ull >> (64 - height)))) return;
+
+    // Only the band of rows between the first and last dirty one is uploaded
+    uint32_t first = 0, last = height - 1;
+    while(!((dirty_rows >> first) & 1)) first++;
+    while(!((dirty_rows >> last) & 1)) last--;
 
-    // Grab bg and fg colours to draw:
-    uint8_t bg_r = (config.bg_color >> 24) & 0xFF;
-    uint8_t bg_g = (config.bg_color >> 16) & 0xFF;
-    uint8_t bg_b = (config.bg_color >> 8) & 0xFF;
-    uint8_t bg_a = (config.bg_color >> 0) & 0xFF;
+    // Colour per pixel value, bit 0 from plane 0 and bit 1 from plane 1
+    const uint32_t palette[4] = {config.bg_color, config.fg_color, config.fg2_color, config.blend_color};
 
-    uint8_t fg_r = (config.fg_color >> 24) & 0xFF;
-    uint8_t fg_g = (config.fg_color >> 16) & 0xFF;
-    uint8_t fg_b = (config.fg_color >> 8) & 0xFF;
-    uint8_t fg_a = (config.fg_color >> 0) & 0xFF;
+    const SDL_Rect band = {.x = 0, .y = first * scale, .w = CHIP8_HIRES_WIDTH, .h = (last - first + 1) * scale};
+    void *pixels;
+    int pitch;
 
-    // Loop through the pixels, draw a rectangle for each pixel to the SDL Window
-    for(uint32_t i = 0; i < sizeof(chip8.display); i++)
+    // Expand the 1 bit per pixel display into the streaming texture, one locked upload per frame
+    if(SDL_LockTexture(sdl.screen, &band, &pixels, &pitch) != 0)
     {
-        // X = i % window_width
-        // Y = floor(i / window_width)
-        rect.x = (i % config.window_width) * config.scale_factor;
-        rect.y = (i / config.window_width) * config.scale_factor;
+        SDL_Log("Could not lock screen texture, %s\n", SDL_GetError());
+        return;
+    }
 
-        if(chip8.display[i])
-        {
-            // If pixel is on, draw the foreground color
-            SDL_SetRenderDrawColor(sdl.renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
+    for(uint32_t y = first; y <= last; y++)
+    {
+        uint32_t *texel = (uint32_t *)((uint8_t *)pixels + (y - first) * scale * pitch);
+        const chip8_row_t row0 = display[0][y];
+        const chip8_row_t row1 = display[1][y];
 
-            // Drawing pixel outlines
-            if(config.pixel_outlines)
-            {
-                SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderDrawRect(sdl.renderer, &rect);    
-            }
-            SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderDrawRect(sdl.renderer, &rect);
-        } else {
-            // Else, draw the background color
-            SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
+        // Display rows are packed one bit per pixel, MSB first
+        for(uint32_t x = 0; x < width; x++)
+        {
+            const uint32_t color = palette[((row0 >> (127 - x)) & 1) | (((row1 >> (127 - x)) & 1) << 1)];
+            for(uint32_t i = 0; i < scale; i++) texel[x * scale + i] = color;
         }
+        if(scale == 2) memcpy((uint8_t *)texel + pitch, texel, CHIP8_HIRES_WIDTH * sizeof *texel);
     }
+    SDL_UnlockTexture(sdl.screen);
+
+    // Scale the whole framebuffer to the window in one copy, then lay the outline grid over it.
+    // The grid outlines low resolution pixels, high resolution ones are too small for it.
+    SDL_RenderCopy(sdl.renderer, sdl.screen, NULL, NULL);
+    if(sdl.grid && !hires) SDL_RenderCopy(sdl.renderer, sdl.grid, NULL, NULL);
 
     // Updating the background color updates the backbuffer, not the screen. To update the screen, use the RenderPresent function.
     SDL_RenderPresent(sdl.renderer);
 }
 
-// Handle user input
-void handle_input(chip8_t* chip8)
+// Handle user input, called from the thread that owns the window
+void handle_input(input_t *input)
 {
     SDL_Event event;
 
@@ -148,63 +200,77 @@ void handle_input(chip8_t* chip8)
         {
             case SDL_QUIT:
                 // Exit window & end program
-                chip8->state = QUIT; // Will exit main emulator loop
+                input->state = QUIT; // Will exit main emulator loop
                 return;
+            case SDL_WINDOWEVENT:
+                // The window contents were lost, repaint everything on the next frame
+                if(event.window.event == SDL_WINDOWEVENT_EXPOSED) input->redraw = true;
+                break;
             case SDL_KEYDOWN:
                 switch(event.key.keysym.sym)
                 {
                     case SDLK_ESCAPE:
                         // Escape key, exit main emulator loop
-                        chip8->state = QUIT;
+                        input->state = QUIT;
                         return;
                     case SDLK_SPACE:
-                        if(chip8->state == RUNNING)
+                        if(input->state == RUNNING)
                         {
-                            chip8->state = PAUSED;
+                            input->state = PAUSED;
                             puts("==== PAUSED ====");
                         } else {
-                            chip8->state = RUNNING;
+                            input->state = RUNNING;
                         }
                         return;
+                    case SDLK_BACKSPACE:
+                        // Held backspace steps back through recent frames
+                        input->rewind = true;
+                        break;
+                    case SDLK_p:
+                        // Write the opcode profile gathered so far
+                        input->dump_profile = true;
+                        break;
                     
-                    case SDLK_1: chip8->keypad[0x1] = true; break; // 1
-                    case SDLK_2: chip8->keypad[0x2] = true; break; // 2
-                    case SDLK_3: chip8->keypad[0x3] = true; break; // 3
-                    case SDLK_4: chip8->keypad[0xC] = true; break; // C
-                    case SDLK_q: chip8->keypad[0x4] = true; break; // 4
-                    case SDLK_w: chip8->keypad[0x5] = true; break; // 5
-                    case SDLK_e: chip8->keypad[0x6] = true; break; // 6
-                    case SDLK_r: chip8->keypad[0xC] = true; break; // D
-                    case SDLK_a: chip8->keypad[0x7] = true; break; // 7
-                    case SDLK_s: chip8->keypad[0x8] = true; break; // 8
-                    case SDLK_d: chip8->keypad[0x9] = true; break; // 9
-                    case SDLK_f: chip8->keypad[0xE] = true; break; // E
-                    case SDLK_z: chip8->keypad[0xA] = true; break; // A
-                    case SDLK_x: chip8->keypad[0x0] = true; break; // 0
-                    case SDLK_c: chip8->keypad[0xB] = true; break; // B
-                    case SDLK_v: chip8->keypad[0xF] = true; break; // F
+                    case SDLK_1: input->keypad |= 1 << 0x1; break; // 1
+                    case SDLK_2: input->keypad |= 1 << 0x2; break; // 2
+                    case SDLK_3: input->keypad |= 1 << 0x3; break; // 3
+                    case SDLK_4: input->keypad |= 1 << 0xC; break; // C
+                    case SDLK_q: input->keypad |= 1 << 0x4; break; // 4
+                    case SDLK_w: input->keypad |= 1 << 0x5; break; // 5
+                    case SDLK_e: input->keypad |= 1 << 0x6; break; // 6
+                    case SDLK_r: input->keypad |= 1 << 0xD; break; // D
+                    case SDLK_a: input->keypad |= 1 << 0x7; break; // 7
+                    case SDLK_s: input->keypad |= 1 << 0x8; break; // 8
+                    case SDLK_d: input->keypad |= 1 << 0x9; break; // 9
+                    case SDLK_f: input->keypad |= 1 << 0xE; break; // E
+                    case SDLK_z: input->keypad |= 1 << 0xA; break; // A
+                    case SDLK_x: input->keypad |= 1 << 0x0; break; // 0
+                    case SDLK_c: input->keypad |= 1 << 0xB; break; // B
+                    case SDLK_v: input->keypad |= 1 << 0xF; break; // F
                     default: break;
                 }
                 break;
             case SDL_KEYUP:
                 switch(event.key.keysym.sym)
                 {
-                    case SDLK_1: chip8->keypad[0x1] = false; break; // 1
-                    case SDLK_2: chip8->keypad[0x2] = false; break; // 2
-                    case SDLK_3: chip8->keypad[0x3] = false; break; // 3
-                    case SDLK_4: chip8->keypad[0xC] = false; break; // C
-                    case SDLK_q: chip8->keypad[0x4] = false; break; // 4
-                    case SDLK_w: chip8->keypad[0x5] = false; break; // 5
-                    case SDLK_e: chip8->keypad[0x6] = false; break; // 6
-                    case SDLK_r: chip8->keypad[0xC] = false; break; // D
-                    case SDLK_a: chip8->keypad[0x7] = false; break; // 7
-                    case SDLK_s: chip8->keypad[0x8] = false; break; // 8
-                    case SDLK_d: chip8->keypad[0x9] = false; break; // 9
-                    case SDLK_f: chip8->keypad[0xE] = false; break; // E
-                    case SDLK_z: chip8->keypad[0xA] = false; break; // A
-                    case SDLK_x: chip8->keypad[0x0] = false; break; // 0
-                    case SDLK_c: chip8->keypad[0xB] = false; break; // B
-                    case SDLK_v: chip8->keypad[0xF] = false; break; // F
+                    case SDLK_BACKSPACE: input->rewind = false; break;
+
+                    case SDLK_1: input->keypad &= ~(1 << 0x1); break; // 1
+                    case SDLK_2: input->keypad &= ~(1 << 0x2); break; // 2
+                    case SDLK_3: input->keypad &= ~(1 << 0x3); break; // 3
+                    case SDLK_4: input->keypad &= ~(1 << 0xC); break; // C
+                    case SDLK_q: input->keypad &= ~(1 << 0x4); break; // 4
+                    case SDLK_w: input->keypad &= ~(1 << 0x5); break; // 5
+                    case SDLK_e: input->keypad &= ~(1 << 0x6); break; // 6
+                    case SDLK_r: input->keypad &= ~(1 << 0xD); break; // D
+                    case SDLK_a: input->keypad &= ~(1 << 0x7); break; // 7
+                    case SDLK_s: input->keypad &= ~(1 << 0x8); break; // 8
+                    case SDLK_d: input->keypad &= ~(1 << 0x9); break; // 9
+                    case SDLK_f: input->keypad &= ~(1 << 0xE); break; // E
+                    case SDLK_z: input->keypad &= ~(1 << 0xA); break; // A
+                    case SDLK_x: input->keypad &= ~(1 << 0x0); break; // 0
+                    case SDLK_c: input->keypad &= ~(1 << 0xB); break; // B
+                    case SDLK_v: input->keypad &= ~(1 << 0xF); break; // F
                     default: break;
                 }
                 break;
@@ -212,4 +278,23 @@ void handle_input(chip8_t* chip8)
                 break;
         }
     }
-}
\ No newline at end of file
+}
+
+// Wait for a SDL_GetPerformanceCounter() deadline. SDL_Delay() only has millisecond
+// resolution and may oversleep, so it covers all but the last 2ms and the rest is spun off.
+void wait_until(const uint64_t deadline)
+{
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+
+    for(uint64_t now = SDL_GetPerformanceCounter(); now < deadline; now = SDL_GetPerformanceCounter())
+    {
+        const uint64_t remaining_ms = (deadline - now) * 1000 / frequency;
+        if(remaining_ms <= 2) break;
+        SDL_Delay(remaining_ms - 2);
+    }
+
+    while(SDL_GetPerformanceCounter() < deadline)
+    {
+        // Spin for sub-millisecond accuracy
+    }
+}
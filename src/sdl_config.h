@@ -2,10 +2,34 @@
 
 #include "common.h"
 #include "chip8.h"
+#include "audio.h"
+#include "SDL.h"
 
-void audio_callback(void* userdata, uint8_t *stream, int len);
-bool init_sdl(sdl_t *sdl, config_t *config);
+// SDL Container Object
+typedef struct 
+{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *screen;    // High resolution framebuffer, streamed once per frame
+    SDL_Texture *grid;      // Low resolution pixel outline overlay, NULL if outlines are off
+    SDL_AudioSpec want, have;
+    SDL_AudioDeviceID dev;
+} sdl_t;
+
+// Input state collected by handle_input(), owned by the thread that polls SDL events
+typedef struct
+{
+    uint16_t keypad;            // Bit per held key 0x0 - 0xF
+    emulator_state_t state;     // Run state requested by the user
+    bool redraw;                // Window contents were lost and must be repainted
+    bool rewind;                // Rewind key is held
+    bool dump_profile;          // Profile dump requested, only does something in -DPROFILE builds
+} input_t;
+
+bool init_sdl(sdl_t *sdl, config_t *config, audio_t *audio);
 void final_cleanup(const sdl_t sdl);
 void clear_screen(const sdl_t sdl, const config_t config);
-void update_screen(sdl_t sdl, config_t config, chip8_t chip8);
-void handle_input(chip8_t* chip8);
\ No newline at end of file
+void update_screen(const sdl_t sdl, const config_t config, const chip8_row_t display[][CHIP8_HIRES_HEIGHT],
+                   const bool hires, const uint64_t dirty_rows);
+void handle_input(input_t *input);
+void wait_until(const uint64_t deadline);
@@ -0,0 +1,340 @@
+// Terminal frontend, for headless servers and SSH sessions.
+//
+// Plays a ROM in a terminal instead of an SDL window. Two display rows share one character cell,
+// drawn with the Unicode half blocks, so the lores display takes 64x16 cells and hires 128x32.
+// Every frame only the cells that changed since the previous one are sent, each run of them behind
+// one cursor move, and the whole frame goes out in a single write(). A sprite moving over a still
+// background costs a few dozen bytes per frame rather than the whole screen, which keeps it usable
+// over slow links. XO-CHIP planes are ORed together and there is no sound.
+//
+// Keys are read from stdin in raw mode and map onto the keypad like the SDL frontend:
+//     1 2 3 4        1 2 3 C
+//     q w e r   ->   4 5 6 D
+//     a s d f        7 8 9 E
+//     z x c v        A 0 B F
+// Esc quits, space pauses and Ctrl-L redraws the whole screen. A terminal only sends key presses,
+// plus the auto repeats while a key stays down, so a key counts as held for TERM_KEY_HOLD_TICKS
+// frames after its last press or repeat.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_term
+// Usage:
+//     chip8_term [--ips <n>] [--speed <multiplier>] [--turbo] [--quirks <profile>] <rom_path>
+
+#include "common.h"
+#include "chip8.h"
+#include "emulator.h"
+#include "scheduler.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define TERM_KEY_HOLD_TICKS 8       // Frames a key stays down after its last press, covers auto repeat gaps
+#define TERM_GAP_CELLS      2       // Unchanged cells rewritten rather than jumped over, a jump costs more bytes
+#define TERM_ROWS           (CHIP8_HIRES_HEIGHT / 2)
+#define TERM_UNKNOWN        0xFF    // Cell whose contents on screen are unknown, always redrawn
+
+// Cell contents, bit 0 for the upper pixel and bit 1 for the lower one
+static const char *const glyphs[4] = {" ", "▀", "▄", "█"};
+
+static struct termios saved_termios;
+static volatile sig_atomic_t quit_requested;
+
+// Everything sent in one frame: worst case every cell behind its own cursor move
+static char out[TERM_ROWS * CHIP8_HIRES_WIDTH * 16 + 64];
+static uint32_t out_size;
+
+// Terminal Object: what the terminal shows, and the keys held from stdin
+typedef struct {
+    uint8_t cells[TERM_ROWS][CHIP8_HIRES_WIDTH];    // As last drawn
+    bool hires;                                     // Mode the cells were drawn in
+    bool paused;                                    // Pause banner shown
+    uint8_t hold[16];                               // Frames each key stays down
+} term_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void wait_until(const uint64_t deadline)
+{
+    const struct timespec ts = {.tv_sec = deadline / 1000000000ull, .tv_nsec = deadline % 1000000000ull};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !quit_requested);
+}
+
+static void emit(const char *text, const size_t size)
+{
+    memcpy(&out[out_size], text, size);
+    out_size += size;
+}
+
+#define EMIT(literal) emit(literal, sizeof literal - 1)
+
+// Send what was emitted, partial writes are retried so the frame stays whole
+static void flush_output(void)
+{
+    for(uint32_t sent = 0; sent < out_size;)
+    {
+        const ssize_t written = write(STDOUT_FILENO, &out[sent], out_size - sent);
+        if(written < 0 && errno != EINTR) break;
+        if(written > 0) sent += written;
+    }
+    out_size = 0;
+}
+
+static void restore_terminal(void)
+{
+    // Show the cursor and leave the alternate screen, the shell comes back as it was
+    EMIT("\x1b[0m\x1b[?25h\x1b[?1049l");
+    flush_output();
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+}
+
+static void quit_handler(int signal_number)
+{
+    (void) signal_number;
+    quit_requested = 1;
+}
+
+// Raw, non-blocking stdin and a blank alternate screen without cursor, undone at exit
+static bool init_terminal(void)
+{
+    if(!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios) != 0)
+    {
+        fprintf(stderr, "stdin and stdout must be a terminal\n");
+        return false;
+    }
+
+    struct termios raw = saved_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+    {
+        fprintf(stderr, "Could not switch the terminal to raw mode\n");
+        return false;
+    }
+    atexit(restore_terminal);
+
+    struct sigaction action = {.sa_handler = quit_handler};
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+
+    EMIT("\x1b[?1049h\x1b[?25l\x1b[2J");
+    flush_output();
+    return true;
+}
+
+// Keypad key for a key on the host keyboard, in the layout of handle_input(), or -1
+static int8_t map_key(const uint8_t c)
+{
+    switch(tolower(c))  // Caps lock doesn't matter
+    {
+        case '1': return 0x1;
+        case '2': return 0x2;
+        case '3': return 0x3;
+        case '4': return 0xC;
+        case 'q': return 0x4;
+        case 'w': return 0x5;
+        case 'e': return 0x6;
+        case 'r': return 0xD;
+        case 'a': return 0x7;
+        case 's': return 0x8;
+        case 'd': return 0x9;
+        case 'f': return 0xE;
+        case 'z': return 0xA;
+        case 'x': return 0x0;
+        case 'c': return 0xB;
+        case 'v': return 0xF;
+        default: return -1;
+    }
+}
+
+// Forget what the terminal shows, the next frame redraws every cell
+static void invalidate(term_t *term)
+{
+    memset(term->cells, TERM_UNKNOWN, sizeof term->cells);
+    term->paused = false;
+    EMIT("\x1b[2J");
+}
+
+// Drain stdin and return the keypad held this frame
+static uint16_t read_input(term_t *term, chip8_t *chip8)
+{
+    uint8_t buffer[64];
+    ssize_t size;
+    while((size = read(STDIN_FILENO, buffer, sizeof buffer)) > 0)
+    {
+        for(ssize_t i = 0; i < size; i++)
+        {
+            const uint8_t c = buffer[i];
+            if(c == 0x1b)
+            {
+                // A lone Esc quits, other keys send sequences starting with Esc [ or Esc O, skip them
+                if(i + 1 < size && (buffer[i + 1] == '[' || buffer[i + 1] == 'O'))
+                {
+                    for(i += 2; i < size && (buffer[i] < 0x40 || buffer[i] > 0x7E); i++);
+                    continue;
+                }
+                chip8->state = QUIT;
+            } else if(c == 0x03) {
+                // Ctrl-C, raw mode doesn't turn it into SIGINT
+                chip8->state = QUIT;
+            } else if(c == ' ') {
+                chip8->state = chip8->state == RUNNING ? PAUSED : RUNNING;
+            } else if(c == 0x0C) {
+                invalidate(term);
+            } else {
+                const int8_t key = map_key(c);
+                if(key >= 0) term->hold[key] = TERM_KEY_HOLD_TICKS;
+            }
+        }
+    }
+
+    uint16_t keypad = 0;
+    for(uint8_t key = 0; key < 16; key++)
+    {
+        if(term->hold[key] == 0) continue;
+        term->hold[key]--;
+        keypad |= 1 << key;
+    }
+    return keypad;
+}
+
+// Emit the cells of the machine's display that differ from what the terminal shows
+static void draw(term_t *term, chip8_t *chip8)
+{
+    if(chip8->hires != term->hires)
+    {
+        term->hires = chip8->hires;
+        invalidate(term);
+    }
+
+    const uint32_t width = term->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    const uint32_t rows = (term->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT) / 2;
+    const bool full = term->cells[0][0] == TERM_UNKNOWN;
+
+    for(uint32_t row = 0; row < rows; row++)
+    {
+        if(!full && !((chip8->dirty_rows >> (row * 2)) & 3)) continue;
+
+        // Both display rows left aligned in 128 bits, lores rows are already
+        const chip8_row_t upper = chip8->display[0][row * 2] | chip8->display[1][row * 2];
+        const chip8_row_t lower = chip8->display[0][row * 2 + 1] | chip8->display[1][row * 2 + 1];
+
+        uint8_t *cells = term->cells[row];
+        uint32_t cursor = UINT32_MAX;   // Column the terminal's cursor is at on this row, if any
+        for(uint32_t x = 0; x < width; x++)
+        {
+            const uint32_t shift = CHIP8_HIRES_WIDTH - 1 - x;
+            const uint8_t cell = ((upper >> shift) & 1) | (((lower >> shift) & 1) << 1);
+            if(cell == cells[x]) continue;
+
+            if(cursor <= x && x - cursor <= TERM_GAP_CELLS)
+            {
+                // Rewriting a short gap is cheaper than jumping over it
+                for(; cursor < x; cursor++) emit(glyphs[cells[cursor]], strlen(glyphs[cells[cursor]]));
+            } else {
+                out_size += sprintf(&out[out_size], "\x1b[%u;%uH", row + 1, x + 1);
+            }
+
+            emit(glyphs[cell], strlen(glyphs[cell]));
+            cells[x] = cell;
+            cursor = x + 1;
+        }
+    }
+    chip8->dirty_rows = 0;
+}
+
+// Show or hide the banner below the display
+static void draw_pause(term_t *term, const bool paused)
+{
+    if(paused == term->paused) return;
+    term->paused = paused;
+
+    const uint32_t rows = (term->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT) / 2;
+    out_size += sprintf(&out[out_size], "\x1b[%u;1H\x1b[2K%s", rows + 1, paused ? "==== PAUSED ====" : "");
+}
+
+int main(int argc, char** argv)
+{
+    const char *rom_path = NULL;
+    uint32_t instructions_per_second = 500;
+    uint32_t speed_percent = 100;
+    bool turbo = false;
+    chip8_quirk_profile_t quirk_profile = CHIP8_QUIRKS_MODERN;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--ips") && i + 1 < argc) {
+            instructions_per_second = strtoul(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--speed") && i + 1 < argc) {
+            speed_percent = strtod(argv[++i], NULL) * 100;
+        } else if(!strcmp(argv[i], "--turbo")) {
+            turbo = true;
+        } else if(!strcmp(argv[i], "--quirks") && i + 1 < argc) {
+            if(!chip8_quirk_profile_from_name(argv[++i], &quirk_profile)) exit(EXIT_FAILURE);
+        } else if(!rom_path && argv[i][0] != '-') {
+            rom_path = argv[i];
+        } else {
+            rom_path = NULL;
+            break;
+        }
+    }
+    if(!rom_path || instructions_per_second == 0 || speed_percent == 0)
+    {
+        fprintf(stderr, "Usage: %s [--ips <n>] [--speed <multiplier>] [--turbo] [--quirks <profile>] <rom_path>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    chip8_t *chip8 = chip8_create(chip8_ram_size(quirk_profile));
+    if(!chip8 || !init_chip8(chip8, rom_path)) exit(EXIT_FAILURE);
+    chip8_seed(chip8, time(NULL));
+    const chip8_run_t run = chip8_runner(quirk_profile);
+
+    if(!init_terminal()) exit(EXIT_FAILURE);
+
+    term_t term = {0};
+    invalidate(&term);
+
+    scheduler_t scheduler;
+    scheduler_init(&scheduler, 1000000000ull, now_ns(), speed_percent, turbo);
+
+    while(chip8->state != QUIT && !quit_requested)
+    {
+        chip8->keypad = read_input(&term, chip8);
+
+        if(chip8->state == RUNNING)
+        {
+            run(chip8, scheduler_cycles(&scheduler, instructions_per_second));
+            update_timers(chip8);
+        }
+
+        // Frames that changed nothing cost nothing. In turbo mode only the host's 60Hz frames are shown.
+        if((chip8->dirty_rows || term.cells[0][0] == TERM_UNKNOWN) && scheduler_present_due(&scheduler, now_ns()))
+        {
+            draw(&term, chip8);
+        }
+        draw_pause(&term, chip8->state == PAUSED);
+        flush_output();
+
+        if(chip8->state == PAUSED)
+        {
+            // Don't try to catch up on the paused time afterwards
+            wait_until(now_ns() + 1000000000ull / SCHEDULER_TICK_RATE);
+            scheduler_resync(&scheduler, now_ns());
+        } else {
+            wait_until(scheduler_next_tick(&scheduler, now_ns()));
+        }
+    }
+
+    chip8_destroy(chip8);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,127 @@
+#include "trace.h"
+
+#ifdef DEBUG
+
+#include "bytes.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define TRACE_CRASH_HANDLER 1
+    #include <signal.h>
+    #include <unistd.h>
+#else
+    #define TRACE_CRASH_HANDLER 0
+#endif
+
+static const char magic[4] = {'C', '8', 'T', 'R'};
+
+static uint8_t buffer[TRACE_BUFFER_SIZE];
+static uint32_t used;       // Bytes of records not yet written out
+static FILE *file;
+static bool failed;         // The trace could not be written, stop recording
+
+// Write out the buffered records. The file is unbuffered, so nothing is left in stdio for the
+// crash handler to miss.
+static void flush(void)
+{
+    if(!file || !used) return;
+
+    if(fwrite(buffer, 1, used, file) != used)
+    {
+        fprintf(stderr, "Could not write trace to %s, tracing stopped\n", TRACE_PATH);
+        fclose(file);
+        file = NULL;
+        failed = true;
+    }
+    used = 0;
+}
+
+static void close_trace(void)
+{
+    flush();
+    if(file)
+    {
+        fclose(file);
+        file = NULL;
+        printf("Trace written to %s\n", TRACE_PATH);
+    }
+}
+
+#if TRACE_CRASH_HANDLER
+// Save what is buffered with the async-signal-safe write(), then crash as we would have
+static void crash_handler(int signal_number)
+{
+    if(file && used)
+    {
+        const ssize_t written = write(fileno(file), buffer, used);
+        (void) written;
+    }
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+#endif
+
+static bool open_trace(void)
+{
+    file = fopen(TRACE_PATH, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not open trace %s for writing, tracing stopped\n", TRACE_PATH);
+        failed = true;
+        return false;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+
+    memcpy(&buffer[0], magic, sizeof magic);
+    put_u16(&buffer[4], TRACE_VERSION);
+    put_u16(&buffer[6], TRACE_HEADER_SIZE);
+    used = TRACE_HEADER_SIZE;
+
+    atexit(close_trace);
+#if TRACE_CRASH_HANDLER
+    const int crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    for(uint32_t i = 0; i < sizeof crash_signals / sizeof crash_signals[0]; i++)
+    {
+        signal(crash_signals[i], crash_handler);
+    }
+#endif
+    return true;
+}
+
+// Append the record of the instruction that just ran, opening the trace on first use
+void trace_end(const trace_before_t *before, const chip8_t *chip8)
+{
+    if(!file && (failed || !open_trace())) return;
+    if(used + TRACE_MAX_RECORD > TRACE_BUFFER_SIZE) flush();
+    if(!file) return;
+
+    uint8_t *record = &buffer[used];
+    put_u16(&record[0], before->PC);
+    put_u16(&record[2], before->opcode);
+    put_u16(&record[4], before->I);
+    put_u16(&record[6], before->stack_top);
+    record[8] = before->V[(before->opcode >> 8) & 0x0F];
+    record[9] = before->V[(before->opcode >> 4) & 0x0F];
+    record[10] = before->V[0];
+    record[11] = before->delay_timer;
+    record[12] = before->key;
+
+    uint32_t size = TRACE_RECORD_SIZE;
+    uint16_t changed = 0;
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        if(chip8->V[i] == before->V[i]) continue;
+        changed |= 1u << i;
+        record[size++] = chip8->V[i];
+    }
+    record[13] = 0;
+    if(chip8->I != before->I)
+    {
+        record[13] |= TRACE_I_CHANGED;
+        put_u16(&record[size], chip8->I);
+        size += 2;
+    }
+    put_u16(&record[14], changed);
+    used += size;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include "chip8.h"
+
+// Execution trace for the reference interpreter (emulate_instruction()).
+// Build with -DDEBUG to enable it. Every instruction appends a compact binary record to a fixed
+// in-memory buffer, which is written to TRACE_PATH whenever it fills, at exit and, on POSIX, when
+// the process crashes. chip8_tracedump (tracedump.c) turns the file back into readable text.
+// Otherwise every TRACE_* hook expands to nothing and trace.c compiles to an empty object.
+// The buffer is global, so trace one machine at a time.
+//
+// Trace Format, all fields little-endian:
+//     0   char[4]   magic "C8TR"
+//     4   uint16    version
+//     6   uint16    header size, offset of the first record
+//     8   records:
+//         0   uint16    PC the instruction was fetched from
+//         2   uint16    opcode
+//         4   uint16    I before the instruction
+//         6   uint16    return address on top of the stack before the instruction, 0 if empty
+//         8   uint8     VX before
+//         9   uint8     VY before
+//         10  uint8     V0 before
+//         11  uint8     delay timer before
+//         12  uint8     state of the key numbered by VX before
+//         13  uint8     flags, TRACE_I_CHANGED
+//         14  uint16    bit per V register the instruction changed
+//         16  ...       new value of each changed V register, lowest register first,
+//                       then uint16 new I if TRACE_I_CHANGED
+#define TRACE_VERSION        1
+#define TRACE_HEADER_SIZE    8
+#define TRACE_RECORD_SIZE    16                            // Without the changed registers
+#define TRACE_MAX_RECORD     (TRACE_RECORD_SIZE + 16 + 2)
+#define TRACE_I_CHANGED      0x01
+
+#ifdef DEBUG
+
+#define TRACE_PATH         "chip8_trace.bin"
+#define TRACE_BUFFER_SIZE  (1024 * 1024)   // Bytes of records held before they are written out
+
+// Machine state before an instruction, what the record describes
+typedef struct {
+    uint16_t PC;
+    uint16_t opcode;
+    uint16_t I;
+    uint16_t stack_top;
+    uint8_t delay_timer;
+    uint8_t key;
+    uint8_t V[16];
+} trace_before_t;
+
+static inline void trace_begin(trace_before_t *before, const chip8_t *chip8, const uint16_t opcode)
+{
+    before->PC = chip8->PC - 2;
+    before->opcode = opcode;
+    before->I = chip8->I;
+    before->stack_top = chip8->SP > 0 ? chip8->stack[(chip8->SP - 1) & 15] : 0;
+    before->delay_timer = chip8->delay_timer;
+    before->key = chip8_key_down(chip8, chip8->V[(opcode >> 8) & 0x0F] & 0x0F);
+    memcpy(before->V, chip8->V, sizeof before->V);
+}
+
+void trace_end(const trace_before_t *before, const chip8_t *chip8);
+
+// TRACE_BEGIN() goes after the instruction is fetched, TRACE_END() after it ran
+#define TRACE_BEGIN(chip8, opcode) trace_before_t trace_before; trace_begin(&trace_before, (chip8), (opcode))
+#define TRACE_END(chip8) trace_end(&trace_before, (chip8))
+
+#else
+
+#define TRACE_BEGIN(chip8, opcode) ((void) 0)
+#define TRACE_END(chip8) ((void) 0)
+
+#endif
@@ -0,0 +1,313 @@
+// Execution trace decoder.
+//
+// Turns a trace written by a -DDEBUG build of the emulator (chip8_trace.bin, see trace.h) into
+// one readable description per instruction, the lines the debug build used to print while running.
+// With --changes every description is followed by the registers the instruction changed.
+//
+// Build (no SDL needed), with the rest of the tree from CMakeLists.txt:
+//     cmake -S . -B build && cmake --build build --target chip8_tracedump
+// Usage:
+//     chip8_tracedump [--changes] <trace_path>
+
+#include "common.h"
+#include "trace.h"
+#include "bytes.h"
+
+static const char magic[4] = {'C', '8', 'T', 'R'};
+
+// Print the description of one record, from the state it saved from before the instruction ran
+static void describe(const uint8_t record[])
+{
+    const uint16_t PC = get_u16(&record[0]);
+    const uint16_t opcode = get_u16(&record[2]);
+    const uint16_t I = get_u16(&record[4]);
+    const uint16_t stack_top = get_u16(&record[6]);
+    const uint8_t VX = record[8];
+    const uint8_t VY = record[9];
+    const uint8_t V0 = record[10];
+    const uint8_t delay_timer = record[11];
+    const uint8_t key = record[12];
+
+    const uint16_t NNN = opcode & 0x0FFF;
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t N = opcode & 0x0F;
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+
+    printf("Current PC Address: 0x%04X, Opcode: 0x%04X Description: ", PC, opcode);
+    switch((opcode >> 12) & 0x0F)
+    {
+        case 0x00:
+            if(NN == 0xE0)
+            {
+                //0x00E0: Clear the screen
+                printf("Clear Screen\n");
+            } else if (NN == 0xEE) {
+                // 0x00EE: Return from a subroutine
+                // Set PC to last return address which was stored on the subroutine stack, and the pop it off
+                printf("Return from subroutine at address 0x%04X\n", stack_top);
+            } else {
+                printf("Unimplemented opcode\n");
+            }
+            break;
+        case 0x01:
+            // 1NNN: Jump to address at NNN.
+            printf("PC set to NNN: (0x%04X)\n", NNN);
+            break;
+        case 0x02:
+            // 0x2NNN: Call Subroutine at NNN:
+            // Store the return point (PC, which has been incremented by 2 to avoid an infinite loop of calling the subroutine and returning to it)
+            // Update the PC to NNN, which is where the subroutine is located
+            printf("Call Subroutine located at 0x%04X\n", NNN);
+            break;
+        case 0x03:
+            // 0x3XNN: Skip the next instruction if value in Vx == NN
+            printf("If V%X (0x%02X) is is equal to NN (0x%02X), then skip the next instruction.\n", X, 
+                    VX, NN);
+            break;
+        case 0x04:
+            // 0x4XNN: Skips the next instruction if VX does not equal NN
+            printf("If V%X  (0x%02X)is is not equal to NN (0x%02X), then skip the next instruction.\n", X, 
+                    VX, NN);
+            break;
+        case 0x05:
+            // 0x5XY0: Skips the next instruction if VX equals VY
+            printf("If V%X  (0x%02X) is equal to V%X (0x%02X), then skip the next instruction.\n", 
+                    X, VX,
+                    Y, VY);
+            break;
+        case 0x06:
+            // 0x6XNN: Set Register Vx = NN
+            printf("Set Register V%01X to 0x%02X\n", X, NN);
+            break;
+        case 0x07:
+            // 0x7XNN: Vx += NN. Carry flag is not changed
+            printf("Value NN (0x%02X) was added to register V%X, which had initial value 0x%02X\n",
+                    NN, X, VX);
+            break;
+        case 0x08:
+            switch(N)
+            {
+                case 0:
+                    // 0x8XY0: Set the value of Vx equal to the value of Vy
+                    printf("Value of V%X set to value of V%X (0x%02X)\n", X, Y,
+                            VY); 
+                    break;
+                case 1:
+                    // 0x8XY1: Set Vx to Vx | Vy (Bitwise OR)
+                    printf("Set V%X to bitwise OR with V%X (0x%02X)\n", X, Y,
+                            VY);
+                    break;
+                case 2:
+                    // 0x8XY1: Set Vx to Vx & Vy (Bitwise AND)
+                    printf("Set V%X to bitwise AND with V%X (0x%02X)\n", X, Y,
+                            VY);
+                    break;
+                case 3:
+                    // 0x8XY3: Set Vx to Vx ^ Vy (Bitwise XOR)
+                    printf("Set V%X to bitwise XOR with V%X (0x%02X)\n", X, Y,
+                            VY);
+                    break;
+                case 4:
+                    // 0x8XY4: Add Vy to Vx. Set VF to 1 if overflow occurs, else set it to 0
+                    printf("V%X (0x%02X) += V%X (0x%02X)\n"
+                            , X, VX
+                            , Y, VY);
+                    break;
+                case 5:
+                    // 0x8XY5: Subtract Vy from Vx. Set VF to 1 when no underflow occurs, and 0 when there is underflow
+                    printf("V%X (0x%02X) -= V%X (0x%02X)\n"
+                            , X, VX
+                            , Y, VY);
+                    break;
+                case 6:
+                    // 0x8XY6: Shift VX to the right by 1, then store the least significant bit of VX prior to the shift into VF
+                    printf("Right shift V%X (0x%02X) by 1 bit\n", X, VX);
+                    break;
+                case 7:
+                    // 0x8XY7: Set VX to VY minus VX. VF is set to 0 when there is an underflow, and 1 when there is not.
+                    printf("V%X (0x%02X) = V%X (0x%02X) - V%X\n"
+                            , X, VX
+                            , Y, VY
+                            , X);
+                    break;
+                case 0xE: 
+                    // 0x8XYE: Shift VX to the left by 1. Set VF to 1 if the MSB of VX prior to that shift was set, or to 0 if it was unset.
+                    printf("Left shift V%X (0x%02X) by 1 bit\n", X, VX);
+                    break;
+                default:
+                    printf("Unimplemented Opcode");
+                    break; // unimplemented or invalid opcode
+            }
+            break;
+        case 0x09:
+            // 0x9XY0: Skips the next instruction if VX != VY
+            printf("If V%X  (0x%02X) is not equal to V%X (0x%02X), then skip the next instruction.\n", 
+                    X, VX,
+                    Y, VY);
+            break;
+        case 0x0A:
+            printf("Set the Instruction Register I to 0x%04X\n", NNN);
+            break;
+        case 0x0B:
+            // 0xBNNN: Jump to the address at V0 + NNN
+            printf("Set PC to V0 (0x%02X) + NNN (0x%04X) = 0x%04X\n", V0, NNN, 
+                                                                    V0 + NNN);
+            break;
+        case 0x0C:
+            // 0xCXNN: Set register Vx to NN & rand(0, 255)
+            printf("Set register V%X to NN(0x%02X) & random byte\n", X, NN);
+            break;
+        case 0x0D:
+            // 0xDXYN: Draw pixel Vx, Vy, heignt N and width 8
+            printf("Drawing sprite with height N (%u), at coords V%X (%02X), V%X, (%02X), from memory location I (0x%04X)\n",
+                    N, X, VX, 
+                                          Y, VY, I);
+            break;
+        case 0x0E:
+            if(NN == 0x9E) 
+            {
+                //0xEX9E: Skip the next instruction if the key is pressed:
+                printf("Skip next instruction if key stored in V%X (%X) is being pressed %d\n", 
+                        X, VX, key);
+
+            } else if (NN == 0xA1) {
+                //0xEXA1: Skip the next instruction if the key is not pressed:
+                printf("Skip next instruction if key stored in V%X (%X) is  not being pressed %d\n", 
+                        X, VX, key);
+            }
+            break;
+        case 0x0F:
+            switch(NN)
+            {
+                case 0x0A:
+                    // 0xFX0A: A key press is awaited, and then stored in in Vx (Blocking operation, all instructions halted until next key event)
+                    printf("Wait until a key is pressed, store key in V%X\n", X);
+                    break;
+                case 0x07:
+                    // 0xFX07: Set Vx to the value of the delay timer
+                    printf("Set value of V%X to the value of the delay timer (0x%X)\n", X, delay_timer);
+                    break;
+                case 0x15:
+                    // 0xFX15: Set the delay timer to value of Vx
+                    printf("Set the value of the delay timer to V%X (0x%02X)\n", X, VX);
+                    break;
+                case 0x18:
+                    // 0xFX18: Set the sound timer to the value of Vx
+                    printf("Set the value of the sound timer to V%X (0x%02X)\n", X, VX);
+                    break;
+                case 0x1E:
+                    // 0xFX1E: Add Vx to I ie I += Vx
+                    printf("Increment I (0x%04X) by V%X (%02X) = 0x%04X\n",
+                            I, X, VX, I + VX);
+                    break;
+                case 0x29:
+                    // 0xFX29: Set I to the location of the sprite for the character in Vx
+                    // Vx has 0x0 - 0xF so it is the sprite for one of those characters
+                    // Font is stored at start of RAM.
+                    // So offset into RAM by 5 * Vx
+                    printf("Set I to sprite location in memory for character in V%X =  (0x%02X) * 5\n", 
+                            X, VX);
+                    break;
+                case 0x33:
+                    // 0xFX33: Stores the binary-coded decimal representation of VX, 
+                    // with the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
+                    printf("Store BCD representation of V%X (%02X) at memory offset in I (0x%04X)\n",
+                            X, VX, I );
+                    break;
+                case 0x55:
+                    // 0xFX55: Store V0 to VX in ram location starting at location in I.
+                    printf("Reg dump V0 to V%X (inclusive) in ram location starting at I (0x%04X)\n", 
+                            X, I);
+                    break;
+                case 0x65:
+                    // 0xFX65: Store V0 to VX in ram location starting at location in I.
+                    printf("Reg load ram location starting at I (0x%04X) into V0 to V%X (inclusive)\n", 
+                            I, X);
+                    break;
+                default:
+                    printf("Unimplemented opcode\n");
+                    break;
+            }
+            break;
+        default:
+            printf("Unimplemented opcode\n");
+            break; // Uninimplemented / invalid opcode
+    }
+}
+
+// Print the registers a record says changed
+static void describe_changes(const uint8_t record[])
+{
+    const uint16_t changed = get_u16(&record[14]);
+    uint32_t offset = TRACE_RECORD_SIZE;
+
+    printf("    Changed:");
+    for(uint8_t i = 0; i < 16; i++)
+    {
+        if(changed & (1u << i)) printf(" V%X = 0x%02X", i, record[offset++]);
+    }
+    if(record[13] & TRACE_I_CHANGED) printf(" I = 0x%04X", get_u16(&record[offset]));
+    printf("%s\n", changed || (record[13] & TRACE_I_CHANGED) ? "" : " nothing");
+}
+
+// Bytes taken by the record, header included
+static uint32_t record_size(const uint8_t record[])
+{
+    return TRACE_RECORD_SIZE + __builtin_popcount(get_u16(&record[14])) + (record[13] & TRACE_I_CHANGED ? 2 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    const bool changes = argc == 3 && !strcmp(argv[1], "--changes");
+    if(argc != 2 && !changes)
+    {
+        fprintf(stderr, "Usage: %s [--changes] <trace_path>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *path = argv[argc - 1];
+
+    FILE *file = fopen(path, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Trace %s is invalid or does not exist\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    if(fread(header, sizeof header, 1, file) != 1 || memcmp(header, magic, sizeof magic) != 0 ||
+       get_u16(&header[4]) != TRACE_VERSION || get_u16(&header[6]) != TRACE_HEADER_SIZE)
+    {
+        fprintf(stderr, "%s is not a supported CHIP8 trace\n", path);
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Records are read header first, then their variable-length tail
+    uint8_t record[TRACE_MAX_RECORD];
+    uint64_t records = 0;
+    size_t read;
+    while((read = fread(record, 1, TRACE_RECORD_SIZE, file)) == TRACE_RECORD_SIZE)
+    {
+        const uint32_t tail = record_size(record) - TRACE_RECORD_SIZE;
+        if(fread(&record[TRACE_RECORD_SIZE], 1, tail, file) != tail)
+        {
+            read = 1;
+            break;
+        }
+
+        describe(record);
+        if(changes) describe_changes(record);
+        records++;
+    }
+    const bool ok = read == 0 && !ferror(file);
+    fclose(file);
+
+    // A crash can cut the last record short, everything before it is still good
+    if(!ok)
+    {
+        fprintf(stderr, "Trace %s is truncated after %llu records\n", path, (unsigned long long) records);
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+}